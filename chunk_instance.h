@@ -0,0 +1,64 @@
+/**
+ * chunk_instance.h
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#ifndef TERRAINER_CHUNK_INSTANCE_H
+#define TERRAINER_CHUNK_INSTANCE_H
+
+#ifdef TERRAINER_MODULE
+#include "core/typedefs.h"
+#endif // TERRAINER_MODULE
+
+#ifdef TERRAINER_GDEXTENSION
+#include <godot_cpp/core/defs.hpp>
+#endif // TERRAINER_GDEXTENSION
+
+#include <cstring>
+
+namespace Terrainer {
+
+/**
+ *
+ * ChunkInstance
+ * Per-instance data of a terrain chunk, in the custom data of its multimesh instance.
+ *
+ * x, y: morph constants of the node LOD, the shader morphs by
+ *       1 - clamp(x - distance * y, 0, 1).
+ * z:    bits read with floatBitsToUint(), texture layer in bits 0-15 and node flags
+ *       (LOD and neighbour bits, as in LODQuadTree::QTNode) in bits 16-23. Bit 30 is
+ *       always set, so the bits are a normal float that survives any copy.
+ * w:    unused.
+ */
+struct ChunkInstance {
+    static const int CUSTOM_FLOATS = 4;
+    static const int MAX_TEXTURE_LAYER = 0xFFFF;
+    static const uint32_t NORMAL_BIT = 1u << 30;
+
+    _FORCE_INLINE_ static void encode(float *r_custom, int p_texture_layer, uint8_t p_flags, float p_morph_c1, float p_morph_c2) {
+        const uint32_t bits = uint32_t(p_texture_layer & MAX_TEXTURE_LAYER) | (uint32_t(p_flags) << 16) | NORMAL_BIT;
+        r_custom[0] = p_morph_c1;
+        r_custom[1] = p_morph_c2;
+        memcpy(&r_custom[2], &bits, sizeof(float));
+        r_custom[3] = 0.0f;
+    }
+
+    _FORCE_INLINE_ static void decode(const float *p_custom, int &r_texture_layer, uint8_t &r_flags, float &r_morph_c1, float &r_morph_c2) {
+        uint32_t bits;
+        memcpy(&bits, &p_custom[2], sizeof(float));
+        r_texture_layer = int(bits & MAX_TEXTURE_LAYER);
+        r_flags = uint8_t(bits >> 16);
+        r_morph_c1 = p_custom[0];
+        r_morph_c2 = p_custom[1];
+    }
+};
+
+} // namespace Terrainer
+
+#endif // TERRAINER_CHUNK_INSTANCE_H
@@ -0,0 +1,82 @@
+/**
+ * chunk_mesh.cpp
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#include "chunk_mesh.h"
+
+#ifdef TERRAINER_MODULE
+#include "core/templates/local_vector.h"
+#endif // TERRAINER_MODULE
+
+#ifdef TERRAINER_GDEXTENSION
+#include <godot_cpp/templates/local_vector.hpp>
+#endif // TERRAINER_GDEXTENSION
+
+using namespace Terrainer;
+
+void Terrainer::chunk_mesh_build_indices(int p_chunk_size, int p_band_quads, int32_t *r_indices) {
+    ERR_FAIL_COND(p_chunk_size <= 0);
+    const int num_points = p_chunk_size + 1;
+    const int band_quads = p_band_quads > 0 ? MIN(p_band_quads, p_chunk_size) : p_chunk_size;
+    int32_t *index = r_indices;
+
+    for (int bx = 0; bx < p_chunk_size; bx += band_quads) {
+        const int band_end = MIN(bx + band_quads, p_chunk_size);
+
+        for (int iz = 0; iz < p_chunk_size; ++iz) {
+            for (int ix = bx; ix < band_end; ++ix) {
+                const int32_t i1 = ix + num_points * iz;
+                const int32_t i2 = i1 + 1;
+                const int32_t i3 = i1 + num_points;
+                const int32_t i4 = i3 + 1;
+
+                if (((ix + iz) & 1) == 0) {
+                    *index++ = i1;
+                    *index++ = i2;
+                    *index++ = i3;
+                    *index++ = i2;
+                    *index++ = i4;
+                    *index++ = i3;
+                } else {
+                    *index++ = i1;
+                    *index++ = i2;
+                    *index++ = i4;
+                    *index++ = i1;
+                    *index++ = i4;
+                    *index++ = i3;
+                }
+            }
+        }
+    }
+}
+
+float Terrainer::chunk_mesh_acmr(const int32_t *p_indices, int p_index_count, int p_vertex_count, int p_cache_size) {
+    ERR_FAIL_COND_V(p_index_count < 3 || p_cache_size <= 0, 0.0f);
+    // A vertex is cached while fewer than p_cache_size misses happened since its own.
+    LocalVector<int64_t> missed_at;
+    missed_at.resize(p_vertex_count);
+
+    for (int64_t &m : missed_at) {
+        m = -int64_t(p_cache_size) - 1;
+    }
+
+    int64_t misses = 0;
+
+    for (int i = 0; i < p_index_count; ++i) {
+        const int32_t v = p_indices[i];
+        ERR_FAIL_INDEX_V(v, p_vertex_count, 0.0f);
+
+        if (misses - missed_at[v] >= p_cache_size) {
+            missed_at[v] = ++misses;
+        }
+    }
+
+    return float(misses) / float(p_index_count / 3);
+}
@@ -0,0 +1,72 @@
+/**
+ * chunk_mesh.h
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#ifndef TERRAINER_CHUNK_MESH_H
+#define TERRAINER_CHUNK_MESH_H
+
+#ifdef TERRAINER_MODULE
+#include "core/typedefs.h"
+#endif // TERRAINER_MODULE
+
+#ifdef TERRAINER_GDEXTENSION
+#include <godot_cpp/core/defs.hpp>
+#endif // TERRAINER_GDEXTENSION
+
+#include <cstdint>
+
+namespace Terrainer {
+
+/**
+ * Shared grid mesh of a terrain chunk.
+ *
+ * The (p_chunk_size + 1) squared vertices are row-major, so the vertex index alone gives
+ * the grid point: x = VERTEX_ID % (p_chunk_size + 1), z = VERTEX_ID / (p_chunk_size + 1).
+ * A shader can pull heights and positions from it without reading the vertex positions.
+ * Quads with even x + z are split by the (1, 0) - (0, 1) diagonal, odd ones by the
+ * (0, 0) - (1, 1) one, as node_error_build() expects.
+ */
+
+// Post-transform vertex cache size assumed when ordering the triangles, in vertices.
+static const int CHUNK_MESH_CACHE_SIZE = 16;
+
+_FORCE_INLINE_ int chunk_mesh_vertex_count(int p_chunk_size) {
+    return (p_chunk_size + 1) * (p_chunk_size + 1);
+}
+
+_FORCE_INLINE_ int chunk_mesh_index_count(int p_chunk_size) {
+    return 6 * p_chunk_size * p_chunk_size;
+}
+
+/**
+ * Quads per band so that two rows of band vertices stay in a FIFO cache of p_cache_size
+ * vertices, then every vertex but the first row of a band is transformed once.
+ */
+_FORCE_INLINE_ int chunk_mesh_band_quads(int p_cache_size) {
+    return MAX(p_cache_size / 2 - 1, 1);
+}
+
+/**
+ * Fill chunk_mesh_index_count() indices. The quads are walked in vertical bands of
+ * p_band_quads columns, row after row inside a band. A band as wide as the chunk is
+ * the plain row-major order.
+ */
+void chunk_mesh_build_indices(int p_chunk_size, int p_band_quads, int32_t *r_indices);
+
+/**
+ * Average cache miss ratio, transformed vertices per triangle, of p_index_count indices
+ * drawn through a FIFO vertex cache of p_cache_size entries. 0.5 is the best possible
+ * on a large grid, 3 the worst.
+ */
+float chunk_mesh_acmr(const int32_t *p_indices, int p_index_count, int p_vertex_count, int p_cache_size);
+
+} // namespace Terrainer
+
+#endif // TERRAINER_CHUNK_MESH_H
@@ -2,6 +2,14 @@ def can_build(env, platform):
     return not env["disable_3d"]
 
 
+def get_opts(platform):
+    from SCons.Variables import BoolVariable
+
+    return [
+        BoolVariable("terrainer_wide_cell_keys", "Use 32-bit cell coordinates, for maps over 65536 sectors per axis", False),
+    ]
+
+
 def configure(env):
     pass
 
@@ -0,0 +1,222 @@
+/**
+ * horizon_buffer.h
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#ifndef TERRAINER_HORIZON_BUFFER_H
+#define TERRAINER_HORIZON_BUFFER_H
+
+#ifdef TERRAINER_MODULE
+#include "core/math/aabb.h"
+#include "core/math/math_funcs.h"
+#endif // TERRAINER_MODULE
+
+#ifdef TERRAINER_GDEXTENSION
+#include <godot_cpp/core/math.hpp>
+#include <godot_cpp/variant/aabb.hpp>
+#endif // TERRAINER_GDEXTENSION
+
+namespace Terrainer {
+
+/**
+ *
+ * HorizonBuffer
+ * Conservative occlusion horizon around a viewer, for terrain self-occlusion.
+ *
+ * Azimuth around the viewer is split in bins. Each bin keeps a slope (height over
+ * horizontal distance) and the distance beyond which every ray of the bin below
+ * that slope is known to hit terrain. Occluders are boxes whose bottom is covered
+ * by terrain, so only their min height is trusted. A box is occluded when, in every
+ * bin it spans, it lies beyond the bin distance and below the bin slope.
+ *
+ * Both tests are conservative whatever the order in which boxes are added, but
+ * boxes added front to back make a much tighter horizon.
+ */
+class HorizonBuffer {
+private:
+    static const int BIN_COUNT = 1024;
+    static const int BIN_MASK = BIN_COUNT - 1;
+
+    real_t slopes[BIN_COUNT];
+    real_t distances[BIN_COUNT];
+    Vector3 viewer;
+    bool empty = true;
+
+    // Azimuth span of the box footprint, in bins, and its horizontal distance range.
+    // Fails if the viewer is above the footprint.
+    _FORCE_INLINE_ bool _get_span(const AABB &p_box, real_t &r_from, real_t &r_to, real_t &r_min_distance, real_t &r_max_distance) const {
+        const real_t x0 = p_box.position.x - viewer.x;
+        const real_t z0 = p_box.position.z - viewer.z;
+        const real_t x1 = x0 + p_box.size.x;
+        const real_t z1 = z0 + p_box.size.z;
+
+        if (x0 <= 0.0 && x1 >= 0.0 && z0 <= 0.0 && z1 >= 0.0) {
+            return false;
+        }
+
+        const real_t nx = x0 > 0.0 ? x0 : (x1 < 0.0 ? x1 : 0.0);
+        const real_t nz = z0 > 0.0 ? z0 : (z1 < 0.0 ? z1 : 0.0);
+        const real_t fx = MAX(ABS(x0), ABS(x1));
+        const real_t fz = MAX(ABS(z0), ABS(z1));
+        r_min_distance = Math::sqrt(nx * nx + nz * nz);
+        r_max_distance = Math::sqrt(fx * fx + fz * fz);
+
+        if (r_min_distance < CMP_EPSILON) {
+            return false;
+        }
+
+        // Corner angles relative to the center one, the footprint spans less than half a turn.
+        const real_t to_bins = BIN_COUNT / Math_TAU;
+        const real_t center = Math::atan2(0.5 * (z0 + z1), 0.5 * (x0 + x1));
+        const real_t xs[2] = { x0, x1 };
+        const real_t zs[2] = { z0, z1 };
+        real_t from = 0.0;
+        real_t to = 0.0;
+
+        for (int i = 0; i < 4; ++i) {
+            real_t delta = Math::atan2(zs[i >> 1], xs[i & 1]) - center;
+
+            if (delta > Math_PI) {
+                delta -= Math_TAU;
+            } else if (delta < -Math_PI) {
+                delta += Math_TAU;
+            }
+
+            from = MIN(from, delta);
+            to = MAX(to, delta);
+        }
+
+        r_from = (center + from) * to_bins;
+        r_to = (center + to) * to_bins;
+        return true;
+    }
+
+    // Distance at which a ray leaves the footprint, the ray must cross it.
+    _FORCE_INLINE_ static real_t _get_exit_distance(real_t p_angle, real_t p_x0, real_t p_z0, real_t p_x1, real_t p_z1) {
+        const real_t dx = Math::cos(p_angle);
+        const real_t dz = Math::sin(p_angle);
+        const real_t tx = dx > CMP_EPSILON ? p_x1 / dx : (dx < -CMP_EPSILON ? p_x0 / dx : Math_INF);
+        const real_t tz = dz > CMP_EPSILON ? p_z1 / dz : (dz < -CMP_EPSILON ? p_z0 / dz : Math_INF);
+        return MIN(tx, tz);
+    }
+
+public:
+    void reset(const Vector3 &p_viewer) {
+        viewer = p_viewer;
+
+        if (empty) {
+            return;
+        }
+
+        for (int i = 0; i < BIN_COUNT; ++i) {
+            slopes[i] = -Math_INF;
+            distances[i] = 0.0;
+        }
+
+        empty = true;
+    }
+
+    bool is_occluded(const AABB &p_box) const {
+        real_t from, to, min_distance, max_distance;
+
+        if (empty || !_get_span(p_box, from, to, min_distance, max_distance)) {
+            return false;
+        }
+
+        // Steepest slope of a ray reaching the box.
+        const real_t top = p_box.position.y + p_box.size.y - viewer.y;
+        const real_t slope = top / (top > 0.0 ? min_distance : max_distance);
+        const int first = int(Math::floor(from));
+        const int last = int(Math::floor(to));
+
+        for (int i = first; i <= last; ++i) {
+            const int bin = i & BIN_MASK;
+
+            if (slopes[bin] <= slope || distances[bin] > min_distance) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void add_occluder(const AABB &p_box) {
+        real_t from, to, min_distance, max_distance;
+
+        if (!_get_span(p_box, from, to, min_distance, max_distance)) {
+            return;
+        }
+
+        // Only the bins whose rays all cross the footprint.
+        const int first = int(Math::ceil(from));
+        const int last = int(Math::floor(to)) - 1;
+
+        if (first > last) {
+            return;
+        }
+
+        if (empty) {
+            for (int i = 0; i < BIN_COUNT; ++i) {
+                slopes[i] = -Math_INF;
+                distances[i] = 0.0;
+            }
+
+            empty = false;
+        }
+
+        const real_t x0 = p_box.position.x - viewer.x;
+        const real_t z0 = p_box.position.z - viewer.z;
+        const real_t x1 = x0 + p_box.size.x;
+        const real_t z1 = z0 + p_box.size.z;
+        const real_t bottom = p_box.position.y - viewer.y;
+        const real_t to_bins = BIN_COUNT / Math_TAU;
+        const real_t xs[2] = { x0, x1 };
+        const real_t zs[2] = { z0, z1 };
+        int corner_bins[4];
+        real_t corner_distances[4];
+
+        for (int i = 0; i < 4; ++i) {
+            const real_t x = xs[i & 1];
+            const real_t z = zs[i >> 1];
+            corner_bins[i] = int(Math::floor(Math::atan2(z, x) * to_bins)) & BIN_MASK;
+            corner_distances[i] = Math::sqrt(x * x + z * z);
+        }
+
+        real_t exit = _get_exit_distance(first / to_bins, x0, z0, x1, z1);
+
+        for (int i = first; i <= last; ++i) {
+            const int bin = i & BIN_MASK;
+            // Farthest point where a ray of the bin leaves the footprint, at a bin edge or a corner.
+            const real_t next_exit = _get_exit_distance((i + 1) / to_bins, x0, z0, x1, z1);
+            real_t bin_distance = MAX(exit, next_exit);
+            exit = next_exit;
+
+            for (int j = 0; j < 4; ++j) {
+                if (corner_bins[j] == bin) {
+                    bin_distance = MAX(bin_distance, corner_distances[j]);
+                }
+            }
+
+            // Shallowest slope blocked by the bottom of the box, wherever the ray crosses it.
+            const real_t slope = bottom / (bottom > 0.0 ? bin_distance : min_distance);
+
+            if (bin_distance <= distances[bin]) {
+                // In front of the current occluder, both block rays beyond it.
+                slopes[bin] = MAX(slopes[bin], slope);
+            } else if (slope > slopes[bin]) {
+                slopes[bin] = slope;
+                distances[bin] = bin_distance;
+            }
+        }
+    }
+};
+
+} // namespace Terrainer
+
+#endif // TERRAINER_HORIZON_BUFFER_H
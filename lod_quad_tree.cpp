@@ -14,17 +14,234 @@
 #include "utils/compat_marshalls.h"
 #include "utils/math.h"
 
+#if !defined(REAL_T_IS_DOUBLE) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define TERRAINER_SELECT_SSE
+#include <emmintrin.h>
+#elif !defined(REAL_T_IS_DOUBLE) && (defined(__aarch64__) || defined(_M_ARM64))
+#define TERRAINER_SELECT_NEON
+#include <arm_neon.h>
+#endif
+
 using namespace Terrainer;
 
+namespace {
+
+// Four boxes in structure of arrays form, per axis.
+struct BoxesSoA {
+    alignas(16) real_t min[3][4];
+    alignas(16) real_t max[3][4];
+};
+
+#if defined(TERRAINER_SELECT_SSE)
+typedef __m128 Float4;
+
+_FORCE_INLINE_ Float4 f4_load(const real_t *p_v) { return _mm_load_ps(p_v); }
+_FORCE_INLINE_ Float4 f4_set(real_t p_v) { return _mm_set1_ps(p_v); }
+_FORCE_INLINE_ Float4 f4_add(Float4 p_a, Float4 p_b) { return _mm_add_ps(p_a, p_b); }
+_FORCE_INLINE_ Float4 f4_sub(Float4 p_a, Float4 p_b) { return _mm_sub_ps(p_a, p_b); }
+_FORCE_INLINE_ Float4 f4_mul(Float4 p_a, Float4 p_b) { return _mm_mul_ps(p_a, p_b); }
+_FORCE_INLINE_ Float4 f4_max(Float4 p_a, Float4 p_b) { return _mm_max_ps(p_a, p_b); }
+_FORCE_INLINE_ Float4 f4_min(Float4 p_a, Float4 p_b) { return _mm_min_ps(p_a, p_b); }
+_FORCE_INLINE_ Float4 f4_abs(Float4 p_a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), p_a); }
+_FORCE_INLINE_ void f4_store(real_t *r_v, Float4 p_a) { _mm_store_ps(r_v, p_a); }
+_FORCE_INLINE_ Float4 f4_select_le(Float4 p_a, Float4 p_b, Float4 p_x, Float4 p_y) {
+    const __m128 m = _mm_cmple_ps(p_a, p_b);
+    return _mm_or_ps(_mm_and_ps(m, p_x), _mm_andnot_ps(m, p_y));
+}
+_FORCE_INLINE_ int f4_gt_mask(Float4 p_a, Float4 p_b) { return _mm_movemask_ps(_mm_cmpgt_ps(p_a, p_b)); }
+_FORCE_INLINE_ int f4_le_mask(Float4 p_a, Float4 p_b) { return _mm_movemask_ps(_mm_cmple_ps(p_a, p_b)); }
+#elif defined(TERRAINER_SELECT_NEON)
+typedef float32x4_t Float4;
+
+_FORCE_INLINE_ int _u4_mask(uint32x4_t p_m) {
+    const uint32_t bits[4] = { 1, 2, 4, 8 };
+    return vaddvq_u32(vandq_u32(p_m, vld1q_u32(bits)));
+}
+
+_FORCE_INLINE_ Float4 f4_load(const real_t *p_v) { return vld1q_f32(p_v); }
+_FORCE_INLINE_ Float4 f4_set(real_t p_v) { return vdupq_n_f32(p_v); }
+_FORCE_INLINE_ Float4 f4_add(Float4 p_a, Float4 p_b) { return vaddq_f32(p_a, p_b); }
+_FORCE_INLINE_ Float4 f4_sub(Float4 p_a, Float4 p_b) { return vsubq_f32(p_a, p_b); }
+_FORCE_INLINE_ Float4 f4_mul(Float4 p_a, Float4 p_b) { return vmulq_f32(p_a, p_b); }
+_FORCE_INLINE_ Float4 f4_max(Float4 p_a, Float4 p_b) { return vmaxq_f32(p_a, p_b); }
+_FORCE_INLINE_ Float4 f4_min(Float4 p_a, Float4 p_b) { return vminq_f32(p_a, p_b); }
+_FORCE_INLINE_ Float4 f4_abs(Float4 p_a) { return vabsq_f32(p_a); }
+_FORCE_INLINE_ void f4_store(real_t *r_v, Float4 p_a) { vst1q_f32(r_v, p_a); }
+_FORCE_INLINE_ Float4 f4_select_le(Float4 p_a, Float4 p_b, Float4 p_x, Float4 p_y) { return vbslq_f32(vcleq_f32(p_a, p_b), p_x, p_y); }
+_FORCE_INLINE_ int f4_gt_mask(Float4 p_a, Float4 p_b) { return _u4_mask(vcgtq_f32(p_a, p_b)); }
+_FORCE_INLINE_ int f4_le_mask(Float4 p_a, Float4 p_b) { return _u4_mask(vcleq_f32(p_a, p_b)); }
+#else
+struct Float4 {
+    real_t v[4];
+};
+
+#define TERRAINER_F4_OP(m_name, m_expr)                                  \
+    _FORCE_INLINE_ Float4 m_name(Float4 p_a, Float4 p_b) {               \
+        Float4 r;                                                        \
+        for (int i = 0; i < 4; ++i) {                                    \
+            const real_t a = p_a.v[i];                                   \
+            const real_t b = p_b.v[i];                                   \
+            r.v[i] = m_expr;                                             \
+        }                                                                \
+        return r;                                                        \
+    }
+
+TERRAINER_F4_OP(f4_add, a + b)
+TERRAINER_F4_OP(f4_sub, a - b)
+TERRAINER_F4_OP(f4_mul, a * b)
+TERRAINER_F4_OP(f4_max, a > b ? a : b)
+TERRAINER_F4_OP(f4_min, a < b ? a : b)
+#undef TERRAINER_F4_OP
+
+_FORCE_INLINE_ Float4 f4_abs(Float4 p_a) { return { { ABS(p_a.v[0]), ABS(p_a.v[1]), ABS(p_a.v[2]), ABS(p_a.v[3]) } }; }
+
+_FORCE_INLINE_ void f4_store(real_t *r_v, Float4 p_a) {
+    for (int i = 0; i < 4; ++i) {
+        r_v[i] = p_a.v[i];
+    }
+}
+
+_FORCE_INLINE_ Float4 f4_select_le(Float4 p_a, Float4 p_b, Float4 p_x, Float4 p_y) {
+    Float4 r;
+
+    for (int i = 0; i < 4; ++i) {
+        r.v[i] = p_a.v[i] <= p_b.v[i] ? p_x.v[i] : p_y.v[i];
+    }
+
+    return r;
+}
+
+_FORCE_INLINE_ Float4 f4_load(const real_t *p_v) { return { { p_v[0], p_v[1], p_v[2], p_v[3] } }; }
+_FORCE_INLINE_ Float4 f4_set(real_t p_v) { return { { p_v, p_v, p_v, p_v } }; }
+
+_FORCE_INLINE_ int f4_gt_mask(Float4 p_a, Float4 p_b) {
+    return (p_a.v[0] > p_b.v[0]) | ((p_a.v[1] > p_b.v[1]) << 1) | ((p_a.v[2] > p_b.v[2]) << 2) | ((p_a.v[3] > p_b.v[3]) << 3);
+}
+
+_FORCE_INLINE_ int f4_le_mask(Float4 p_a, Float4 p_b) {
+    return (p_a.v[0] <= p_b.v[0]) | ((p_a.v[1] <= p_b.v[1]) << 1) | ((p_a.v[2] <= p_b.v[2]) << 2) | ((p_a.v[3] <= p_b.v[3]) << 3);
+}
+#endif
+
+_FORCE_INLINE_ void _boxes_to_soa(const AABB *p_boxes, BoxesSoA &r_boxes) {
+    for (int i = 0; i < 4; ++i) {
+        const Vector3 end = p_boxes[i].get_end();
+        r_boxes.min[0][i] = p_boxes[i].position.x;
+        r_boxes.min[1][i] = p_boxes[i].position.y;
+        r_boxes.min[2][i] = p_boxes[i].position.z;
+        r_boxes.max[0][i] = end.x;
+        r_boxes.max[1][i] = end.y;
+        r_boxes.max[2][i] = end.z;
+    }
+}
+
+// Bit i is set when box i is within sqrt(p_radius_sqrd) of p_point, as aabb_intersects_sphere.
+// Squared distances from p_point are written to r_distances_sqrd, if given.
+_FORCE_INLINE_ int _boxes_in_sphere(const BoxesSoA &p_boxes, const Vector3 &p_point, real_t p_radius_sqrd, real_t *r_distances_sqrd = nullptr) {
+    const Float4 zero = f4_set(0.0);
+    Float4 distance_sqrd = zero;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        const Float4 p = f4_set(p_point[axis]);
+        const Float4 d = f4_max(f4_max(f4_sub(f4_load(p_boxes.min[axis]), p), f4_sub(p, f4_load(p_boxes.max[axis]))), zero);
+        distance_sqrd = f4_add(distance_sqrd, f4_mul(d, d));
+    }
+
+    if (r_distances_sqrd) {
+        f4_store(r_distances_sqrd, distance_sqrd);
+    }
+
+    return f4_le_mask(distance_sqrd, f4_set(p_radius_sqrd));
+}
+
+// Test four boxes against the planes in p_plane_mask, the hinted one first. Bit i of the
+// result is set when every corner of box i is over some plane, and r_plane_masks[i] gets
+// the planes box i straddles. Only the corners nearest and farthest along each normal
+// are tested (n and p vertices), which classifies boxes exactly like testing all eight.
+// If r_slacks is given, it gets how far the planes can move before a result changes, and
+// r_inside_slacks the same for the planes each box is inside of.
+_FORCE_INLINE_ int _boxes_in_frustum(const BoxesSoA &p_boxes, const Plane *p_planes, int p_count, uint8_t p_plane_mask, std::atomic<uint8_t> &r_hint, uint8_t *r_plane_masks, real_t *r_slacks = nullptr, real_t *r_inside_slacks = nullptr) {
+    const Float4 min_x = f4_load(p_boxes.min[0]);
+    const Float4 min_y = f4_load(p_boxes.min[1]);
+    const Float4 min_z = f4_load(p_boxes.min[2]);
+    const Float4 max_x = f4_load(p_boxes.max[0]);
+    const Float4 max_y = f4_load(p_boxes.max[1]);
+    const Float4 max_z = f4_load(p_boxes.max[2]);
+    const int hint = r_hint.load(std::memory_order_relaxed);
+    int outside = 0;
+    const Float4 inf = f4_set(Math_INF);
+    Float4 slack = inf;
+    Float4 inside_slack = inf;
+
+    for (int i = 0; i < 4; ++i) {
+        r_plane_masks[i] = 0;
+    }
+
+    for (int j = -1; j < p_count; ++j) {
+        const int i = j < 0 ? hint : j;
+
+        if (i >= p_count || (j >= 0 && i == hint) || !(p_plane_mask & (1 << i))) {
+            continue;
+        }
+
+        const Plane &plane = p_planes[i];
+        const Float4 nx = f4_set(plane.normal.x);
+        const Float4 ny = f4_set(plane.normal.y);
+        const Float4 nz = f4_set(plane.normal.z);
+        const Float4 d = f4_set(plane.d);
+        const bool px = plane.normal.x >= 0.0;
+        const bool py = plane.normal.y >= 0.0;
+        const bool pz = plane.normal.z >= 0.0;
+        const Float4 near_dot = f4_add(f4_add(f4_mul(nx, px ? min_x : max_x), f4_mul(ny, py ? min_y : max_y)), f4_mul(nz, pz ? min_z : max_z));
+        const Float4 far_dot = f4_add(f4_add(f4_mul(nx, px ? max_x : min_x), f4_mul(ny, py ? max_y : min_y)), f4_mul(nz, pz ? max_z : min_z));
+        const int rejected = f4_gt_mask(near_dot, d) & ~outside;
+
+        if (r_slacks) {
+            const Float4 far_slack = f4_sub(d, far_dot);
+            slack = f4_min(slack, f4_min(f4_abs(f4_sub(near_dot, d)), f4_abs(far_slack)));
+            inside_slack = f4_min(inside_slack, f4_select_le(far_dot, d, far_slack, inf));
+        }
+
+        const int straddling = ~f4_le_mask(far_dot, d) & ~rejected;
+
+        for (int k = 0; k < 4; ++k) {
+            r_plane_masks[k] |= ((straddling >> k) & 1) << i;
+        }
+
+        if (rejected) {
+            outside |= rejected;
+
+            if (i != hint) {
+                r_hint.store(i, std::memory_order_relaxed);
+            }
+
+            if (outside == 0xF) {
+                break;
+            }
+        }
+    }
+
+    if (r_slacks) {
+        f4_store(r_slacks, slack);
+        f4_store(r_inside_slacks, inside_slack);
+    }
+
+    return outside;
+}
+
+} // namespace
+
 void LODQuadTree::set_map_info(int p_chunk_size, int p_region_size, const Vector2i p_world_regions, const Vector3 &p_map_scale) {
     chunk_size = p_chunk_size;
     region_size = p_region_size;
     world_size = p_world_regions * region_size;
     map_scale = p_map_scale;
+    selection_cache_valid = false;
 }
 
 int LODQuadTree::set_lod_levels(real_t p_far_view, int p_lod_detailed_chunks_radius) {
     lod_levels = 1;
+    selection_cache_valid = false;
     const real_t radius0 = LOD0_RADIUS_FACTOR * p_lod_detailed_chunks_radius * chunk_size * MAX(map_scale.x, map_scale.z);
     real_t level_radius = radius0;
     real_t current_radius = 0.0;
@@ -62,21 +279,431 @@ int LODQuadTree::set_lod_levels(real_t p_far_view, int p_lod_detailed_chunks_rad
         current_radius += level_radius;
     }
 
+    // Nodes morph into their parent over the end of their range.
+    lod_morph.resize(lod_levels);
+    real_t prev_range = 0.0;
+
+    for (int i = 0; i < lod_levels; ++i) {
+        const real_t end = lod_visibility_range[i];
+        const real_t start = prev_range + (end - prev_range) * DEFAULT_MORPH_START_RATIO;
+        lod_morph[i] = Vector2(end / (end - start), 1.0 / (end - start));
+        prev_range = end;
+    }
+
     sector_count_x = Math::ceil((real_t)world_size.x / (real_t)sector_size);
     sector_count_z = Math::ceil((real_t)world_size.y / (real_t)sector_size);
     lods_count.resize(lod_levels);
-    real_t offset_x = (real_t)(world_size.x / 2) * chunk_size * map_scale.x;
-    real_t offset_z = (real_t)(world_size.y / 2) * chunk_size * map_scale.z;
-    world_offset = Vector3(-offset_x, 0.0, -offset_z);
+    _update_origin();
     return num_nodes;
 }
 
-LODQuadTree::NodeSelectionResult LODQuadTree::select_sector_nodes(const Vector3 &p_viewer_position, CellKey p_sector, const Ref<MapStorage> &p_storage, int p_stop_at_lod_level) {
-    if (p_sector.cell.x >= sector_count_x || p_sector.cell.z >= sector_count_z) {
-        return OutOfMap;
+void LODQuadTree::_update_origin() {
+    origin_chunk = world_size / 2 + origin_shift;
+    world_offset = Vector3(-origin_chunk.x * chunk_size * map_scale.x, 0.0, -origin_chunk.y * chunk_size * map_scale.z);
+}
+
+void LODQuadTree::set_origin_shift(const Vector2i &p_shift) {
+    if (origin_shift == p_shift) {
+        return;
+    }
+
+    origin_shift = p_shift;
+    _update_origin();
+    selection_cache_valid = false;
+}
+
+struct LODQuadTree::SelectionBatch {
+    const LODQuadTree *tree = nullptr;
+    Vector3 viewer_position;
+    const Ref<MapStorage> *storage = nullptr;
+    SectorSelection *sectors = nullptr;
+    SectorCache *const *caches = nullptr;
+    const SelectionView *views = nullptr;
+    int view_count = 0;
+};
+
+void LODQuadTree::_select_sector(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, SectorSelection &r_selection, HorizonBuffer *p_horizon, SectorCache *p_cache) const {
+    r_selection.nodes.clear();
+
+    if (r_selection.sector.cell.x >= sector_count_x || r_selection.sector.cell.z >= sector_count_z) {
+        r_selection.result = OutOfMap;
+        return;
+    }
+
+    r_selection.result = _lod_select(p_viewer_position, p_storage, NodeKey(r_selection.sector, CellKey()), r_selection.stop_at_lod_level, r_selection, p_horizon, p_cache);
+
+    if (p_cache) {
+        p_cache->current = 1 - p_cache->current;
+        p_cache->viewer_position = p_viewer_position;
+        p_cache->nodes = r_selection.nodes;
+    }
+}
+
+void LODQuadTree::_select_sector_task(void *p_batch, uint32_t p_index) {
+    const SelectionBatch *batch = static_cast<const SelectionBatch *>(p_batch);
+    SectorCache *cache = batch->caches ? batch->caches[p_index] : nullptr;
+    batch->tree->_select_sector(batch->viewer_position, *batch->storage, batch->sectors[p_index], nullptr, cache);
+}
+
+void LODQuadTree::_update_selection_cache(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, const SectorSelection *p_sectors, int p_count) {
+    // Any other change of the frustum than a translation, or of the LOD parameters, changes everything.
+    bool valid = selection_cache_valid && cached_plane_count == frustum_plane_count && cached_screen_error_mode == screen_error_mode && cached_screen_error_orthogonal == screen_error_orthogonal && cached_max_screen_error == max_screen_error && cached_screen_error_scale == screen_error_scale;
+    // A finite coarsen_distance moves every frame the budget is adjusted. The nodes it
+    // decides on are bounded by their slack, so the change is taken as viewer motion.
+    // Only turning it on or off changes everything.
+    valid = valid && (cached_coarsen_distance < Math_INF) == (coarsen_distance < Math_INF);
+    coarsen_moved = valid && coarsen_distance < Math_INF ? ABS(coarsen_distance - cached_coarsen_distance) : 0.0;
+    cached_coarsen_distance = coarsen_distance;
+    real_t max_normal_length = 0.0;
+
+    for (int i = 0; i < frustum_plane_count; ++i) {
+        valid = valid && cached_plane_normals[i] == frustum_planes[i].normal;
+        cached_plane_normals[i] = frustum_planes[i].normal;
+        max_normal_length = MAX(max_normal_length, frustum_planes[i].normal.length());
+    }
+
+    if (!valid) {
+        selection_cache.clear();
+        cached_plane_count = frustum_plane_count;
+        cached_screen_error_mode = screen_error_mode;
+        cached_screen_error_orthogonal = screen_error_orthogonal;
+        cached_max_screen_error = max_screen_error;
+        cached_screen_error_scale = screen_error_scale;
+        selection_cache_valid = true;
+    }
+
+    // Rounding errors grow with the magnitude of the coordinates involved.
+    const real_t world_extent = MAX(world_size.x * ABS(map_scale.x), world_size.y * ABS(map_scale.z)) * chunk_size;
+    const real_t magnitude = p_viewer_position.abs().max_axis_value() + world_extent + UINT16_MAX * ABS(map_scale.y) + lod_visibility_range[lod_levels - 1];
+    slack_epsilon = SLACK_RELATIVE_EPSILON * magnitude;
+    slack_plane_scale = max_normal_length > 0.0 ? 1.0 / max_normal_length : 0.0;
+
+    selection_frame++;
+    sector_caches.resize(p_count);
+
+    for (int i = 0; i < p_count; ++i) {
+        const SectorSelection &selection = p_sectors[i];
+        SectorCache &cache = selection_cache[selection.sector];
+        const bool loaded = p_storage->is_sector_loaded(selection.sector);
+
+        if (cache.frame == 0 || cache.stop_at_lod_level != selection.stop_at_lod_level || cache.loaded != loaded) {
+            cache.records[cache.current].clear();
+            cache.stop_at_lod_level = selection.stop_at_lod_level;
+            cache.loaded = loaded;
+        }
+
+        cache.frame = selection_frame;
+        sector_caches[i] = &cache;
+    }
+
+    // Forget the sectors out of view.
+    LocalVector<CellKey> unused;
+
+    for (KeyValue<CellKey, SectorCache> &kv : selection_cache) {
+        if (kv.value.frame != selection_frame) {
+            unused.push_back(kv.key);
+        }
+    }
+
+    for (const CellKey &key : unused) {
+        selection_cache.erase(key);
+    }
+}
+
+uint32_t LODQuadTree::_find_child_record(const LocalVector<SubtreeRecord> &p_records, uint32_t p_parent, CellKey p_cell) {
+    for (uint32_t i = p_parent + 1; i < p_records[p_parent].end; i = p_records[i].end) {
+        if (p_records[i].cell == p_cell) {
+            return i;
+        }
+    }
+
+    return NO_RECORD;
+}
+
+void LODQuadTree::_reuse_subtree(const SectorCache &p_cache, uint32_t p_record, real_t p_moved, LocalVector<SubtreeRecord> &r_records, SectorSelection &r_selection) {
+    const LocalVector<SubtreeRecord> &cached = p_cache.records[p_cache.current];
+    const SubtreeRecord &top = cached[p_record];
+    // Offsets from the previous selection to the new one, wrapping is fine.
+    const uint32_t record_offset = r_records.size() - p_record;
+    const uint32_t node_offset = r_selection.nodes.size() - top.nodes_begin;
+
+    for (uint32_t i = p_record; i < top.end; ++i) {
+        SubtreeRecord record = cached[i];
+        record.end += record_offset;
+        record.nodes_begin += node_offset;
+        record.nodes_end += node_offset;
+        // Relative to the new viewer position.
+        record.slack -= p_moved;
+        r_records.push_back(record);
+    }
+
+    for (uint32_t i = top.nodes_begin; i < top.nodes_end; ++i) {
+        r_selection.nodes.push_back(p_cache.nodes[i]);
+    }
+}
+
+void LODQuadTree::select_sectors(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, SectorSelection *p_sectors, int p_count) {
+    ERR_FAIL_COND_EDMSG(frustum.size() > MAX_FRUSTUM_PLANES, "Too many frustum planes.");
+    frustum_plane_count = frustum.size();
+
+    for (int i = 0; i < frustum_plane_count; ++i) {
+        frustum_planes[i] = frustum[i];
+    }
+
+    const real_t far_view = lod_visibility_range[lod_levels - 1];
+
+    // Give detail back once well under budget.
+    if (coarsen_distance < Math_INF && (node_budget <= 0 || selection_count < node_budget * COARSEN_RELAX_RATIO)) {
+        coarsen_distance = MAX(coarsen_distance, lod_visibility_range[0]) * COARSEN_GROW_FACTOR;
+
+        if (coarsen_distance >= far_view) {
+            coarsen_distance = Math_INF;
+        }
+    }
+
+    _select_pass(p_viewer_position, p_storage, p_sectors, p_count);
+
+    // Over budget, stop refining far away until it fits. If even the roots don't fit, keep them all.
+    for (int pass = 0; node_budget > 0 && selection_count > node_budget && pass < MAX_BUDGET_PASSES; ++pass) {
+        coarsen_distance = MIN(coarsen_distance, far_view) * COARSEN_SHRINK_FACTOR;
+        _select_pass(p_viewer_position, p_storage, p_sectors, p_count);
+    }
+}
+
+void LODQuadTree::_select_pass(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, SectorSelection *p_sectors, int p_count) {
+    const bool incremental = incremental_selection && !occlusion_culling;
+
+    if (incremental) {
+        _update_selection_cache(p_viewer_position, p_storage, p_sectors, p_count);
+    } else {
+        selection_cache.clear();
+        selection_cache_valid = false;
+    }
+
+    if (occlusion_culling || !parallel_selection || p_count < 2) {
+        // The horizon is shared by all sectors, they go one after the other.
+        HorizonBuffer *occlusion = occlusion_culling ? &horizon : nullptr;
+        horizon.reset(p_viewer_position);
+
+        for (int i = 0; i < p_count; ++i) {
+            _select_sector(p_viewer_position, p_storage, p_sectors[i], occlusion, incremental ? sector_caches[i] : nullptr);
+        }
+    } else {
+        SelectionBatch batch;
+        batch.tree = this;
+        batch.viewer_position = p_viewer_position;
+        batch.storage = &p_storage;
+        batch.sectors = p_sectors;
+        batch.caches = incremental ? sector_caches.ptr() : nullptr;
+        WorkerThreadPool::GroupID group = WorkerThreadPool::get_singleton()->add_native_group_task(_select_sector_task, &batch, p_count, parallel_tasks, true, SNAME("Terrainer LOD selection"));
+        WorkerThreadPool::get_singleton()->wait_for_group_task_completion(group);
+    }
+
+    // Merge in sector order, so the result doesn't depend on scheduling.
+    uint32_t count = 0;
+
+    for (int i = 0; i < p_count; ++i) {
+        count += p_sectors[i].nodes.size();
+    }
+
+    selected_buffer.resize(count);
+    selection_count = 0;
+
+    for (int i = 0; i < p_count; ++i) {
+        const LocalVector<QTNode> &nodes = p_sectors[i].nodes;
+
+        if (!nodes.is_empty()) {
+            memcpy(selected_buffer.ptr() + selection_count, nodes.ptr(), nodes.size() * sizeof(QTNode));
+            selection_count += nodes.size();
+        }
+    }
+}
+
+void LODQuadTree::select_views(const Ref<MapStorage> &p_storage, SectorSelection *p_sectors, int p_count, SelectionView *p_views, int p_view_count) {
+    ERR_FAIL_COND_EDMSG(p_view_count < 0 || p_view_count > MAX_VIEWS, "Too many selection views.");
+
+    for (int v = 0; v < p_view_count; ++v) {
+        ERR_FAIL_COND_EDMSG(p_views[v].plane_count < 0 || p_views[v].plane_count > MAX_FRUSTUM_PLANES, "Too many frustum planes.");
+    }
+
+    if (!parallel_selection || p_count < 2) {
+        for (int i = 0; i < p_count; ++i) {
+            _select_sector_views(p_storage, p_sectors[i], p_views, p_view_count);
+        }
+    } else {
+        SelectionBatch batch;
+        batch.tree = this;
+        batch.storage = &p_storage;
+        batch.sectors = p_sectors;
+        batch.views = p_views;
+        batch.view_count = p_view_count;
+        WorkerThreadPool::GroupID group = WorkerThreadPool::get_singleton()->add_native_group_task(_select_sector_views_task, &batch, p_count, parallel_tasks, true, SNAME("Terrainer LOD selection"));
+        WorkerThreadPool::get_singleton()->wait_for_group_task_completion(group);
+    }
+
+    // Merge each view in sector order.
+    for (int v = 0; v < p_view_count; ++v) {
+        uint32_t count = 0;
+
+        for (int i = 0; i < p_count; ++i) {
+            count += p_sectors[i].view_nodes[v].size();
+        }
+
+        LocalVector<QTNode> &view_nodes = p_views[v].nodes;
+        view_nodes.resize(count);
+        count = 0;
+
+        for (int i = 0; i < p_count; ++i) {
+            const LocalVector<QTNode> &nodes = p_sectors[i].view_nodes[v];
+
+            if (!nodes.is_empty()) {
+                memcpy(view_nodes.ptr() + count, nodes.ptr(), nodes.size() * sizeof(QTNode));
+                count += nodes.size();
+            }
+        }
+    }
+}
+
+void LODQuadTree::set_shadow_cascade_view(SelectionView &r_view, const Vector3 &p_viewer_position, const Vector3 *p_slice_corners, const Vector3 &p_light_direction, real_t p_lod_bias) {
+    const Vector3 z = p_light_direction.normalized();
+    ERR_FAIL_COND(z.is_zero_approx());
+    const Vector3 x = (ABS(z.y) < 0.9 ? Vector3(0.0, 1.0, 0.0) : Vector3(1.0, 0.0, 0.0)).cross(z).normalized();
+    const Vector3 y = z.cross(x);
+    // Sides around the slice, and the far side along the light: nothing behind the
+    // slice shadows it. No near side, casters between the light and the slice count.
+    const Vector3 normals[5] = { x, -x, y, -y, z };
+    r_view.position = p_viewer_position;
+    r_view.plane_count = 5;
+    r_view.lod_bias = p_lod_bias;
+
+    for (int i = 0; i < 5; ++i) {
+        real_t d = -Math_INF;
+
+        for (int j = 0; j < 8; ++j) {
+            d = MAX(d, normals[i].dot(p_slice_corners[j]));
+        }
+
+        r_view.planes[i] = Plane(normals[i], d);
+    }
+}
+
+void LODQuadTree::merge_views(const Ref<MapStorage> &p_storage, const SelectionView *p_views, int p_view_count, LocalVector<QTNode> &r_nodes) {
+    r_nodes.clear();
+    merge_quadrants.resize(lod_levels);
+    merge_covered.resize(lod_levels);
+    merge_nodes.resize(lod_levels);
+
+    for (int ilod = 0; ilod < lod_levels; ++ilod) {
+        merge_quadrants[ilod].clear();
+        merge_covered[ilod].clear();
+        merge_nodes[ilod].clear();
+    }
+
+    // The quadrants each view draws, and the coarser cells around them.
+    for (int v = 0; v < p_view_count; ++v) {
+        for (const QTNode &node : p_views[v].nodes) {
+            const int lod = node.get_lod_level();
+
+            for (int child = 0; child < 4; ++child) {
+                if (!(node.flags & (TL_BIT << child))) {
+                    continue;
+                }
+
+                NodeKey cell = NodeKey(node.key.sector, CellKey(2 * node.key.cell.cell.x + (child & 1), 2 * node.key.cell.cell.z + (child >> 1)));
+
+                if (merge_quadrants[lod].has(cell)) {
+                    continue;
+                }
+
+                merge_quadrants[lod].insert(cell);
+
+                for (int ilod = lod + 1; ilod < lod_levels; ++ilod) {
+                    cell.cell = CellKey(cell.cell.cell.x / 2, cell.cell.cell.z / 2);
+
+                    if (merge_covered[ilod].has(cell)) {
+                        break; // So are the ones above it.
+                    }
+
+                    merge_covered[ilod].insert(cell);
+                }
+            }
+        }
+    }
+
+    for (int ilod = 0; ilod < lod_levels; ++ilod) {
+        for (const NodeKey &cell : merge_quadrants[ilod]) {
+            if (merge_covered[ilod].has(cell)) {
+                _merge_split(cell, ilod);
+            } else {
+                _merge_quadrant(cell, ilod);
+            }
+        }
+    }
+
+    for (int ilod = 0; ilod < lod_levels; ++ilod) {
+        const uint16_t size = sector_size >> (lod_levels - 1 - ilod);
+
+        for (const KeyValue<NodeKey, uint8_t> &kv : merge_nodes[ilod]) {
+            hmap_t min_y;
+            hmap_t max_y;
+            bool has_data;
+            p_storage->get_minmax(kv.key, ilod, min_y, max_y, has_data);
+
+            if (has_data) {
+                const uint8_t quadrants = kv.value;
+                r_nodes.push_back(QTNode(kv.key, size, min_y, max_y, ilod, quadrants & TL_BIT, quadrants & TR_BIT, quadrants & BL_BIT, quadrants & BR_BIT));
+            }
+        }
+    }
+}
+
+_FORCE_INLINE_ void LODQuadTree::_merge_quadrant(const NodeKey &p_cell, int p_lod_level) {
+    const NodeKey key = NodeKey(p_cell.sector, CellKey(p_cell.cell.cell.x / 2, p_cell.cell.cell.z / 2));
+    const uint8_t bit = TL_BIT << ((p_cell.cell.cell.x & 1) | ((p_cell.cell.cell.z & 1) << 1));
+    uint8_t *quadrants = merge_nodes[p_lod_level].getptr(key);
+
+    if (quadrants) {
+        *quadrants |= bit;
+    } else {
+        merge_nodes[p_lod_level].insert(key, bit);
+    }
+}
+
+void LODQuadTree::_merge_split(const NodeKey &p_cell, int p_lod_level) {
+    // Drawn by the node one LOD finer, as far as no view has finer quadrants there.
+    const int lod = p_lod_level - 1;
+
+    for (int child = 0; child < 4; ++child) {
+        const NodeKey cell = NodeKey(p_cell.sector, CellKey(2 * p_cell.cell.cell.x + (child & 1), 2 * p_cell.cell.cell.z + (child >> 1)));
+
+        if (merge_quadrants[lod].has(cell)) {
+            continue; // Merged on its own.
+        } else if (merge_covered[lod].has(cell)) {
+            _merge_split(cell, lod);
+        } else {
+            _merge_quadrant(cell, lod);
+        }
+    }
+}
+
+void LODQuadTree::_select_sector_views(const Ref<MapStorage> &p_storage, SectorSelection &r_selection, const SelectionView *p_views, int p_view_count) const {
+    r_selection.nodes.clear();
+
+    for (int v = 0; v < p_view_count; ++v) {
+        r_selection.view_nodes[v].clear();
+    }
+
+    if (r_selection.sector.cell.x >= sector_count_x || r_selection.sector.cell.z >= sector_count_z) {
+        r_selection.result = OutOfMap;
+        return;
     }
 
-    return _lod_select(p_viewer_position, p_storage, false, NodeKey(p_sector, CellKey()), sector_size, lod_levels - 1, 0);
+    r_selection.result = _lod_select_views(p_storage, NodeKey(r_selection.sector, CellKey()), r_selection.stop_at_lod_level, p_views, p_view_count, r_selection);
+}
+
+void LODQuadTree::_select_sector_views_task(void *p_batch, uint32_t p_index) {
+    const SelectionBatch *batch = static_cast<const SelectionBatch *>(p_batch);
+    batch->tree->_select_sector_views(*batch->storage, batch->sectors[p_index], batch->views, batch->view_count);
 }
 
 void LODQuadTree::update_stats() {
@@ -167,136 +794,631 @@ int LODQuadTree::get_lod_nodes_count(int p_level) const {
 // }
 
 Transform3D LODQuadTree::get_node_transform(const QTNode *p_node) const {
-    const Vector3 bx = Vector3(p_node->size * map_scale.x, 0.0, 0.0);
+    const AABB box = _get_node_AABB(p_node->key, p_node->min_y, p_node->min_y, p_node->size);
+    const Vector3 bx = Vector3(box.size.x, 0.0, 0.0);
     const Vector3 by = Vector3(0.0, 1.0, 0.0);
-    const Vector3 bz = Vector3(0.0, 0.0, p_node->size * map_scale.z);
-    const Vector3 sector_pos = Vector3(p_node->key.sector.cell.x * sector_size * map_scale.x, 0, p_node->key.sector.cell.z * sector_size * map_scale.z);
-    const Vector3 cell_pos = Vector3(p_node->key.cell.cell.x * bx.x, p_node->min_y * map_scale.y, p_node->key.cell.cell.z * bz.z);
-    const Vector3 origin = cell_pos + sector_pos + world_offset;
-    return Transform3D(Basis(bx, by, bz), origin);
+    const Vector3 bz = Vector3(0.0, 0.0, box.size.z);
+    return Transform3D(Basis(bx, by, bz), box.position);
 }
 
-LODQuadTree::NodeSelectionResult LODQuadTree::_lod_select(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, bool p_parent_inside_frustum, const NodeKey &p_key, uint16_t p_size, int p_lod_level, int p_stop_at_lod_level) {
-    hmap_t min_y = 0;
-    hmap_t max_y = 0;
-    bool has_data = false;
-    p_storage->get_minmax(p_key, p_lod_level, min_y, max_y, has_data);
-    AABB box = _get_node_AABB(p_key, min_y, max_y, p_size);
-    real_t distance_limit = lod_visibility_range[p_lod_level];
+LODQuadTree::NodeSelectionResult LODQuadTree::_lod_select(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, const NodeKey &p_key, int p_stop_at_lod_level, SectorSelection &r_selection, HorizonBuffer *p_horizon, SectorCache *p_cache) const {
+    // With a cache, subtrees the viewer motion can't change are copied from the previous selection.
+    const LocalVector<SubtreeRecord> *cached = nullptr;
+    LocalVector<SubtreeRecord> *records = nullptr;
+    real_t moved = 0.0;
+
+    if (p_cache) {
+        cached = &p_cache->records[p_cache->current];
+        records = &p_cache->records[1 - p_cache->current];
+        records->clear();
+        moved = p_viewer_position.distance_to(p_cache->viewer_position) + coarsen_moved + slack_epsilon;
 
-    if (!aabb_intersects_sphere(box, p_viewer_position, distance_limit)) {
-        return OutOfRange;
+        if (!cached->is_empty() && (*cached)[0].slack > moved) {
+            _reuse_subtree(*p_cache, 0, moved, *records, r_selection);
+            return (*cached)[0].result;
+        }
     }
 
-    IntersectType frustum_it = p_parent_inside_frustum ? Inside : _aabb_intersects_frustum(box);
+    SelectFrame stack[MapStorage::MAX_LOD_LEVELS + 1];
+    SelectFrame &root = stack[0];
+    root.key = p_key;
+    root.size = sector_size;
+    root.lod_level = lod_levels - 1;
+    root.slack = Math_INF;
+    root.cached_record = cached && !cached->is_empty() ? 0 : NO_RECORD;
+    p_storage->get_minmax(p_key, root.lod_level, root.min_y, root.max_y, root.has_data);
+    root.box = _get_node_AABB(p_key, root.min_y, root.max_y, root.size);
+    const real_t distance_limit = screen_error_mode ? lod_visibility_range[lod_levels - 1] : lod_visibility_range[root.lod_level];
+    const real_t distance_sqrd = aabb_min_distance_sqrd_from_point(root.box, p_viewer_position);
+    NodeSelectionResult result = Undefined;
 
-    if (frustum_it == Outside) {
-        return OutOfFrustum;
+    if (records) {
+        root.slack = ABS(Math::sqrt(distance_sqrd) - distance_limit);
     }
 
-    NodeSelectionResult res_subnode_tl = Undefined;
-    NodeSelectionResult res_subnode_tr = Undefined;
-    NodeSelectionResult res_subnode_bl = Undefined;
-    NodeSelectionResult res_subnode_br = Undefined;
-
-    if (p_lod_level > p_stop_at_lod_level) {
-        int next_lod = p_lod_level - 1;
-        real_t next_distance_limit = lod_visibility_range[next_lod];
-        uint16_t x = 2 * p_key.cell.cell.x;
-        uint16_t z = 2 * p_key.cell.cell.z;
-        uint16_t half_size = p_size / 2;
-
-        if (aabb_intersects_sphere(box, p_viewer_position, next_distance_limit)) {
-            bool completely_in_frustum = frustum_it == Inside;
-            res_subnode_tl = _lod_select(p_viewer_position, p_storage, completely_in_frustum, NodeKey(p_key.sector, CellKey(x, z)), half_size, next_lod, p_stop_at_lod_level);
-            ERR_FAIL_COND_V(res_subnode_tl == MaxReached, MaxReached);
-            res_subnode_tr = _lod_select(p_viewer_position, p_storage, completely_in_frustum, NodeKey(p_key.sector, CellKey(x + 1ui16, z)), half_size, next_lod, p_stop_at_lod_level);
-            ERR_FAIL_COND_V(res_subnode_tr == MaxReached, MaxReached);
-            res_subnode_bl = _lod_select(p_viewer_position, p_storage, completely_in_frustum, NodeKey(p_key.sector, CellKey(x, z + 1ui16)), half_size, next_lod, p_stop_at_lod_level);
-            ERR_FAIL_COND_V(res_subnode_bl == MaxReached, MaxReached);
-            res_subnode_br = _lod_select(p_viewer_position, p_storage, completely_in_frustum, NodeKey(p_key.sector, CellKey(x + 1ui16, z + 1ui16)), half_size, next_lod, p_stop_at_lod_level);
-            ERR_FAIL_COND_V(res_subnode_br == MaxReached, MaxReached);
-        } else {
-            uint16_t sector_x = p_key.sector.cell.x * sector_size;
-            uint16_t sector_z = p_key.sector.cell.z * sector_size;
-
-            if (sector_x + x * half_size >= world_size.x || sector_z + z * half_size >= world_size.y) {
-                res_subnode_tl = OutOfMap;
-                res_subnode_tr = OutOfMap;
-                res_subnode_bl = OutOfMap;
-                res_subnode_br = OutOfMap;
-            } else {
-                if (sector_x + (x + 1ui16) * half_size >= world_size.x) {
-                    res_subnode_tr = OutOfMap;
-                    res_subnode_br = OutOfMap;
-                }
+    if (distance_sqrd > distance_limit * distance_limit) {
+        result = OutOfRange;
+    } else {
+        real_t frustum_slack = Math_INF;
+        real_t inside_slack = Math_INF;
+        root.plane_mask = (1 << frustum_plane_count) - 1;
+
+        if (_aabb_intersects_frustum(root.box, frustum_planes, frustum_plane_count, root.plane_mask, _get_plane_hint(p_key, lod_levels), records ? &frustum_slack : nullptr, records ? &inside_slack : nullptr) == Outside) {
+            result = OutOfFrustum;
+        }
+
+        root.slack = MIN(root.slack, frustum_slack * slack_plane_scale);
+        root.inside_slack = inside_slack * slack_plane_scale;
+    }
+
+    if (result == Undefined && !_open_frame(p_viewer_position, p_storage, p_stop_at_lod_level, p_horizon, records, root, result)) {
+        return result;
+    }
+
+    if (result != Undefined) {
+        // Culled root, only its own tests to remember.
+        if (records) {
+            SubtreeRecord record;
+            record.cell = p_key.cell;
+            record.lod_level = root.lod_level;
+            record.result = result;
+            record.slack = root.slack;
+            record.end = 1;
+            records->push_back(record);
+        }
+
+        return result;
+    }
+
+    root.record = 0;
+    root.nodes_begin = 0;
+
+    if (records) {
+        records->push_back(SubtreeRecord());
+    }
+
+    int depth = 0;
 
-                if (sector_z + (z + 1ui16) * half_size >= world_size.y) {
-                    res_subnode_bl = OutOfMap;
-                    res_subnode_br = OutOfMap;
+    while (true) {
+        SelectFrame &frame = stack[depth];
+
+        if (frame.next_child < 4) {
+            // Visit the next child, depth first.
+            const int child = frame.nearest ^ frame.next_child;
+            frame.next_child++;
+            const ChildrenTest &test = frame.children;
+
+            if (test.results[child] != Undefined) {
+                frame.results[child] = test.results[child];
+                continue;
+            }
+
+            const CellKey cell = CellKey(2 * frame.key.cell.cell.x + (child & 1), 2 * frame.key.cell.cell.z + (child >> 1));
+            const uint32_t cached_record = frame.cached_record != NO_RECORD ? _find_child_record(*cached, frame.cached_record, cell) : NO_RECORD;
+
+            if (cached_record != NO_RECORD && (*cached)[cached_record].slack > moved) {
+                const SubtreeRecord &record = (*cached)[cached_record];
+                _reuse_subtree(*p_cache, cached_record, moved, *records, r_selection);
+                frame.results[child] = record.result;
+                frame.slack = MIN(frame.slack, record.slack - moved);
+                continue;
+            }
+
+            SelectFrame &child_frame = stack[depth + 1];
+            child_frame.key = NodeKey(frame.key.sector, cell);
+            child_frame.box = test.boxes[child];
+            child_frame.size = frame.size / 2;
+            child_frame.lod_level = frame.lod_level - 1;
+            child_frame.min_y = test.min_y[child];
+            child_frame.max_y = test.max_y[child];
+            child_frame.has_data = test.has_data;
+            child_frame.plane_mask = test.plane_masks[child];
+            // Its descendants skip the planes it is inside of.
+            child_frame.inside_slack = MIN(frame.inside_slack, test.inside_slacks[child]);
+            child_frame.slack = child_frame.inside_slack;
+            child_frame.cached_record = cached_record;
+
+            if (_open_frame(p_viewer_position, p_storage, p_stop_at_lod_level, p_horizon, records, child_frame, result)) {
+                child_frame.nodes_begin = r_selection.nodes.size();
+
+                if (records) {
+                    child_frame.record = records->size();
+                    records->push_back(SubtreeRecord());
                 }
+
+                depth++;
+            } else {
+                frame.results[child] = result;
+            }
+
+            continue;
+        }
+
+        // Every child is done, decide on the node itself.
+        result = _close_frame(frame, r_selection, p_horizon);
+
+        if (records) {
+            SubtreeRecord &record = (*records)[frame.record];
+            record.cell = frame.key.cell;
+            record.lod_level = frame.lod_level;
+            record.result = result;
+            record.slack = frame.slack;
+            record.end = records->size();
+            record.nodes_begin = frame.nodes_begin;
+            record.nodes_end = r_selection.nodes.size();
+        }
+
+        if (depth == 0) {
+            return result;
+        }
+
+        depth--;
+        SelectFrame &parent = stack[depth];
+        parent.results[parent.nearest ^ (parent.next_child - 1)] = result;
+        parent.slack = MIN(parent.slack, frame.slack);
+    }
+}
+
+_FORCE_INLINE_ bool LODQuadTree::_open_frame(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, int p_stop_at_lod_level, HorizonBuffer *p_horizon, bool p_track_slack, SelectFrame &r_frame, NodeSelectionResult &r_result) const {
+    // Nodes without data have unknown heights, they can't be occluded.
+    if (p_horizon && r_frame.has_data && p_horizon->is_occluded(r_frame.box)) {
+        r_result = Occluded;
+        return false;
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        r_frame.results[i] = Undefined;
+    }
+
+    r_frame.next_child = 4;
+
+    if (r_frame.lod_level <= p_stop_at_lod_level) {
+        return true;
+    }
+
+    if (_needs_refinement(p_viewer_position, p_storage, r_frame.key, r_frame.lod_level, r_frame.box, r_frame.has_data, p_track_slack ? &r_frame.slack : nullptr)) {
+        _test_children(p_viewer_position, p_storage, r_frame, p_track_slack, r_frame.children);
+        // Nearest child first, so the horizon is built front to back.
+        const Vector3 center = r_frame.box.get_center();
+        r_frame.nearest = (p_viewer_position.x >= center.x ? 1 : 0) | (p_viewer_position.z >= center.z ? 2 : 0);
+        r_frame.next_child = 0;
+
+        if (p_track_slack) {
+            // The visit order sets the order of the selected nodes.
+            r_frame.slack = MIN(r_frame.slack, MIN(ABS(p_viewer_position.x - center.x), ABS(p_viewer_position.z - center.z)));
+
+            for (int i = 0; i < 4; ++i) {
+                r_frame.slack = MIN(r_frame.slack, r_frame.children.slacks[i]);
             }
         }
+
+        return true;
     }
 
-    const bool subnode_tl_sel = res_subnode_tl == Selected;
-    const bool subnode_tr_sel = res_subnode_tr == Selected;
-    const bool subnode_bl_sel = res_subnode_bl == Selected;
-    const bool subnode_br_sel = res_subnode_br == Selected;
-    const bool remove_subnode_tl = (res_subnode_tl & RESULT_DISCARD) || subnode_tl_sel;
-    const bool remove_subnode_tr = (res_subnode_tr & RESULT_DISCARD) || subnode_tr_sel;
-    const bool remove_subnode_bl = (res_subnode_bl & RESULT_DISCARD) || subnode_bl_sel;
-    const bool remove_subnode_br = (res_subnode_br & RESULT_DISCARD) || subnode_br_sel;
+    const int out_of_map = _get_children_out_of_map(r_frame.key, r_frame.size);
 
-    if (!(remove_subnode_tl && remove_subnode_tr && remove_subnode_bl && remove_subnode_br)) {
-        if (selection_count >= MAX_NODE_SELECTION_COUNT) {
-            return MaxReached;
+    for (int i = 0; i < 4; ++i) {
+        if (out_of_map & (1 << i)) {
+            r_frame.results[i] = OutOfMap;
         }
+    }
+
+    return true;
+}
+
+_FORCE_INLINE_ int LODQuadTree::_get_children_out_of_map(const NodeKey &p_key, uint16_t p_size) const {
+    const uint16_t x = 2 * p_key.cell.cell.x;
+    const uint16_t z = 2 * p_key.cell.cell.z;
+    const uint16_t half_size = p_size / 2;
+    const int sector_x = int(p_key.sector.cell.x) * sector_size;
+    const int sector_z = int(p_key.sector.cell.z) * sector_size;
+
+    if (sector_x + x * half_size >= world_size.x || sector_z + z * half_size >= world_size.y) {
+        return 0xF;
+    }
+
+    int out_of_map = 0;
+
+    if (sector_x + uint16_t(x + 1) * half_size >= world_size.x) {
+        out_of_map |= (1 << 1) | (1 << 3);
+    }
+
+    if (sector_z + uint16_t(z + 1) * half_size >= world_size.y) {
+        out_of_map |= (1 << 2) | (1 << 3);
+    }
+
+    return out_of_map;
+}
+
+_FORCE_INLINE_ LODQuadTree::NodeSelectionResult LODQuadTree::_close_frame(const SelectFrame &p_frame, SectorSelection &r_selection, HorizonBuffer *p_horizon) const {
+    const uint32_t count = r_selection.nodes.size();
+    const NodeSelectionResult result = _close_node(p_frame.key, p_frame.size, p_frame.min_y, p_frame.max_y, p_frame.lod_level, p_frame.has_data, p_frame.results, r_selection.nodes);
+
+    if (p_horizon && r_selection.nodes.size() > count) {
+        p_horizon->add_occluder(p_frame.box);
+    }
+
+    return result;
+}
 
-        if (has_data) {
-            selected_buffer[selection_count] = QTNode(p_key, p_size, min_y, max_y, p_lod_level, !remove_subnode_tl, !remove_subnode_tr, !remove_subnode_bl, !remove_subnode_br);
-            selection_count++;
+_FORCE_INLINE_ LODQuadTree::NodeSelectionResult LODQuadTree::_close_node(const NodeKey &p_key, uint16_t p_size, hmap_t p_min_y, hmap_t p_max_y, int p_lod_level, bool p_has_data, const NodeSelectionResult *p_results, LocalVector<QTNode> &r_nodes) {
+    bool selected[4];
+    bool remove[4];
+
+    for (int i = 0; i < 4; ++i) {
+        selected[i] = p_results[i] == Selected;
+        remove[i] = (p_results[i] & RESULT_DISCARD) || selected[i];
+    }
+
+    if (!(remove[0] && remove[1] && remove[2] && remove[3])) {
+        if (p_has_data) {
+            r_nodes.push_back(QTNode(p_key, p_size, p_min_y, p_max_y, p_lod_level, !remove[0], !remove[1], !remove[2], !remove[3]));
         }
 
         return Selected;
     }
 
-    if (subnode_tl_sel || subnode_tr_sel || subnode_bl_sel || subnode_br_sel) {
+    if (selected[0] || selected[1] || selected[2] || selected[3]) {
         return Selected; // At least one child has been selected.
     } else {
         return OutOfFrustum;
     }
 }
 
+_FORCE_INLINE_ void LODQuadTree::_test_children(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, const SelectFrame &p_frame, bool p_track_slack, ChildrenTest &r_test) const {
+    const int lod = p_frame.lod_level - 1;
+    const uint16_t half_size = p_frame.size / 2;
+    const uint16_t x = 2 * p_frame.key.cell.cell.x;
+    const uint16_t z = 2 * p_frame.key.cell.cell.z;
+    p_storage->get_children_minmax(p_frame.key, lod, r_test.min_y, r_test.max_y, r_test.has_data);
+    BoxesSoA boxes;
+
+    for (int i = 0; i < 4; ++i) {
+        const NodeKey key = NodeKey(p_frame.key.sector, CellKey(x + uint16_t(i & 1), z + uint16_t(i >> 1)));
+        r_test.boxes[i] = _get_node_AABB(key, r_test.min_y[i], r_test.max_y[i], half_size);
+    }
+
+    _boxes_to_soa(r_test.boxes, boxes);
+
+    const real_t distance_limit = screen_error_mode ? lod_visibility_range[lod_levels - 1] : lod_visibility_range[lod];
+    alignas(16) real_t distances_sqrd[4];
+    alignas(16) real_t slacks[4] = { Math_INF, Math_INF, Math_INF, Math_INF };
+    alignas(16) real_t inside_slacks[4] = { Math_INF, Math_INF, Math_INF, Math_INF };
+    const int in_range = _boxes_in_sphere(boxes, p_viewer_position, distance_limit * distance_limit, p_track_slack ? distances_sqrd : nullptr);
+    int outside = 0;
+
+    // Children are inside the planes their parent is inside.
+    if (p_frame.plane_mask) {
+        outside = _boxes_in_frustum(boxes, frustum_planes, frustum_plane_count, p_frame.plane_mask, _get_plane_hint(p_frame.key, p_frame.lod_level), r_test.plane_masks, p_track_slack ? slacks : nullptr, inside_slacks);
+    } else {
+        for (int i = 0; i < 4; ++i) {
+            r_test.plane_masks[i] = 0;
+        }
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        const int bit = 1 << i;
+        r_test.results[i] = !(in_range & bit) ? OutOfRange : ((outside & bit) ? OutOfFrustum : Undefined);
+        r_test.inside_slacks[i] = inside_slacks[i] * slack_plane_scale;
+
+        if (p_track_slack) {
+            r_test.slacks[i] = MIN(ABS(Math::sqrt(distances_sqrd[i]) - distance_limit), slacks[i] * slack_plane_scale);
+        }
+    }
+}
+
+LODQuadTree::NodeSelectionResult LODQuadTree::_lod_select_views(const Ref<MapStorage> &p_storage, const NodeKey &p_key, int p_stop_at_lod_level, const SelectionView *p_views, int p_view_count, SectorSelection &r_selection) const {
+    // Last plane that rejected a box, per view. Sectors may be selected in parallel, so kept per sector.
+    std::atomic<uint8_t> hints[MAX_VIEWS] = {};
+    NodeSelectionResult view_results[MAX_VIEWS];
+    ViewsFrame stack[MapStorage::MAX_LOD_LEVELS + 1];
+    ViewsFrame &root = stack[0];
+    root.key = p_key;
+    root.size = sector_size;
+    root.lod_level = lod_levels - 1;
+    root.views = 0;
+    p_storage->get_minmax(p_key, root.lod_level, root.min_y, root.max_y, root.has_data);
+    root.box = _get_node_AABB(p_key, root.min_y, root.max_y, root.size);
+    const real_t far_view = lod_visibility_range[lod_levels - 1];
+
+    for (int v = 0; v < p_view_count; ++v) {
+        const SelectionView &view = p_views[v];
+        root.plane_masks[v] = (1 << view.plane_count) - 1;
+
+        if (aabb_min_distance_sqrd_from_point(root.box, view.position) > far_view * far_view) {
+            view_results[v] = OutOfRange;
+        } else if (_aabb_intersects_frustum(root.box, view.planes, view.plane_count, root.plane_masks[v], hints[v]) == Outside) {
+            view_results[v] = OutOfFrustum;
+        } else {
+            root.views |= 1 << v;
+        }
+    }
+
+    if (root.views) {
+        _open_views_frame(p_storage, p_stop_at_lod_level, p_views, p_view_count, hints, root);
+        int depth = 0;
+
+        while (true) {
+            ViewsFrame &frame = stack[depth];
+
+            if (frame.next_child < 4) {
+                // Visit the next child some view needs, depth first.
+                const int child = frame.nearest ^ frame.next_child;
+                frame.next_child++;
+
+                if (!frame.child_views[child]) {
+                    continue;
+                }
+
+                ViewsFrame &child_frame = stack[depth + 1];
+                child_frame.key = NodeKey(frame.key.sector, CellKey(2 * frame.key.cell.cell.x + (child & 1), 2 * frame.key.cell.cell.z + (child >> 1)));
+                child_frame.box = frame.child_boxes[child];
+                child_frame.size = frame.size / 2;
+                child_frame.lod_level = frame.lod_level - 1;
+                child_frame.min_y = frame.child_min_y[child];
+                child_frame.max_y = frame.child_max_y[child];
+                child_frame.has_data = frame.children_have_data;
+                child_frame.views = frame.child_views[child];
+
+                for (int v = 0; v < p_view_count; ++v) {
+                    child_frame.plane_masks[v] = frame.child_plane_masks[v][child];
+                }
+
+                _open_views_frame(p_storage, p_stop_at_lod_level, p_views, p_view_count, hints, child_frame);
+                depth++;
+                continue;
+            }
+
+            // Every child is done, decide on the node itself for each view.
+            for (int v = 0; v < p_view_count; ++v) {
+                if (frame.views & (1 << v)) {
+                    view_results[v] = _close_node(frame.key, frame.size, frame.min_y, frame.max_y, frame.lod_level, frame.has_data, frame.results[v], r_selection.view_nodes[v]);
+                }
+            }
+
+            if (depth == 0) {
+                break;
+            }
+
+            depth--;
+            ViewsFrame &parent = stack[depth];
+            const int child = parent.nearest ^ (parent.next_child - 1);
+
+            for (int v = 0; v < p_view_count; ++v) {
+                if (frame.views & (1 << v)) {
+                    parent.results[v][child] = view_results[v];
+                }
+            }
+        }
+    }
+
+    // Stream the sector for the view that needs it most.
+    NodeSelectionResult result = OutOfRange;
+
+    for (int v = 0; v < p_view_count; ++v) {
+        if (view_results[v] == Selected) {
+            return Selected;
+        }
+
+        if (view_results[v] != OutOfRange) {
+            result = OutOfFrustum;
+        }
+    }
+
+    return result;
+}
+
+_FORCE_INLINE_ void LODQuadTree::_open_views_frame(const Ref<MapStorage> &p_storage, int p_stop_at_lod_level, const SelectionView *p_views, int p_view_count, std::atomic<uint8_t> *r_hints, ViewsFrame &r_frame) const {
+    uint8_t refine = 0;
+    r_frame.next_child = 4;
+
+    for (int i = 0; i < 4; ++i) {
+        r_frame.child_views[i] = 0;
+    }
+
+    for (int v = 0; v < p_view_count; ++v) {
+        if (!(r_frame.views & (1 << v))) {
+            continue;
+        }
+
+        for (int i = 0; i < 4; ++i) {
+            r_frame.results[v][i] = Undefined;
+        }
+
+        if (r_frame.lod_level > p_stop_at_lod_level && _view_needs_refinement(p_views[v], p_storage, r_frame.key, r_frame.lod_level, r_frame.box, r_frame.has_data)) {
+            refine |= 1 << v;
+        }
+    }
+
+    if (refine) {
+        // Children data and boxes are read once, then tested for each view refining the node.
+        const int lod = r_frame.lod_level - 1;
+        const uint16_t half_size = r_frame.size / 2;
+        const uint16_t x = 2 * r_frame.key.cell.cell.x;
+        const uint16_t z = 2 * r_frame.key.cell.cell.z;
+        p_storage->get_children_minmax(r_frame.key, lod, r_frame.child_min_y, r_frame.child_max_y, r_frame.children_have_data);
+
+        for (int i = 0; i < 4; ++i) {
+            const NodeKey key = NodeKey(r_frame.key.sector, CellKey(x + uint16_t(i & 1), z + uint16_t(i >> 1)));
+            r_frame.child_boxes[i] = _get_node_AABB(key, r_frame.child_min_y[i], r_frame.child_max_y[i], half_size);
+        }
+
+        BoxesSoA boxes;
+        _boxes_to_soa(r_frame.child_boxes, boxes);
+
+        for (int v = 0; v < p_view_count; ++v) {
+            if (!(refine & (1 << v))) {
+                continue;
+            }
+
+            const SelectionView &view = p_views[v];
+            const real_t distance_limit = screen_error_mode ? lod_visibility_range[lod_levels - 1] : lod_visibility_range[lod] * view.lod_bias;
+            const int in_range = _boxes_in_sphere(boxes, view.position, distance_limit * distance_limit);
+            int outside = 0;
+
+            if (r_frame.plane_masks[v]) {
+                outside = _boxes_in_frustum(boxes, view.planes, view.plane_count, r_frame.plane_masks[v], r_hints[v], r_frame.child_plane_masks[v]);
+            } else {
+                for (int i = 0; i < 4; ++i) {
+                    r_frame.child_plane_masks[v][i] = 0;
+                }
+            }
+
+            for (int i = 0; i < 4; ++i) {
+                const int bit = 1 << i;
+                r_frame.results[v][i] = !(in_range & bit) ? OutOfRange : ((outside & bit) ? OutOfFrustum : Undefined);
+
+                if (r_frame.results[v][i] == Undefined) {
+                    r_frame.child_views[i] |= 1 << v;
+                }
+            }
+        }
+
+        // Nearest child to the first view first, so a single view selects like select_sectors.
+        const Vector3 center = r_frame.box.get_center();
+        const Vector3 &position = p_views[0].position;
+        r_frame.nearest = (position.x >= center.x ? 1 : 0) | (position.z >= center.z ? 2 : 0);
+        r_frame.next_child = 0;
+    }
+
+    // Views not refining the node draw all of it that is in the map.
+    const uint8_t coarse = r_frame.views & ~refine;
+
+    if (!coarse || r_frame.lod_level <= p_stop_at_lod_level) {
+        return;
+    }
+
+    const int out_of_map = _get_children_out_of_map(r_frame.key, r_frame.size);
+
+    for (int v = 0; v < p_view_count; ++v) {
+        if (!(coarse & (1 << v))) {
+            continue;
+        }
+
+        for (int i = 0; i < 4; ++i) {
+            if (out_of_map & (1 << i)) {
+                r_frame.results[v][i] = OutOfMap;
+            }
+        }
+    }
+}
+
 _FORCE_INLINE_ AABB LODQuadTree::_get_node_AABB(const NodeKey &p_key, hmap_t min_y, hmap_t max_y, uint16_t p_size) const {
-    const Vector3 sector_position = Vector3(p_key.sector.cell.x * sector_size * chunk_size, 0, p_key.sector.cell.z * sector_size * chunk_size) * map_scale;
-    const Vector3 node_size = Vector3(p_size * chunk_size, max_y - min_y, p_size * chunk_size) * map_scale;
-    const Vector3 node_position = Vector3(p_key.cell.cell.x * node_size.x, min_y * map_scale.y, p_key.cell.cell.z * node_size.z) + sector_position + world_offset;
+    // In chunks from the local origin, exact before the conversion to real_t.
+    const int64_t x = int64_t(p_key.sector.cell.x) * sector_size + int64_t(p_key.cell.cell.x) * p_size - origin_chunk.x;
+    const int64_t z = int64_t(p_key.sector.cell.z) * sector_size + int64_t(p_key.cell.cell.z) * p_size - origin_chunk.y;
+    const real_t chunk_x = chunk_size * map_scale.x;
+    const real_t chunk_z = chunk_size * map_scale.z;
+    const Vector3 node_size = Vector3(p_size * chunk_x, (max_y - min_y) * map_scale.y, p_size * chunk_z);
+    const Vector3 node_position = Vector3(real_t(x) * chunk_x, min_y * map_scale.y, real_t(z) * chunk_z);
     return AABB(node_position, node_size);
 }
 
-LODQuadTree::IntersectType LODQuadTree::_aabb_intersects_frustum(const AABB &p_aabb) const {
-    int in = 0;
+_FORCE_INLINE_ bool LODQuadTree::_needs_refinement(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, const NodeKey &p_key, int p_lod_level, const AABB &p_box, bool p_has_data, real_t *r_slack) const {
+    // Over the node budget, the farthest nodes stay coarse.
+    if (coarsen_distance < Math_INF) {
+        const real_t distance = Math::sqrt(aabb_min_distance_sqrd_from_point(p_box, p_viewer_position));
+
+        if (r_slack) {
+            *r_slack = MIN(*r_slack, ABS(distance - coarsen_distance));
+        }
+
+        if (distance > coarsen_distance) {
+            return false;
+        }
+    }
 
-    for (int iplane = 0; iplane < frustum.size(); ++iplane) {
-        int out = 0;
+    // Without data, fall back to the distance rings.
+    if (screen_error_mode && p_has_data) {
+        real_t projected = p_storage->get_node_error(p_key, p_lod_level) * map_scale.y * screen_error_scale;
 
-        for (int icorner = 0; icorner < 8; ++icorner) {
-            Plane plane = frustum[iplane];
+        if (!screen_error_orthogonal) {
+            const real_t distance = Math::sqrt(aabb_min_distance_sqrd_from_point(p_box, p_viewer_position));
 
-            if (plane.is_point_over(p_aabb.get_endpoint(icorner))) {
-                out++;
+            if (r_slack) {
+                // Refined closer than the distance where the projected error is the limit.
+                *r_slack = MIN(*r_slack, ABS(distance - projected / max_screen_error));
             }
+
+            projected /= MAX(distance, (real_t)CMP_EPSILON);
         }
 
-        if (out == 8) {
+        return projected > max_screen_error;
+    }
+
+    const real_t range = lod_visibility_range[p_lod_level - 1];
+    const real_t distance_sqrd = aabb_min_distance_sqrd_from_point(p_box, p_viewer_position);
+
+    if (r_slack) {
+        *r_slack = MIN(*r_slack, ABS(Math::sqrt(distance_sqrd) - range));
+    }
+
+    return distance_sqrd <= range * range;
+}
+
+_FORCE_INLINE_ bool LODQuadTree::_view_needs_refinement(const SelectionView &p_view, const Ref<MapStorage> &p_storage, const NodeKey &p_key, int p_lod_level, const AABB &p_box, bool p_has_data) const {
+    const real_t distance_sqrd = aabb_min_distance_sqrd_from_point(p_box, p_view.position);
+
+    if (screen_error_mode && p_has_data) {
+        real_t projected = p_storage->get_node_error(p_key, p_lod_level) * map_scale.y * screen_error_scale * p_view.lod_bias;
+
+        if (!screen_error_orthogonal) {
+            projected /= MAX(Math::sqrt(distance_sqrd), (real_t)CMP_EPSILON);
+        }
+
+        return projected > max_screen_error;
+    }
+
+    const real_t range = lod_visibility_range[p_lod_level - 1] * p_view.lod_bias;
+    return distance_sqrd <= range * range;
+}
+
+_FORCE_INLINE_ std::atomic<uint8_t> &LODQuadTree::_get_plane_hint(const NodeKey &p_key, int p_lod_level) const {
+    return plane_hints[hash_murmur3_one_32(p_lod_level, p_key.hash()) & PLANE_HINT_MASK];
+}
+
+_FORCE_INLINE_ LODQuadTree::IntersectType LODQuadTree::_aabb_intersects_frustum(const AABB &p_aabb, const Plane *p_planes, int p_plane_count, uint8_t &r_plane_mask, std::atomic<uint8_t> &r_hint, real_t *r_slack, real_t *r_inside_slack) {
+    const Vector3 end = p_aabb.get_end();
+    const int hint = r_hint.load(std::memory_order_relaxed);
+    uint8_t straddling = 0;
+
+    for (int j = -1; j < p_plane_count; ++j) {
+        const int i = j < 0 ? hint : j;
+
+        if (i >= p_plane_count || (j >= 0 && i == hint) || !(r_plane_mask & (1 << i))) {
+            continue;
+        }
+
+        const Plane &plane = p_planes[i];
+        const Vector3 &n = plane.normal;
+        const Vector3 n_vertex = Vector3(n.x >= 0.0 ? p_aabb.position.x : end.x, n.y >= 0.0 ? p_aabb.position.y : end.y, n.z >= 0.0 ? p_aabb.position.z : end.z);
+        const Vector3 p_vertex = Vector3(n.x >= 0.0 ? end.x : p_aabb.position.x, n.y >= 0.0 ? end.y : p_aabb.position.y, n.z >= 0.0 ? end.z : p_aabb.position.z);
+
+        if (r_slack) {
+            const real_t n_distance = plane.distance_to(n_vertex);
+            const real_t p_distance = plane.distance_to(p_vertex);
+            *r_slack = MIN(*r_slack, MIN(ABS(n_distance), ABS(p_distance)));
+
+            if (p_distance <= 0.0) {
+                *r_inside_slack = MIN(*r_inside_slack, -p_distance);
+            }
+        }
+
+        if (plane.is_point_over(n_vertex)) {
+            if (i != hint) {
+                r_hint.store(i, std::memory_order_relaxed);
+            }
+
             return Outside;
-        } else if (out == 0) {
-            in++;
+        }
+
+        if (plane.is_point_over(p_vertex)) {
+            straddling |= 1 << i;
         }
     }
 
-    return in == frustum.size() ? Inside : Intersects;
+    r_plane_mask = straddling;
+    return straddling ? Intersects : Inside;
 }
 
 LODQuadTree::LODQuadTree() {
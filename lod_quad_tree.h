@@ -12,16 +12,21 @@
 #ifndef TERRAINER_QUAD_TREE_H
 #define TERRAINER_QUAD_TREE_H
 
+#include "horizon_buffer.h"
 #include "map_storage/map_storage.h"
 // #include "terrain_info.h"
 
 #ifdef TERRAINER_MODULE
+#include "core/object/worker_thread_pool.h"
+#include "core/templates/hash_set.h"
 #include "scene/3d/camera_3d.h"
 #include "scene/resources/image_texture.h"
 #endif // TERRAINER_MODULE
 
 #ifdef TERRAINER_GDEXTENSION
 #include <godot_cpp/classes/image_texture.hpp>
+#include <godot_cpp/classes/worker_thread_pool.hpp>
+#include <godot_cpp/templates/hash_set.hpp>
 #endif // TERRAINER_GDEXTENSION
 
 #define DEFAULT_MORPH_START_RATIO  (0.66)
@@ -35,6 +40,7 @@ using hmap_t = MapStorage::hmap_t;
 class LODQuadTree {
 
     friend class Terrain;
+    friend class TestLODQuadTree;
 
 private:
     static const uint8_t LOD_MASK = 0x0F;
@@ -43,7 +49,10 @@ private:
     static const uint8_t BL_BIT = 1 << 6;
     static const uint8_t BR_BIT = 1 << 7;
     static constexpr real_t LOD0_RADIUS_FACTOR = 1.2;
-    static const int MAX_NODE_SELECTION_COUNT = 4096;
+    static constexpr real_t COARSEN_SHRINK_FACTOR = 0.75;
+    static constexpr real_t COARSEN_GROW_FACTOR = 1.25;
+    static constexpr real_t COARSEN_RELAX_RATIO = 0.8; // Of the budget, under which detail comes back.
+    static const int MAX_BUDGET_PASSES = 8;
 
     enum NodeSelectionResult {
 		Undefined = 0,
@@ -51,10 +60,10 @@ private:
 		OutOfRange = 2,
         OutOfMap = 4,
         Selected = 8,
-        MaxReached = 16
+        Occluded = 32
 	};
 
-    static constexpr int RESULT_DISCARD = OutOfFrustum | OutOfMap;
+    static constexpr int RESULT_DISCARD = OutOfFrustum | OutOfMap | Occluded;
 
     enum IntersectType
     {
@@ -72,9 +81,9 @@ private:
 
         _FORCE_INLINE_ int get_lod_level() const { return flags & LOD_MASK; }
         _FORCE_INLINE_ bool use_tl() const { return flags & TL_BIT; }
-        _FORCE_INLINE_ bool use_tr() const { return flags & TL_BIT; }
-        _FORCE_INLINE_ bool use_bl() const { return flags & TL_BIT; }
-        _FORCE_INLINE_ bool use_br() const { return flags & TL_BIT; }
+        _FORCE_INLINE_ bool use_tr() const { return flags & TR_BIT; }
+        _FORCE_INLINE_ bool use_bl() const { return flags & BL_BIT; }
+        _FORCE_INLINE_ bool use_br() const { return flags & BR_BIT; }
 
         QTNode() : key(CellKey(), CellKey()) {}
 
@@ -85,7 +94,125 @@ private:
         }
     };
 
-    QTNode selected_buffer[MAX_NODE_SELECTION_COUNT];
+    static const int MAX_VIEWS = 8;
+
+    // Nodes selected in one sector. Sectors can be selected in parallel, each one
+    // into its own output, and are then merged in order into selected_buffer.
+    struct SectorSelection {
+        CellKey sector;
+        int stop_at_lod_level = 0;
+        NodeSelectionResult result = Undefined;
+        LocalVector<QTNode> nodes;
+        LocalVector<QTNode> view_nodes[MAX_VIEWS]; // Per view, with select_views.
+    };
+
+    struct SelectionBatch;
+
+    static const uint32_t NO_RECORD = UINT32_MAX;
+    static constexpr real_t SLACK_RELATIVE_EPSILON = 1e-5;
+
+    // Range and frustum results of the four children of a node, tested together.
+    // Children are indexed tl, tr, bl, br; Undefined results passed both tests.
+    struct ChildrenTest {
+        NodeSelectionResult results[4];
+        hmap_t min_y[4];
+        hmap_t max_y[4];
+        AABB boxes[4];
+        uint8_t plane_masks[4]; // Frustum planes each child straddles.
+        real_t slacks[4]; // Viewer distance within which the tests can't change, when tracked.
+        real_t inside_slacks[4]; // Same, for the planes each child is inside of.
+        bool has_data = false;
+    };
+
+    // Explicit stack entry of the traversal, for a node that passed its tests.
+    struct SelectFrame {
+        NodeKey key;
+        AABB box;
+        uint16_t size = 1;
+        int lod_level = 0;
+        hmap_t min_y = 0;
+        hmap_t max_y = 0;
+        bool has_data = false;
+        uint8_t plane_mask = 0; // Frustum planes the node straddles, none when completely inside.
+        uint8_t nearest = 0; // First child visited.
+        uint8_t next_child = 4; // Children visited so far.
+        NodeSelectionResult results[4];
+        ChildrenTest children;
+        real_t slack = Math_INF; // Smallest slack of the decisions taken in the subtree.
+        real_t inside_slack = Math_INF; // Smallest slack of the planes it is inside of, which its subtree skips.
+        uint32_t record = 0; // Its record in the new selection.
+        uint32_t cached_record = NO_RECORD; // Its record in the previous selection.
+        uint32_t nodes_begin = 0;
+    };
+
+    // Selection of a subtree, in depth first order. Nodes are stored in post order,
+    // so the nodes of a subtree are contiguous too.
+    struct SubtreeRecord {
+        CellKey cell;
+        int lod_level = 0;
+        NodeSelectionResult result = Undefined;
+        real_t slack = 0.0;
+        uint32_t end = 0; // One past the last record of the subtree.
+        uint32_t nodes_begin = 0;
+        uint32_t nodes_end = 0;
+    };
+
+    // Previous selection of a sector. A subtree selection can't change while the
+    // viewer stays within its slack of the position it was selected from.
+    struct SectorCache {
+        Vector3 viewer_position;
+        int stop_at_lod_level = 0;
+        bool loaded = false;
+        uint64_t frame = 0;
+        int current = 0;
+        LocalVector<SubtreeRecord> records[2]; // Previous and new.
+        LocalVector<QTNode> nodes;
+    };
+
+    static const int MAX_FRUSTUM_PLANES = 6;
+    static const int PLANE_HINT_COUNT = 4096;
+    static const uint32_t PLANE_HINT_MASK = PLANE_HINT_COUNT - 1;
+
+    // A viewer selected together with others by select_views, like a split-screen camera,
+    // an eye or a shadow cascade. Each view gets the nodes select_sectors would give it.
+    struct SelectionView {
+        Vector3 position;
+        Plane planes[MAX_FRUSTUM_PLANES];
+        int plane_count = 0;
+        real_t lod_bias = 1.0; // Scales the distances nodes are refined within, under 1 for coarser LODs.
+        LocalVector<QTNode> nodes; // Selected nodes, in sector order.
+    };
+
+    // Explicit stack entry of the multi-view traversal, for a node that passed the
+    // tests of some views. Node data and children boxes are shared between views.
+    struct ViewsFrame {
+        NodeKey key;
+        AABB box;
+        uint16_t size = 1;
+        int lod_level = 0;
+        hmap_t min_y = 0;
+        hmap_t max_y = 0;
+        bool has_data = false;
+        uint8_t views = 0; // Views the node passed the tests of, one bit each.
+        uint8_t nearest = 0; // First child visited, from the first view.
+        uint8_t next_child = 4;
+        uint8_t plane_masks[MAX_VIEWS]; // Frustum planes the node straddles, per view.
+        NodeSelectionResult results[MAX_VIEWS][4]; // Of the children, per view.
+        uint8_t child_views[4]; // Views each child passed the tests of.
+        uint8_t child_plane_masks[MAX_VIEWS][4];
+        AABB child_boxes[4];
+        hmap_t child_min_y[4];
+        hmap_t child_max_y[4];
+        bool children_have_data = false;
+    };
+
+    LocalVector<QTNode> selected_buffer; // Keeps its allocation between selections.
+
+    // Scratch of merge_views, per LOD. A quadrant is keyed by its cell one LOD finer,
+    // covered cells hold a finer quadrant inside.
+    LocalVector<HashSet<NodeKey>> merge_quadrants;
+    LocalVector<HashSet<NodeKey>> merge_covered;
+    LocalVector<HashMap<NodeKey, uint8_t>> merge_nodes; // Quadrant bits of each merged node.
 
     int chunk_size = 0;
     int region_size = 0;
@@ -93,29 +220,113 @@ private:
     Vector3 map_scale;
 
     uint16_t sector_size = 1; // In number of chunks.
-    uint16_t sector_count_x = 1;
-    uint16_t sector_count_z = 1;
+    MapStorage::cell_t sector_count_x = 1;
+    MapStorage::cell_t sector_count_z = 1;
     real_t lod_distance_ratio = 2.0;
 
     int lod_levels = 0;
     Vector<real_t> lod_visibility_range;
+    LocalVector<Vector2> lod_morph; // Morph constants of each LOD, as in ChunkInstance.
     int selection_count = 0;
     Vector<int> lods_count;
+    // Node positions are taken relative to the chunk at the local origin, in integers, so
+    // they stay precise near the origin however large the map. origin_shift moves that
+    // chunk away from the map center, and world_offset is where the map corner ends up.
+    Vector2i origin_shift;
+    Vector2i origin_chunk;
     Vector3 world_offset;
+    bool occlusion_culling = false;
+    HorizonBuffer horizon;
+    bool parallel_selection = true;
+    int parallel_tasks = -1; // Worker tasks of the parallel selection, -1 for every pool thread.
+
+    // Optional limit of selected nodes, 0 for none. Over it, nodes farther than
+    // coarsen_distance aren't refined, so the farthest nodes get coarser first.
+    int node_budget = 0;
+    real_t coarsen_distance = Math_INF;
+
+    // Incremental selection, reusing the subtrees the viewer motion can't change.
+    // Not used with occlusion culling, where every sector depends on the ones before it.
+    bool incremental_selection = true;
+    HashMap<CellKey, SectorCache> selection_cache;
+    LocalVector<SectorCache *> sector_caches; // For the sectors being selected.
+    uint64_t selection_frame = 0;
+    bool selection_cache_valid = false;
+    // Selection parameters the cache was built with.
+    Vector3 cached_plane_normals[MAX_FRUSTUM_PLANES];
+    int cached_plane_count = 0;
+    bool cached_screen_error_mode = false;
+    bool cached_screen_error_orthogonal = false;
+    real_t cached_max_screen_error = 0.0;
+    real_t cached_screen_error_scale = 0.0;
+    real_t cached_coarsen_distance = Math_INF;
+    real_t coarsen_moved = 0.0; // Change of coarsen_distance since the cache was built.
+    real_t slack_epsilon = 0.0; // Rounding margin, in world units.
+    real_t slack_plane_scale = 1.0; // From plane distances to world units.
+
+    // Screen space error mode: refine nodes whose projected geometric error is too large.
+    bool screen_error_mode = false;
+    real_t max_screen_error = 2.0; // In pixels.
+    real_t screen_error_scale = 0.0; // Pixels per world unit, at unit distance when in perspective.
+    bool screen_error_orthogonal = false;
 
 #ifdef TERRAINER_MODULE
     Vector<Plane> frustum;
 #elif TERRAINER_GDEXTENSION
     TypedArray<Plane> frustum;
 #endif
-    NodeSelectionResult _lod_select(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, bool p_parent_inside_frustum, const NodeKey &p_key, uint16_t p_size, int p_lod_level, int p_stop_at_lod_level);
+    Plane frustum_planes[MAX_FRUSTUM_PLANES]; // Copy of frustum for the traversal.
+    int frustum_plane_count = 0;
+    // Last plane that rejected a box, per node, hashed. Tested first next time.
+    mutable std::atomic<uint8_t> plane_hints[PLANE_HINT_COUNT] = {};
+    NodeSelectionResult _lod_select(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, const NodeKey &p_key, int p_stop_at_lod_level, SectorSelection &r_selection, HorizonBuffer *p_horizon, SectorCache *p_cache) const;
+    _FORCE_INLINE_ bool _open_frame(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, int p_stop_at_lod_level, HorizonBuffer *p_horizon, bool p_track_slack, SelectFrame &r_frame, NodeSelectionResult &r_result) const;
+    _FORCE_INLINE_ NodeSelectionResult _close_frame(const SelectFrame &p_frame, SectorSelection &r_selection, HorizonBuffer *p_horizon) const;
+    _FORCE_INLINE_ static NodeSelectionResult _close_node(const NodeKey &p_key, uint16_t p_size, hmap_t p_min_y, hmap_t p_max_y, int p_lod_level, bool p_has_data, const NodeSelectionResult *p_results, LocalVector<QTNode> &r_nodes);
+    _FORCE_INLINE_ int _get_children_out_of_map(const NodeKey &p_key, uint16_t p_size) const;
+    _FORCE_INLINE_ void _test_children(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, const SelectFrame &p_frame, bool p_track_slack, ChildrenTest &r_test) const;
+    static uint32_t _find_child_record(const LocalVector<SubtreeRecord> &p_records, uint32_t p_parent, CellKey p_cell);
+    static void _reuse_subtree(const SectorCache &p_cache, uint32_t p_record, real_t p_moved, LocalVector<SubtreeRecord> &r_records, SectorSelection &r_selection);
+    void _select_sector(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, SectorSelection &r_selection, HorizonBuffer *p_horizon, SectorCache *p_cache) const;
+    void _select_pass(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, SectorSelection *p_sectors, int p_count);
+    void _update_selection_cache(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, const SectorSelection *p_sectors, int p_count);
+    static void _select_sector_task(void *p_batch, uint32_t p_index);
+    NodeSelectionResult _lod_select_views(const Ref<MapStorage> &p_storage, const NodeKey &p_key, int p_stop_at_lod_level, const SelectionView *p_views, int p_view_count, SectorSelection &r_selection) const;
+    _FORCE_INLINE_ void _open_views_frame(const Ref<MapStorage> &p_storage, int p_stop_at_lod_level, const SelectionView *p_views, int p_view_count, std::atomic<uint8_t> *r_hints, ViewsFrame &r_frame) const;
+    _FORCE_INLINE_ bool _view_needs_refinement(const SelectionView &p_view, const Ref<MapStorage> &p_storage, const NodeKey &p_key, int p_lod_level, const AABB &p_box, bool p_has_data) const;
+    void _select_sector_views(const Ref<MapStorage> &p_storage, SectorSelection &r_selection, const SelectionView *p_views, int p_view_count) const;
+    static void _select_sector_views_task(void *p_batch, uint32_t p_index);
+    void _update_origin();
     _FORCE_INLINE_ AABB _get_node_AABB(const NodeKey &p_key, hmap_t min_y, hmap_t max_y, uint16_t p_size) const;
-    _FORCE_INLINE_ IntersectType _aabb_intersects_frustum(const AABB &p_aabb) const;
+    _FORCE_INLINE_ std::atomic<uint8_t> &_get_plane_hint(const NodeKey &p_key, int p_lod_level) const;
+    _FORCE_INLINE_ static IntersectType _aabb_intersects_frustum(const AABB &p_aabb, const Plane *p_planes, int p_plane_count, uint8_t &r_plane_mask, std::atomic<uint8_t> &r_hint, real_t *r_slack = nullptr, real_t *r_inside_slack = nullptr);
+    _FORCE_INLINE_ bool _needs_refinement(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, const NodeKey &p_key, int p_lod_level, const AABB &p_box, bool p_has_data, real_t *r_slack = nullptr) const;
+    _FORCE_INLINE_ void _merge_quadrant(const NodeKey &p_cell, int p_lod_level);
+    void _merge_split(const NodeKey &p_cell, int p_lod_level);
 
 public:
     void set_map_info(int p_chunk_size, int p_region_size, const Vector2i p_world_regions, const Vector3 &p_map_scale);
     int set_lod_levels(real_t p_far_view, int p_lod_detailed_chunks_radius);
-    NodeSelectionResult select_sector_nodes(const Vector3 &p_viewer_position, CellKey p_sector, const Ref<MapStorage> &p_storage, int p_stop_at_lod_level = 0);
+    // Move the local origin to the chunk p_shift away from the map center.
+    void set_origin_shift(const Vector2i &p_shift);
+    Vector2i get_origin_shift() const { return origin_shift; }
+    Vector2i get_origin_chunk() const { return origin_chunk; }
+    // Select the nodes of every sector, in the given order, which must be front to back
+    // for occlusion culling. Reads minmax data without locking, MapStorage must not change meanwhile.
+    void select_sectors(const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, SectorSelection *p_sectors, int p_count);
+    // Select the nodes of every sector for several views in one traversal, sharing the
+    // minmax reads and node boxes. Fills the nodes of each view, and merges the sector
+    // results so streaming follows the view that needs each sector most. No occlusion
+    // culling, incremental selection or node budget, and selected_buffer is left as is.
+    void select_views(const Ref<MapStorage> &p_storage, SectorSelection *p_sectors, int p_count, SelectionView *p_views, int p_view_count);
+    // Make r_view select the shadow casters of a directional light cascade, whose camera
+    // frustum slice has the 8 corners p_slice_corners. Its frustum is the light-space box
+    // around the slice, open towards the light, so node boxes from minmax heights bound
+    // the casters. LODs still follow the distance to p_viewer_position.
+    static void set_shadow_cascade_view(SelectionView &r_view, const Vector3 &p_viewer_position, const Vector3 *p_slice_corners, const Vector3 &p_light_direction, real_t p_lod_bias);
+    // Union of the nodes of several views, with the finest LOD wherever they overlap and
+    // no area drawn twice. A quadrant with finer ones inside is split down to them.
+    void merge_views(const Ref<MapStorage> &p_storage, const SelectionView *p_views, int p_view_count, LocalVector<QTNode> &r_nodes);
     void update_stats();
     const QTNode *get_selected_node(int p_index) const;
 //     AABB get_selected_node_aabb(int p_index) const;
@@ -123,6 +334,7 @@ public:
 //     void set_info(TTerrainInfo *p_info) { info = p_info; }
 //     void set_world_info(TWorldInfo *p_info) { world_info = p_info; }
     int get_lod_nodes_count(int p_level) const;
+    _FORCE_INLINE_ Vector2 get_lod_morph(int p_level) const { return lod_morph[p_level]; }
 //     Ref<ImageTexture> get_morph_texture(real_t p_morph_start_ratio = DEFAULT_MORPH_START_RATIO) const;
     Transform3D get_node_transform(const QTNode *p_node) const;
 
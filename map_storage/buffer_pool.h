@@ -51,6 +51,7 @@ private:
     // Cache line size (commonly 64 bytes on modern systems)
     static constexpr size_t CACHE_LINE_SIZE = 64;
     static constexpr size_t THREAD_LOCAL_CACHE_SIZE = 16;
+    static constexpr size_t MAX_LIVE_POOLS = 16;
 
     struct FreeNode {
         FreeNode* next;
@@ -66,6 +67,7 @@ private:
         std::atomic<size_t> peak_allocated{0};
         std::atomic<size_t> total_allocations{0};
         std::atomic<size_t> total_deallocations{0};
+        std::atomic<size_t> cas_retries{0};
     };
 
     size_t block_size;
@@ -76,6 +78,17 @@ private:
     uintptr_t buffer_base;
     uintptr_t buffer_end;
 
+    // Pools of the same element type share the thread-local cache, so entries are
+    // tagged with the id of the pool that owns them
+    uint64_t pool_id;
+    static inline std::atomic<uint64_t> next_pool_id{1};
+
+    // Ids of the pools alive. A thread cache left with blocks of a deleted pool can't be
+    // cleared by the thread deleting it, so the owning thread drops it once it sees the
+    // id is gone. Pools without a slot don't use the thread-local cache.
+    static inline std::atomic<uint64_t> live_pool_ids[MAX_LIVE_POOLS];
+    bool local_cache_enabled = false;
+
     // Global free list head (accessed by all threads)
     std::atomic<FreeNode*> free_list_head{nullptr};
 
@@ -86,8 +99,9 @@ private:
     struct ThreadLocalCache {
         FreeNode* local_cache[THREAD_LOCAL_CACHE_SIZE];
         size_t cache_count;
+        uint64_t owner_id;
 
-        ThreadLocalCache() : cache_count(0) {
+        ThreadLocalCache() : cache_count(0), owner_id(0) {
             for (size_t i = 0; i < THREAD_LOCAL_CACHE_SIZE; ++i) {
                 local_cache[i] = nullptr;
             }
@@ -108,7 +122,9 @@ public:
         : block_size(_align_up(p_block_size, p_alignment))
         , block_count(p_block_count)
         , alignment(p_alignment)
+        , pool_id(next_pool_id.fetch_add(1, std::memory_order_relaxed))
     {
+        _register_live();
         total_size = block_size * block_count * sizeof(T);
         void *base;
 
@@ -145,6 +161,8 @@ public:
     }
 
     ~BufferPool() {
+        _unregister_live();
+
         if (buffer) {
 #ifdef _WIN32
             _aligned_free(buffer);
@@ -165,8 +183,10 @@ public:
      * Returns nullptr if no blocks are available
      */
     T* allocate() {
+        _drop_dead_local_cache();
+
         // Try thread-local cache first (no atomics needed)
-        if (tls_cache.cache_count > 0) {
+        if (tls_cache.owner_id == pool_id && tls_cache.cache_count > 0) {
             T* result = reinterpret_cast<T*>(tls_cache.local_cache[--tls_cache.cache_count]);
             stats.allocated_count.fetch_add(1, std::memory_order_relaxed);
             _update_peak();
@@ -190,6 +210,8 @@ public:
                 stats.total_allocations.fetch_add(1, std::memory_order_relaxed);
                 return reinterpret_cast<T*>(old_head);
             }
+
+            stats.cas_retries.fetch_add(1, std::memory_order_relaxed);
         }
 
         // Out of blocks
@@ -223,6 +245,19 @@ public:
             return;  // Invalid pointer
         }
 
+        _drop_dead_local_cache();
+
+        if (tls_cache.cache_count == 0 && local_cache_enabled) {
+            tls_cache.owner_id = pool_id;
+        } else if (tls_cache.owner_id != pool_id) {
+            // The local cache holds blocks of another pool, go straight to the global list
+            FreeNode* node = reinterpret_cast<FreeNode*>(p_ptr);
+            _push_chain(node, node);
+            stats.allocated_count.fetch_sub(1, std::memory_order_relaxed);
+            stats.total_deallocations.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
         // Try to cache locally first (avoids atomics in fast path)
         if (tls_cache.cache_count < THREAD_LOCAL_CACHE_SIZE) {
             tls_cache.local_cache[tls_cache.cache_count++] = reinterpret_cast<FreeNode*>(p_ptr);
@@ -302,6 +337,14 @@ public:
         return stats.total_deallocations.load(std::memory_order_relaxed);
     }
 
+    /**
+     * Get number of failed compare-and-swap attempts on the global free list (cumulative)
+     * A growing value indicates contention between threads
+     */
+    size_t get_cas_retries() const {
+        return stats.cas_retries.load(std::memory_order_relaxed);
+    }
+
     /**
      * Get pool utilization as a percentage [0.0, 1.0]
      */
@@ -361,41 +404,102 @@ private:
         free_list_head.store(reinterpret_cast<FreeNode*>(buffer), std::memory_order_release);
     }
 
+    /**
+     * Take a live pool id slot, or leave the thread-local cache disabled if all are taken
+     */
+    void _register_live() {
+        for (size_t i = 0; i < MAX_LIVE_POOLS; ++i) {
+            uint64_t expected = 0;
+
+            if (live_pool_ids[i].compare_exchange_strong(expected, pool_id, std::memory_order_acq_rel)) {
+                local_cache_enabled = true;
+                return;
+            }
+        }
+    }
+
+    void _unregister_live() {
+        if (!local_cache_enabled) {
+            return;
+        }
+
+        // The cache of this thread can be cleared right away, other threads drop theirs
+        // on their next allocate or free
+        if (tls_cache.owner_id == pool_id) {
+            tls_cache.cache_count = 0;
+            tls_cache.owner_id = 0;
+        }
+
+        for (size_t i = 0; i < MAX_LIVE_POOLS; ++i) {
+            if (live_pool_ids[i].load(std::memory_order_relaxed) == pool_id) {
+                live_pool_ids[i].store(0, std::memory_order_release);
+                return;
+            }
+        }
+    }
+
+    static bool _is_live(uint64_t p_pool_id) {
+        for (size_t i = 0; i < MAX_LIVE_POOLS; ++i) {
+            if (live_pool_ids[i].load(std::memory_order_acquire) == p_pool_id) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * Forget the thread-local cache if it holds blocks of a deleted pool
+     */
+    void _drop_dead_local_cache() {
+        if (tls_cache.cache_count > 0 && tls_cache.owner_id != pool_id && !_is_live(tls_cache.owner_id)) {
+            tls_cache.cache_count = 0;
+            tls_cache.owner_id = 0;
+        }
+    }
+
     /**
      * Flush local cache entries back to the global free list
      */
     void _flush_local_cache(size_t count) {
-        if (count == 0 || tls_cache.cache_count == 0) {
+        if (count == 0 || tls_cache.cache_count == 0 || tls_cache.owner_id != pool_id) {
             return;
         }
 
         count = (count > tls_cache.cache_count) ? tls_cache.cache_count : count;
 
-        // Build a chain of nodes to add
-        FreeNode* chain_head = reinterpret_cast<FreeNode*>(tls_cache.local_cache[tls_cache.cache_count - 1]);
+        // Build a chain with the top count nodes of the local cache
+        const size_t first = tls_cache.cache_count - count;
+        FreeNode* chain_head = tls_cache.local_cache[first];
         FreeNode* chain_tail = chain_head;
 
-        for (size_t i = tls_cache.cache_count - 2; i >= 0 && i < tls_cache.cache_count; --i) {
-            FreeNode* node = reinterpret_cast<FreeNode*>(tls_cache.local_cache[i]);
+        for (size_t i = first + 1; i < tls_cache.cache_count; ++i) {
+            FreeNode* node = tls_cache.local_cache[i];
             node->next = chain_tail;
             chain_tail = node;
-
-            if (--count == 0) {
-                break;
-            }
         }
 
-        // Atomically insert chain into global list
-        FreeNode* old_head = free_list_head.load(std::memory_order_acquire);
-        do {
-            chain_head->next = old_head;
-        } while (!free_list_head.compare_exchange_weak(
-            old_head, chain_tail,
-            std::memory_order_release,
-            std::memory_order_acquire));
+        _push_chain(chain_head, chain_tail);
 
         // Update local cache
-        tls_cache.cache_count -= (count > 0 ? count : 1);
+        tls_cache.cache_count = first;
+    }
+
+    /**
+     * Atomically insert a chain of nodes into the global free list
+     * chain_tail becomes the new head, chain_head links to the previous head
+     */
+    void _push_chain(FreeNode* chain_head, FreeNode* chain_tail) {
+        FreeNode* old_head = free_list_head.load(std::memory_order_acquire);
+        chain_head->next = old_head;
+
+        while (!free_list_head.compare_exchange_weak(
+                old_head, chain_tail,
+                std::memory_order_release,
+                std::memory_order_acquire)) {
+            chain_head->next = old_head;
+            stats.cas_retries.fetch_add(1, std::memory_order_relaxed);
+        }
     }
 
     /**
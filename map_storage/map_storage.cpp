@@ -11,14 +11,33 @@
 
 #include "map_storage.h"
 
+#include "minmax_reduce.h"
+#include "node_error.h"
+
 #include "../utils/math.h"
 
+#include "main/performance.h"
+
 using namespace Terrainer;
 
 const String MapStorage::REGION_FILE_BASE_NAME("region_");
 const String MapStorage::REGION_FILE_EXTENSION("bin");
 const String MapStorage::REGION_FILE_FORMAT(REGION_FILE_BASE_NAME + "%d_%d." + REGION_FILE_EXTENSION);
 const StringName MapStorage::path_changed = "path_changed";
+const String MapStorage::MONITOR_CATEGORY("Terrainer");
+const char *MapStorage::MONITOR_NAMES[MONITOR_MAX] = {
+    "minmax_pool_utilization",
+    "height_pool_utilization",
+    "pool_cas_retries",
+    "pending_requests",
+    "in_flight_requests",
+    "io_bytes_per_second",
+    "result_backlog",
+    "texture_layers_in_use",
+    "evictions_per_second",
+    "staging_queued_bytes",
+    "upload_latency_usec"
+};
 
 Error MapStorage::load_headers() {
     if (!DirAccess::exists(directory_path)) {
@@ -71,19 +90,22 @@ Error MapStorage::load_headers() {
 }
 
 bool MapStorage::is_sector_loaded(CellKey p_sector) const {
-    _cache_minmax(p_sector);
-    cached_minmax_tracker->frame = current_frame;
-    return cached_minmax_tracker->is_loaded();
+    const Tracker *tracker = minmax_grid.getptr(p_sector);
+
+    if (!tracker) {
+        return false;
+    }
+
+    tracker->frame = current_frame;
+    return tracker->is_loaded();
 }
 
 void MapStorage::load_minmax(CellKey p_sector, bool p_in_frustum) {
-    _cache_minmax(p_sector);
+    Tracker *tracker = minmax_grid.getptr(p_sector);
 
-    if (cached_minmax_tracker->exists()) {
-        cached_minmax_tracker->in_frustum = p_in_frustum;
+    if (tracker) {
+        tracker->in_frustum = p_in_frustum;
     } else {
-        Tracker *tracker = nullptr;
-
         if (sector_size < region_size) {
             uint16_t region_sectors = region_size / sector_size;
             const CellKey region_key = CellKey(p_sector.cell.x / region_sectors, p_sector.cell.z / region_sectors);
@@ -92,29 +114,124 @@ void MapStorage::load_minmax(CellKey p_sector, bool p_in_frustum) {
                 const int z_sector = izs + region_key.cell.z * region_sectors;
 
                 for (uint16_t ixs = 0; ixs < region_sectors; ++ixs) {
-                    const uint16_t x_sector = ixs + region_key.cell.x * region_sectors;
+                    const cell_t x_sector = ixs + region_key.cell.x * region_sectors;
                     const CellKey sector_key = CellKey(x_sector, z_sector);
-                    auto it = minmax_trackers.insert(sector_key, {current_frame, Tracker::Status::LOADING, p_in_frustum});
-                    tracker = &it->value;
+
+                    if (sector_key != p_sector && (!minmax_grid.is_inside(sector_key) || minmax_grid.has(sector_key))) {
+                        continue;
+                    }
+
+                    SectorGrid<CellKey, Tracker>::Slot &slot = minmax_grid.get_slot(sector_key);
+
+                    if (slot.used) {
+                        _release_minmax(slot.value);
+                    }
+
+                    minmax_grid.insert(sector_key, {current_frame, Tracker::Status::LOADING, p_in_frustum});
                 }
             }
+
+            tracker = minmax_grid.getptr(p_sector);
         } else {
-            auto it = minmax_trackers.insert(p_sector, {current_frame, Tracker::Status::LOADING, p_in_frustum});
-            tracker = &it->value;
+            SectorGrid<CellKey, Tracker>::Slot &slot = minmax_grid.get_slot(p_sector);
+
+            if (slot.used) {
+                _release_minmax(slot.value);
+            }
+
+            tracker = minmax_grid.insert(p_sector, {current_frame, Tracker::Status::LOADING, p_in_frustum});
         }
 
         _add_request(NodeKey(p_sector, CellKey()), tracker, DATA_TYPE_MINMAX, 0);
     }
 }
 
+bool MapStorage::set_sector_minmax(CellKey p_sector, const hmap_t *p_minmax) {
+    ERR_FAIL_NULL_V_EDMSG(minmax_buffer, false, "Minmax buffers not allocated.");
+    hmap_t *block = minmax_buffer->allocate();
+    ERR_FAIL_NULL_V_EDMSG(block, false, "Error allocating buffer for minmax data.");
+    memcpy(block, p_minmax, 2 * sector_size * sector_size * sizeof(hmap_t));
+
+    if (lods > 1) {
+        hmap_t *levels[MAX_LOD_LEVELS];
+
+        for (int ilod = 1; ilod < lods; ++ilod) {
+            levels[ilod - 1] = block + minmax_lod_offsets[ilod];
+        }
+
+        minmax_reduce(block, sector_size, levels, lods - 1);
+    }
+
+    node_error_from_minmax(block, sector_size, 0, lods, block + error_lod_offsets[0]);
+
+    if (minmax_layout.load(std::memory_order_relaxed) == MINMAX_LAYOUT_MORTON) {
+        _swizzle_minmax(block);
+    }
+
+    // A pending request for the sector finds it loaded and drops its result.
+    SectorGrid<CellKey, Tracker>::Slot &slot = minmax_grid.get_slot(p_sector);
+
+    if (slot.used) {
+        _release_minmax(slot.value);
+    }
+
+    const int sector_cells = sector_size * chunk_size;
+    const Vector3 half_sector = Vector3(sector_cells * map_scale.x, 0.0, sector_cells * map_scale.z) * 0.5;
+    const NodeKey key = NodeKey(p_sector, CellKey());
+    const Vector3 p = key.sector_position(sector_cells * map_scale.x, sector_cells * map_scale.z) + half_sector;
+    Tracker *tracker = minmax_grid.insert(p_sector, {current_frame, Tracker::Status::LOADED, false});
+    tracker->pointer = block;
+    tracker->budget_handle = memory_budget.add(ResourceBudget::RESOURCE_MINMAX, key, tracker, &tracker->frame, p, lods - 1, minmax_buffer->get_block_size() * sizeof(hmap_t));
+    return true;
+}
+
+bool MapStorage::set_node_heights(const NodeKey &p_key, int p_lod, const hmap_t *p_heights) {
+    ERR_FAIL_NULL_V_EDMSG(hmap_buffer, false, "Height buffers not allocated.");
+    ERR_FAIL_INDEX_V_EDMSG(p_lod, textures_trackers.size(), false, "LOD level out of range.");
+    hmap_t *heights = hmap_buffer->allocate();
+    ERR_FAIL_NULL_V_EDMSG(heights, false, "Error allocating buffer for height data.");
+    memcpy(heights, p_heights, size_t(chunk_size + 1) * (chunk_size + 1) * sizeof(hmap_t));
+
+    HashMap<NodeKey, Tracker> &map = textures_trackers.write[p_lod];
+    Tracker *tracker = map.getptr(p_key);
+    TextureData *td = nullptr;
+
+    if (tracker) {
+        td = (TextureData *)tracker->pointer;
+
+        if (td->heights) {
+            hmap_buffer->free(td->heights);
+        }
+
+        if (tracker->budget_handle != ResourceBudget::INVALID_HANDLE) {
+            memory_budget.remove(tracker->budget_handle);
+        }
+    } else {
+        // The layer is requested as if the node was drawn, the heights don't wait for it.
+        const auto it = map.insert(p_key, {current_frame, Tracker::Status::LOADING, false});
+        tracker = &it->value;
+        td = memnew(TextureData);
+        tracker->pointer = td;
+        _add_request(p_key, tracker, DATA_TYPE_HEIGHT | DATA_TYPE_SPLAT, p_lod);
+        requested_layers++;
+    }
+
+    td->heights = heights;
+    tracker->budget_handle = memory_budget.add(ResourceBudget::RESOURCE_HEIGHT, p_key, tracker, &tracker->frame, _get_node_center(p_key, p_lod), p_lod, hmap_buffer->get_block_size() * sizeof(hmap_t));
+    return true;
+}
+
 void MapStorage::get_minmax(const NodeKey &p_key, int p_lod, hmap_t &r_min, hmap_t &r_max, bool &r_has_data) const {
-    _cache_minmax(p_key.sector);
+    const Tracker *tracker = minmax_grid.getptr(p_key.sector);
+    r_has_data = tracker && tracker->is_loaded();
 
-    if (cached_minmax_tracker->is_loaded()) {
-        hmap_t *minmax = (hmap_t *)cached_minmax_tracker->pointer;
+    if (r_has_data) {
+        hmap_t *minmax = (hmap_t *)tracker->pointer;
         const size_t lod_offset = minmax_lod_offsets[p_lod];
         const size_t block_size = sector_size >> p_lod;
-        const size_t cell_offset = 2 * (p_key.cell.cell.x + block_size * p_key.cell.cell.z);
+        const size_t cell_offset = minmax_layout.load(std::memory_order_relaxed) == MINMAX_LAYOUT_MORTON
+                ? 2 * morton_encode(p_key.cell.cell.x, p_key.cell.cell.z)
+                : 2 * (p_key.cell.cell.x + block_size * p_key.cell.cell.z);
         const size_t offset = lod_offset + cell_offset;
         r_min = minmax[offset];
         r_max = minmax[offset + 1];
@@ -122,8 +239,61 @@ void MapStorage::get_minmax(const NodeKey &p_key, int p_lod, hmap_t &r_min, hmap
         r_min = 0;
         r_max = HMAP_MAX;
     }
+}
+
+void MapStorage::get_children_minmax(const NodeKey &p_parent, int p_lod, hmap_t *r_min, hmap_t *r_max, bool &r_has_data) const {
+    const Tracker *tracker = minmax_grid.getptr(p_parent.sector);
+    r_has_data = tracker && tracker->is_loaded();
+
+    if (!r_has_data) {
+        for (int i = 0; i < 4; ++i) {
+            r_min[i] = 0;
+            r_max[i] = HMAP_MAX;
+        }
+
+        return;
+    }
+
+    const hmap_t *level = (const hmap_t *)tracker->pointer + minmax_lod_offsets[p_lod];
+    const uint32_t x = 2 * p_parent.cell.cell.x;
+    const uint32_t z = 2 * p_parent.cell.cell.z;
+
+    if (minmax_layout.load(std::memory_order_relaxed) == MINMAX_LAYOUT_MORTON) {
+        // Siblings are contiguous.
+        const hmap_t *children = level + 2 * morton_encode(x, z);
 
-    r_has_data = cached_minmax_tracker->is_loaded();
+        for (int i = 0; i < 4; ++i) {
+            r_min[i] = children[2 * i];
+            r_max[i] = children[2 * i + 1];
+        }
+    } else {
+        const size_t block_size = sector_size >> p_lod;
+        const hmap_t *row0 = level + 2 * (x + block_size * z);
+        const hmap_t *row1 = row0 + 2 * block_size;
+        r_min[0] = row0[0];
+        r_max[0] = row0[1];
+        r_min[1] = row0[2];
+        r_max[1] = row0[3];
+        r_min[2] = row1[0];
+        r_max[2] = row1[1];
+        r_min[3] = row1[2];
+        r_max[3] = row1[3];
+    }
+}
+
+MapStorage::hmap_t MapStorage::get_node_error(const NodeKey &p_key, int p_lod) const {
+    const Tracker *tracker = minmax_grid.getptr(p_key.sector);
+
+    if (!tracker || !tracker->is_loaded()) {
+        return HMAP_MAX;
+    }
+
+    const hmap_t *errors = (const hmap_t *)tracker->pointer + error_lod_offsets[p_lod];
+    const size_t block_size = sector_size >> p_lod;
+    const size_t index = minmax_layout.load(std::memory_order_relaxed) == MINMAX_LAYOUT_MORTON
+            ? morton_encode(p_key.cell.cell.x, p_key.cell.cell.z)
+            : p_key.cell.cell.x + block_size * p_key.cell.cell.z;
+    return errors[index];
 }
 
 void MapStorage::allocate_buffers(int p_sector_chunks, int p_num_nodes, int p_lods, const Vector3 &p_map_scale, real_t p_far_view) {
@@ -154,12 +324,22 @@ void MapStorage::allocate_buffers(int p_sector_chunks, int p_num_nodes, int p_lo
         lod_block_size >>= 2;
     }
 
+    error_lod_offsets.resize(lods);
+    lod_block_size = sector_size * sector_size;
+
+    for (int ilod = 0; ilod < lods; ++ilod) {
+        error_lod_offsets.set(ilod, block_size);
+        block_size += lod_block_size;
+        lod_block_size >>= 2;
+    }
+
     if (minmax_buffer) {
         if (minmax_buffer->get_block_size() != block_size && !minmax_read.is_empty()) {
             minmax_read.clear();
         }
 
-        if (minmax_buffer->get_block_size() != block_size || minmax_buffer->get_block_count() != block_count) {
+        if (minmax_buffer->get_block_size() != block_size || minmax_buffer->get_block_count() != block_count || minmax_grid.needs_resize(blocks_x, blocks_z)) {
+            _reset_minmax();
             memdelete(minmax_buffer);
             minmax_buffer = nullptr;
         }
@@ -167,25 +347,46 @@ void MapStorage::allocate_buffers(int p_sector_chunks, int p_num_nodes, int p_lo
 
     if (!minmax_buffer) {
         minmax_buffer = memnew(BufferPool<hmap_t>(block_size, block_count));
+        minmax_grid.resize(blocks_x, blocks_z);
     }
 
 
+    if (minmax_swizzle.size() != 2 * sector_size * sector_size) {
+        minmax_swizzle.resize(2 * sector_size * sector_size);
+    }
+
     if (minmax_read.is_empty() && sector_size != region_size) {
-        const int read_size = lod_expand(region_size, MIN(lods, saved_lods));
+        // Two values per node, for every level read from the region.
+        const int read_size = 2 * node_error_pyramid_size(region_size, MIN(lods, saved_lods));
         minmax_read.resize(read_size);
     }
 
+    if (sector_size != region_size) {
+        error_read.resize(node_error_pyramid_size(region_size, MIN(lods, saved_lods)));
+    }
+
     textures_trackers.resize(lods);
     size_t hmap_count = p_num_nodes * BUFFER_EXTRA_ALLOCATION_FACTOR;
     size_t hmap_size = (chunk_size + 1) * (chunk_size + 1) + 4 * (chunk_size + 1);
 
     if (hmap_buffer && hmap_buffer->get_block_count() != hmap_count) {
+        memory_budget.clear(ResourceBudget::RESOURCE_HEIGHT);
+
+        for (int i = 0; i < textures_trackers.size(); ++i) {
+            for (KeyValue<NodeKey, Tracker> &kv : textures_trackers.write[i]) {
+                TextureData *td = (TextureData *)kv.value.pointer;
+                td->heights = nullptr;
+                kv.value.budget_handle = ResourceBudget::INVALID_HANDLE;
+            }
+        }
+
         memdelete(hmap_buffer);
         hmap_buffer = nullptr;
     }
 
     if (!hmap_buffer) {
         hmap_buffer = memnew(BufferPool<hmap_t>(hmap_size, hmap_count));
+        hmap_buffer_request = current_request;
     }
 }
 
@@ -196,8 +397,17 @@ int MapStorage::get_node_texture_layer(const NodeKey &p_key, int p_lod) {
     if (tracker) {
         tracker->frame = current_frame;
         tracker->in_frustum = true;
+        // The layer is only drawn once its upload is done.
         TextureData *td = (TextureData *)tracker->pointer;
-        return td->layer;
+
+        if (tracker->is_loaded() && td->layer == INVALID_TEXTURE_LAYER) {
+            // Only the heights are resident, see set_node_heights.
+            tracker->status = Tracker::Status::LOADING;
+            _add_request(p_key, tracker, DATA_TYPE_HEIGHT | DATA_TYPE_SPLAT, p_lod);
+            requested_layers++;
+        }
+
+        return tracker->is_loaded() ? td->layer : INVALID_TEXTURE_LAYER;
     } else {
         const auto it = map.insert(p_key, {current_frame, Tracker::Status::LOADING, true});
         tracker = &it->value;
@@ -214,6 +424,17 @@ void MapStorage::update_viewer(const Vector3 &p_viewer_pos, const Vector3 &p_vie
     viewer_vel = p_viewer_vel;
     viewer_forward = p_viewer_forward;
     predicted_viewer_pos = viewer_pos + viewer_vel * PRIORITY_PREDICTION_DELTA_TIME;
+
+    if (sector_size > 0 && minmax_buffer) {
+        // Keep the minmax window centered on the viewer sector.
+        const int sector_cells = sector_size * chunk_size;
+        const int viewer_x = (int)Math::floor(viewer_pos.x / (sector_cells * map_scale.x));
+        const int viewer_z = (int)Math::floor(viewer_pos.z / (sector_cells * map_scale.z));
+        const Vector2i origin = Vector2i(viewer_x - minmax_grid.get_size_x() / 2, viewer_z - minmax_grid.get_size_z() / 2);
+        minmax_grid.slide(origin, [this](CellKey p_sector, Tracker &p_tracker) {
+            _release_minmax(p_tracker);
+        });
+    }
 }
 
 void MapStorage::stop_io() {
@@ -232,12 +453,17 @@ void MapStorage::stop_io() {
             io_result->pop();
         }
     }
+
+    _unregister_monitors();
 }
 
 void MapStorage::process() {
     _submit_requests();
     _process_results();
-    _clean_minmax();
+    _allocate_textures();
+    staging_ring.upload(UPLOAD_BYTES_PER_FRAME, UPLOAD_TIME_SLICE_USEC);
+    _update_memory_budget();
+    _update_monitor_rates();
     current_frame++;
 }
 
@@ -265,6 +491,8 @@ int MapStorage::get_buffer_stat(BufferType p_buffer, BufferStat p_stat) const {
                 return minmax_buffer->get_total_deallocations();
             case STAT_UTILIZATION:
                 return (int)Math::round(100.0 * minmax_buffer->get_utilization());
+            case STAT_CAS_RETRIES:
+                return minmax_buffer->get_cas_retries();
             default:
                 return -1;
         }
@@ -290,6 +518,8 @@ int MapStorage::get_buffer_stat(BufferType p_buffer, BufferStat p_stat) const {
                 return hmap_buffer->get_total_deallocations();
             case STAT_UTILIZATION:
                 return (int)Math::round(100.0 * hmap_buffer->get_utilization());
+            case STAT_CAS_RETRIES:
+                return hmap_buffer->get_cas_retries();
             default:
                 return -1;
             }
@@ -368,6 +598,40 @@ void MapStorage::set_default_height(hmap_t p_height) {
     default_height = MIN(p_height, HMAP_MAX - 1);
 }
 
+void MapStorage::set_memory_budget(int p_megabytes) {
+    ERR_FAIL_COND_EDMSG(p_megabytes <= 0, "Memory budget must be greater than zero.");
+    memory_budget.set_budget((size_t)p_megabytes << 20);
+}
+
+int MapStorage::get_memory_budget() const {
+    return int(memory_budget.get_budget() >> 20);
+}
+
+void MapStorage::set_minmax_layout(MinmaxLayout p_layout) {
+    ERR_FAIL_INDEX(p_layout, MINMAX_LAYOUT_MAX);
+
+    if (p_layout == minmax_layout.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    minmax_layout.store(p_layout, std::memory_order_relaxed);
+
+    if (minmax_buffer) {
+        // Resident blocks use the previous layout, reload them.
+        minmax_grid.for_each([this](CellKey p_sector, Tracker &p_tracker) {
+            _release_minmax(p_tracker);
+        });
+        _reset_minmax();
+    }
+
+    minmax_layout_request = current_request;
+    emit_changed();
+}
+
+MapStorage::MinmaxLayout MapStorage::get_minmax_layout() const {
+    return minmax_layout.load(std::memory_order_relaxed);
+}
+
 bool MapStorage::_set(const StringName &p_name, const Variant &p_value) {
     String prop_name = p_name;
 
@@ -427,8 +691,20 @@ void MapStorage::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("get_chunk_size"), &MapStorage::get_chunk_size);
     ClassDB::bind_method(D_METHOD("set_region_size", "size"), &MapStorage::set_region_size);
 	ClassDB::bind_method(D_METHOD("get_region_size"), &MapStorage::get_region_size);
+    ClassDB::bind_method(D_METHOD("set_memory_budget", "megabytes"), &MapStorage::set_memory_budget);
+	ClassDB::bind_method(D_METHOD("get_memory_budget"), &MapStorage::get_memory_budget);
+    ClassDB::bind_method(D_METHOD("set_minmax_layout", "layout"), &MapStorage::set_minmax_layout);
+	ClassDB::bind_method(D_METHOD("get_minmax_layout"), &MapStorage::get_minmax_layout);
+    ClassDB::bind_method(D_METHOD("get_height", "position"), &MapStorage::get_height);
+    ClassDB::bind_method(D_METHOD("get_normal", "position"), &MapStorage::get_normal);
+    ClassDB::bind_method(D_METHOD("get_heights", "positions"), &MapStorage::_get_heights_packed);
+    ClassDB::bind_method(D_METHOD("get_heights_rect", "rect", "resolution"), &MapStorage::_get_heights_rect_packed);
+    ClassDB::bind_method(D_METHOD("intersect_ray", "from", "direction", "max_distance"), &MapStorage::_intersect_ray_dict);
+    ClassDB::bind_method(D_METHOD("intersect_rays", "from", "directions", "max_distance"), &MapStorage::_intersect_rays_packed);
 
     ADD_PROPERTY(PropertyInfo(Variant::STRING, "directory_path", PROPERTY_HINT_DIR), "set_directory_path", "get_directory_path");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "memory_budget", PROPERTY_HINT_RANGE, "16,4096,1,or_greater,suffix:MiB"), "set_memory_budget", "get_memory_budget");
+    ADD_PROPERTY(PropertyInfo(Variant::INT, "minmax_layout", PROPERTY_HINT_ENUM, "Linear,Morton"), "set_minmax_layout", "get_minmax_layout");
 
     ADD_SIGNAL(MethodInfo(path_changed));
 
@@ -445,6 +721,10 @@ void MapStorage::_bind_methods() {
     BIND_ENUM_CONSTANT(STAT_AVAILABLE_BYTES);
     BIND_ENUM_CONSTANT(STAT_BLOCK_SIZE);
     BIND_ENUM_CONSTANT(STAT_BLOCK_COUNT);
+    BIND_ENUM_CONSTANT(STAT_CAS_RETRIES);
+
+    BIND_ENUM_CONSTANT(MINMAX_LAYOUT_LINEAR);
+    BIND_ENUM_CONSTANT(MINMAX_LAYOUT_MORTON);
 }
 
 void MapStorage::_clear() {
@@ -456,13 +736,16 @@ void MapStorage::_clear() {
 
     if (minmax_buffer) {
         memdelete(minmax_buffer);
+        minmax_buffer = nullptr;
     }
 
     if (hmap_buffer) {
         memdelete(hmap_buffer);
+        hmap_buffer = nullptr;
     }
 
-    minmax_trackers.clear();
+    memory_budget.clear();
+    minmax_grid.clear();
 
     for (int i = 0; i < textures_trackers.size(); ++i) {
         for (KeyValue<NodeKey, Tracker> &kv : textures_trackers.get(i)) {
@@ -473,6 +756,8 @@ void MapStorage::_clear() {
     }
 
     textures_trackers.clear();
+    texture_layers.clear();
+    staging_ring.clear();
 }
 
 void MapStorage::_process_requests(void *p_storage) {
@@ -484,6 +769,8 @@ void MapStorage::_process_requests(void *p_storage) {
 
             if (request->data_type == DATA_TYPE_MINMAX) {
                 storage->_load_sector_minmax(request->key, *request);
+            } else if (request->data_type & DATA_TYPE_HEIGHT) {
+                storage->_load_node_height(request->key, *request);
             }
 
             storage->io_queue->pop();
@@ -501,8 +788,24 @@ void MapStorage::_submit_requests() {
     }
 
     const int sector_cells = sector_size * chunk_size;
+    IORequest *pending = io_pending.ptrw();
+    int kept = 0;
+
+    for (int i = 0; i < io_pending.size(); ++i) {
+        IORequest &request = pending[i];
+
+        // Trackers are resolved by key, the one a request was added with may have been
+        // released since: minmax slots are reused when the grid slides or a read fails.
+        if (request.data_type == DATA_TYPE_MINMAX) {
+            request.tracker = minmax_grid.getptr(request.key.sector);
+        } else {
+            request.tracker = request.lod_level < textures_trackers.size() ? textures_trackers.write[request.lod_level].getptr(request.key) : nullptr;
+        }
+
+        if (!request.tracker || request.tracker->is_loaded()) {
+            continue;
+        }
 
-    for (IORequest &request : io_pending) {
         if (request.data_type == DATA_TYPE_MINMAX) {
             const Vector3 p = request.key.sector_position(sector_cells * map_scale.x, sector_cells * map_scale.z);
             request.priority = PRIORITY_MINMAX * _calc_request_priority(p, request.tracker->in_frustum);
@@ -510,14 +813,29 @@ void MapStorage::_submit_requests() {
             const Vector3 p = request.key.position(sector_cells, request.lod_level, lods, map_scale.x, map_scale.z);
             request.priority = _calc_request_priority(p, request.tracker->in_frustum && (current_frame == request.tracker->frame)) + MAX_LOD_LEVELS - request.lod_level;
         }
+
+        pending[kept++] = request;
+    }
+
+    io_pending.resize(kept);
+
+    if (io_pending.is_empty()) {
+        return;
     }
 
     io_pending.sort_custom<RequestCompare>();
+    // With the staging ring full, height data would have nowhere to go, only minmax is read.
+    const bool staging_full = !staging_ring.can_push(_get_layer_bytes());
+    pending = io_pending.ptrw();
     int submitted = 0;
     int ipending = io_pending.size() - 1;
+    int held = io_pending.size(); // Held back requests are packed at the end.
 
     while (ipending >= 0 && submitted < MAX_QUEUE_SIZE) {
-        if (io_queue->try_push(io_pending[ipending])) {
+        if (staging_full && pending[ipending].data_type != DATA_TYPE_MINMAX) {
+            pending[--held] = pending[ipending];
+            ipending--;
+        } else if (io_queue->try_push(pending[ipending])) {
             ipending--;
             submitted++;
         } else {
@@ -525,11 +843,19 @@ void MapStorage::_submit_requests() {
         }
     }
 
-    io_pending.resize(ipending + 1);
+    // Keep the held back requests after the ones left, still in priority order.
+    const int held_count = io_pending.size() - held;
+
+    for (int i = 0; i < held_count; ++i) {
+        pending[ipending + 1 + i] = pending[held + i];
+    }
+
+    io_pending.resize(ipending + 1 + held_count);
 
     if (!io_thread.is_started()) {
         io_running.set();
         io_thread.start(_process_requests, this);
+        _register_monitors();
     }
 }
 
@@ -540,9 +866,43 @@ void MapStorage::_process_results() {
         IOResult *result = io_result->front();
 
         if (result->data_type == DATA_TYPE_MINMAX) {
-            Tracker &tracker = *minmax_trackers.getptr(result->key.sector);
-            tracker.pointer = result->pointer;
-            tracker.status = Tracker::Status::LOADED;
+            Tracker *tracker = minmax_grid.getptr(result->key.sector);
+
+            if (result->request_id < minmax_layout_request) {
+                // Built with the previous layout.
+                if (result->is_success()) {
+                    minmax_buffer->free((hmap_t *)result->pointer);
+                }
+            } else if (result->is_success() && tracker && !tracker->is_loaded()) {
+                const int sector_cells = sector_size * chunk_size;
+                const Vector3 half_sector = Vector3(sector_cells * map_scale.x, 0.0, sector_cells * map_scale.z) * 0.5;
+                const Vector3 p = result->key.sector_position(sector_cells * map_scale.x, sector_cells * map_scale.z) + half_sector;
+                const size_t bytes = minmax_buffer->get_block_size() * sizeof(hmap_t);
+                tracker->pointer = result->pointer;
+                tracker->status = Tracker::Status::LOADED;
+                tracker->budget_handle = memory_budget.add(ResourceBudget::RESOURCE_MINMAX, result->key, tracker, &tracker->frame, p, lods - 1, bytes);
+            } else if (result->is_success()) {
+                // Already loaded by an earlier request for the same region.
+                minmax_buffer->free((hmap_t *)result->pointer);
+            } else {
+                // Drop every sector waiting on the failed request, so it can be requested again.
+                const uint16_t region_sectors = sector_size < region_size ? region_size / sector_size : 1;
+                const cell_t x0 = (result->key.sector.cell.x / region_sectors) * region_sectors;
+                const cell_t z0 = (result->key.sector.cell.z / region_sectors) * region_sectors;
+
+                for (uint16_t iz = 0; iz < region_sectors; ++iz) {
+                    for (uint16_t ix = 0; ix < region_sectors; ++ix) {
+                        const CellKey sector_key = CellKey(x0 + ix, z0 + iz);
+                        const Tracker *sector_tracker = minmax_grid.getptr(sector_key);
+
+                        if (sector_tracker && !sector_tracker->is_loaded()) {
+                            minmax_grid.erase(sector_key);
+                        }
+                    }
+                }
+            }
+        } else if (result->data_type == DATA_TYPE_HEIGHT) {
+            _process_height_result(*result);
         }
 
         io_result->pop();
@@ -564,6 +924,7 @@ void MapStorage::_load_region_minmax(CellKey p_region_key, hmap_t *p_buffer, siz
         region->data_access->seek(MINMAX_OFFSET);
         size_t nbytes = p_size * sizeof(hmap_t);
         int64_t len = region->data_access->get_buffer(reinterpret_cast<uint8_t*>(p_buffer), nbytes);
+        io_bytes_read.fetch_add(MAX(len, 0), std::memory_order_relaxed);
         ERR_FAIL_COND_EDMSG(len != nbytes, "Returned buffer of different size than expected.");
     } else {
         hmap_t hmax = default_height + 1;
@@ -575,7 +936,30 @@ void MapStorage::_load_region_minmax(CellKey p_region_key, hmap_t *p_buffer, siz
     }
 }
 
+void MapStorage::_load_region_error(CellKey p_region_key, const hmap_t *p_minmax, hmap_t *p_buffer, int p_lods) {
+    // The region was opened when reading its minmax.
+    Region *region = regions[p_region_key];
+    int stored_lods = 0;
+
+    if (region->header->presence & REGION_FLAG_HAS_ERROR) {
+        stored_lods = MIN(p_lods, saved_lods);
+        region->data_access->seek(MINMAX_OFFSET + 2 * node_error_pyramid_size(region_size, saved_lods) * sizeof(hmap_t));
+        size_t nbytes = node_error_pyramid_size(region_size, stored_lods) * sizeof(hmap_t);
+        int64_t len = region->data_access->get_buffer(reinterpret_cast<uint8_t*>(p_buffer), nbytes);
+        io_bytes_read.fetch_add(MAX(len, 0), std::memory_order_relaxed);
+
+        if (len != nbytes) {
+            ERR_PRINT_ED("Returned buffer of different size than expected, deriving node errors from minmax.");
+            stored_lods = 0;
+        }
+    }
+
+    node_error_from_minmax(p_minmax, region_size, stored_lods, p_lods, p_buffer);
+}
+
 void MapStorage::_load_sector_minmax(const NodeKey &p_key, const IORequest &p_request) {
+    const bool swizzle = minmax_layout.load(std::memory_order_relaxed) == MINMAX_LAYOUT_MORTON;
+
     if (sector_size < region_size) {
         const uint16_t region_sectors = region_size / sector_size;
         Vector<hmap_t *> buffers;
@@ -593,6 +977,8 @@ void MapStorage::_load_sector_minmax(const NodeKey &p_key, const IORequest &p_re
         const CellKey region_key = CellKey(p_key.sector.cell.x / region_sectors, p_key.sector.cell.z / region_sectors);
         uint16_t *src = minmax_read.ptrw();
         _load_region_minmax(region_key, src, minmax_read.size());
+        hmap_t *error_src = error_read.ptrw();
+        _load_region_error(region_key, src, error_src, lods);
 
         for (int izs = 0; izs < region_sectors; ++izs) {
             const int z_sector = izs + region_key.cell.z * region_sectors;
@@ -608,6 +994,7 @@ void MapStorage::_load_sector_minmax(const NodeKey &p_key, const IORequest &p_re
                 ptrdiff_t buffer_offset = 0;
                 ptrdiff_t src_lod_offset = 0;
                 ptrdiff_t src_block_size = 2 * region_size * region_size;
+                ptrdiff_t error_src_lod_offset = 0;
 
                 for (int ilod = 0; ilod < lods; ++ilod) {
                     const ptrdiff_t src_offset = src_lod_offset + 2 * ixs * rows + 2 * izs * rows * rows * region_sectors;
@@ -618,12 +1005,24 @@ void MapStorage::_load_sector_minmax(const NodeKey &p_key, const IORequest &p_re
                         buffer_offset += 2 * rows;
                     }
 
+                    const ptrdiff_t error_src_offset = error_src_lod_offset + ixs * rows + izs * rows * rows * region_sectors;
+                    hmap_t *error_dst = sector_buffer + error_lod_offsets[ilod];
+
+                    for (int iz = 0; iz < rows; ++iz) {
+                        memcpy(error_dst + iz * rows, error_src + error_src_offset + iz * rows * region_sectors, rows * sizeof(hmap_t));
+                    }
+
+                    error_src_lod_offset += src_block_size >> 1;
                     src_lod_offset += src_block_size;
                     src_block_size >>= 2;
                     write_size >>= 1;
                     rows >>= 1;
                 }
 
+                if (swizzle) {
+                    _swizzle_minmax(sector_buffer);
+                }
+
                 res.status = IOResult::Status::SUCCESS;
                 io_result->push(res);
             }
@@ -643,7 +1042,8 @@ void MapStorage::_load_sector_minmax(const NodeKey &p_key, const IORequest &p_re
         res.pointer = sector_buffer;
 
         if (sector_size == region_size) {
-            _load_region_minmax(p_key.sector, sector_buffer, minmax_buffer->get_block_size());
+            _load_region_minmax(p_key.sector, sector_buffer, error_lod_offsets[0]);
+            _load_region_error(p_key.sector, sector_buffer, sector_buffer + error_lod_offsets[0], lods);
         } else { // sector_size > region_size
             int sector_regions = sector_size / region_size;
             int num_lods = MIN(saved_lods, lods);
@@ -656,6 +1056,8 @@ void MapStorage::_load_sector_minmax(const NodeKey &p_key, const IORequest &p_re
                     const CellKey region_key = CellKey(x_region, z_region);
                     uint16_t *data = minmax_read.ptrw();
                     _load_region_minmax(region_key, data, minmax_read.size());
+                    hmap_t *errors = error_read.ptrw();
+                    _load_region_error(region_key, data, errors, num_lods);
                     int read_size = 2 * region_size;
 
                     for (int ilod = 0; ilod < num_lods; ++ilod) {
@@ -670,44 +1072,159 @@ void MapStorage::_load_sector_minmax(const NodeKey &p_key, const IORequest &p_re
 
                         read_size >>= 1;
                     }
+
+                    for (int ilod = 0; ilod < num_lods; ++ilod) {
+                        const int rows = region_size >> ilod;
+                        const int sector_rows = sector_size >> ilod;
+                        hmap_t *error_dst = sector_buffer + error_lod_offsets[ilod] + izr * rows * sector_rows + ixr * rows;
+
+                        for (int iz = 0; iz < rows; ++iz) {
+                            memcpy(error_dst + iz * sector_rows, errors, rows * sizeof(hmap_t));
+                            errors += rows;
+                        }
+                    }
                 }
             }
 
-            {
+            if (num_lods < lods) {
                 // Fill in remaining LODs.
-                int size = sector_size >> num_lods;
+                hmap_t *levels[MAX_LOD_LEVELS];
 
                 for (int ilod = num_lods; ilod < lods; ++ilod) {
-                    const int src_lod_offset = minmax_lod_offsets[ilod - 1];
-                    const int dst_lod_offset = minmax_lod_offsets[ilod];
-
-                    for (int iz = 0; iz < size; ++iz) {
-                        for (int ix = 0; ix < size; ++ix) {
-                            const int src_index = src_lod_offset + 4 * (ix + 2 * iz * size);
-                            const int dst_index = dst_lod_offset + 2 * (ix + iz * size);
-                            const hmap_t src_min1 = sector_buffer[src_index];
-                            const hmap_t src_max1 = sector_buffer[src_index + 1];
-                            const hmap_t src_min2 = sector_buffer[src_index + 2];
-                            const hmap_t src_max2 = sector_buffer[src_index + 3];
-                            const hmap_t src_min3 = sector_buffer[src_index + 4 * size];
-                            const hmap_t src_max3 = sector_buffer[src_index + 4 * size + 1];
-                            const hmap_t src_min4 = sector_buffer[src_index + 4 * size + 2];
-                            const hmap_t src_max4 = sector_buffer[src_index + 4 * size + 3];
-                            sector_buffer[dst_index] = MIN(src_min1, MIN(src_min2, MIN(src_min3, src_min4)));
-                            sector_buffer[dst_index + 1] = MAX(src_max1, MAX(src_max2, MAX(src_max3, src_max4)));
-                        }
-                    }
-
-                    size >>= 1;
+                    levels[ilod - num_lods] = sector_buffer + minmax_lod_offsets[ilod];
                 }
+
+                const hmap_t *src = sector_buffer + minmax_lod_offsets[num_lods - 1];
+                minmax_reduce(src, sector_size >> (num_lods - 1), levels, lods - num_lods);
+                node_error_from_minmax(sector_buffer, sector_size, num_lods, lods, sector_buffer + error_lod_offsets[0]);
             }
         }
 
+        if (swizzle) {
+            _swizzle_minmax(sector_buffer);
+        }
+
         res.status = IOResult::Status::SUCCESS;
         io_result->push(res);
     }
 }
 
+void MapStorage::_load_node_height(const NodeKey &p_key, const IORequest &p_request) {
+    IOResult res = IOResult(p_key, p_request.request_id, DATA_TYPE_HEIGHT, p_request.lod_level);
+    hmap_t *heights = hmap_buffer->allocate();
+
+    if (!heights) {
+        res.status = IOResult::Status::OUT_OF_MEMORY;
+        io_result->push(res);
+        return;
+    }
+
+    // Region files have no height section yet. The block is flat at the default height
+    // and is only used to give the node a texture layer, never to answer queries.
+    const int samples = (chunk_size + 1) * (chunk_size + 1);
+
+    for (int i = 0; i < samples; ++i) {
+        heights[i] = default_height;
+    }
+
+    res.pointer = heights;
+    res.status = IOResult::Status::SUCCESS;
+    io_result->push(res);
+}
+
+void MapStorage::_process_height_result(const IOResult &p_result) {
+    hmap_t *heights = (hmap_t *)p_result.pointer;
+    // Allocated from a buffer deleted since the request, nothing to free.
+    const bool stale = p_result.request_id < hmap_buffer_request;
+    HashMap<NodeKey, Tracker> &trackers = textures_trackers.write[p_result.lod_level];
+    Tracker *tracker = trackers.getptr(p_result.key);
+
+    if (!tracker || tracker->is_loaded()) {
+        if (p_result.is_success() && !stale) {
+            hmap_buffer->free(heights);
+        }
+
+        return;
+    }
+
+    TextureData *td = (TextureData *)tracker->pointer;
+    int layer = INVALID_TEXTURE_LAYER;
+
+    if (p_result.is_success() && !stale) {
+        layer = _next_layer(p_result.key, p_result.lod_level, *tracker);
+        const Vector3 center = _get_node_center(p_result.key, p_result.lod_level);
+        const float priority = _calc_request_priority(center, tracker->in_frustum && current_frame == tracker->frame) + MAX_LOD_LEVELS - p_result.lod_level;
+
+        // Heights are uploaded as they are, the low byte of each sample goes to red. The
+        // staging ring keeps its own copy, so the block isn't needed after staging.
+        if (layer != INVALID_TEXTURE_LAYER && _stage_layer(layer, priority, (const uint8_t *)heights, _get_layer_bytes())) {
+            // The block is only a placeholder until region files have a height section, so
+            // it isn't attached to the node and queries keep using the minmax bounds.
+            hmap_buffer->free(heights);
+            td->layer = layer;
+            td->layer_budget_handle = memory_budget.add(ResourceBudget::RESOURCE_TEXTURE_LAYER, p_result.key, tracker, &tracker->frame, center, p_result.lod_level, _get_layer_bytes());
+            return;
+        }
+
+        if (layer != INVALID_TEXTURE_LAYER) {
+            texture_layers.free(layer);
+        }
+
+        hmap_buffer->free(heights);
+    }
+
+    // No room or no data, the node is requested again the next time it is drawn.
+    if (td->heights) {
+        // Heights set by set_node_heights stay for queries.
+        tracker->status = Tracker::Status::LOADED;
+        return;
+    }
+
+    memdelete(td);
+    trackers.erase(p_result.key);
+}
+
+void MapStorage::_swizzle_minmax(hmap_t *p_block) {
+    hmap_t *src = minmax_swizzle.ptrw();
+    int size = sector_size;
+
+    for (int ilod = 0; ilod < lods && size > 1; ++ilod) {
+        hmap_t *dst = p_block + minmax_lod_offsets[ilod];
+        memcpy(src, dst, 2 * size * size * sizeof(hmap_t));
+
+        for (int iz = 0; iz < size; ++iz) {
+            const uint32_t morton_z = morton_part1by1(iz) << 1;
+            const hmap_t *row = src + 2 * iz * size;
+
+            for (int ix = 0; ix < size; ++ix) {
+                const uint32_t dst_index = 2 * (morton_z | morton_part1by1(ix));
+                dst[dst_index] = row[2 * ix];
+                dst[dst_index + 1] = row[2 * ix + 1];
+            }
+        }
+
+        size >>= 1;
+    }
+
+    size = sector_size;
+
+    for (int ilod = 0; ilod < lods && size > 1; ++ilod) {
+        hmap_t *dst = p_block + error_lod_offsets[ilod];
+        memcpy(src, dst, size * size * sizeof(hmap_t));
+
+        for (int iz = 0; iz < size; ++iz) {
+            const uint32_t morton_z = morton_part1by1(iz) << 1;
+            const hmap_t *row = src + iz * size;
+
+            for (int ix = 0; ix < size; ++ix) {
+                dst[morton_z | morton_part1by1(ix)] = row[ix];
+            }
+        }
+
+        size >>= 1;
+    }
+}
+
 MapStorage::Region *MapStorage::_create_region(CellKey p_region_key) {
     Region *region = memnew(Region);
     Header *header = memnew(Header);
@@ -767,85 +1284,324 @@ bool MapStorage::_is_format_correct(Ref<FileAccess> &p_file) const {
     return true;
 }
 
-void MapStorage::_clean_minmax() {
-    if (minmax_buffer && minmax_buffer->get_utilization() > CLEANUP_BUFFER_UTILIZATION) {
-        const int sector_cells = sector_size * chunk_size;
-        const real_t sector_world_size_x = sector_cells * map_scale.x;
-        const real_t sector_world_size_z = sector_cells * map_scale.z;
-        const Vector3 offset = Vector3(sector_world_size_x * 0.5, 0.0, sector_world_size_z * 0.5);
-        const real_t r2 = camera_far * camera_far;
+void MapStorage::_update_memory_budget() {
+    if (minmax_buffer) {
+        memory_budget.set_pressure(ResourceBudget::RESOURCE_MINMAX, minmax_buffer->get_utilization() > CLEANUP_BUFFER_UTILIZATION);
+    }
 
-        for (KeyValue<CellKey, Tracker> &kv : minmax_trackers) {
-            Tracker &tracker = kv.value;
+    if (hmap_buffer) {
+        memory_budget.set_pressure(ResourceBudget::RESOURCE_HEIGHT, hmap_buffer->get_utilization() > CLEANUP_BUFFER_UTILIZATION);
+    }
 
-            if (tracker.is_loaded()) {
-                if (tracker.frame <= cancelled_frame) {
-                    minmax_buffer->free((hmap_t *)tracker.pointer);
-                } else {
-                    const Vector3 p = kv.key.position(sector_world_size_x, sector_world_size_z) + offset;
-                    const Vector3 diff = p - viewer_pos;
+    const int evicted = memory_budget.process(current_frame, viewer_pos, MEMORY_BUDGET_TIME_SLICE_USEC);
 
-                    if (diff.x * diff.x + diff.z * diff.z > r2) {
-                        minmax_buffer->free((hmap_t *)tracker.pointer);
-                    }
-                }
-            }
+    if (evicted > 0) {
+        // Hand freed blocks back to the I/O thread.
+        if (minmax_buffer) {
+            minmax_buffer->flush_all_caches();
         }
 
-        if (minmax_buffer->get_utilization() > CLEANUP_BUFFER_UTILIZATION) {
-            ERR_PRINT_ED("Failed to free MinMax buffers.");
+        if (hmap_buffer) {
+            hmap_buffer->flush_all_caches();
         }
     }
 }
 
-void MapStorage::_cache_minmax(CellKey p_sector) const {
-    if (p_sector != cached_sector) {
-        cached_sector = p_sector;
-        const Tracker *tracker = minmax_trackers.getptr(cached_sector);
+bool MapStorage::_evict_resource(void *p_storage, const ResourceBudget::Item &p_item) {
+    MapStorage *storage = static_cast<MapStorage *>(p_storage);
+    Tracker *tracker = static_cast<Tracker *>(p_item.data);
 
-        if (tracker) {
-            cached_minmax_tracker = tracker;
-        } else {
-            cached_minmax_tracker = &default_tracker;
+    if (!tracker->is_loaded() || tracker->frame >= storage->current_frame) {
+        return false;
+    }
+
+    switch (p_item.type) {
+        case ResourceBudget::RESOURCE_MINMAX: {
+            // The budget drops the item itself.
+            tracker->budget_handle = ResourceBudget::INVALID_HANDLE;
+            storage->_release_minmax(*tracker);
+            storage->minmax_grid.erase(p_item.key.sector);
+        } break;
+        case ResourceBudget::RESOURCE_HEIGHT:
+        case ResourceBudget::RESOURCE_TEXTURE_LAYER: {
+            // The heights and the layer of a node go together. The budget drops this
+            // item itself, the other one is dropped here.
+            TextureData *td = (TextureData *)tracker->pointer;
+            const uint32_t other_handle = p_item.type == ResourceBudget::RESOURCE_HEIGHT ? td->layer_budget_handle : tracker->budget_handle;
+
+            if (other_handle != ResourceBudget::INVALID_HANDLE) {
+                storage->memory_budget.remove(other_handle);
+            }
+
+            if (td->heights) {
+                storage->hmap_buffer->free(td->heights);
+            }
+
+            if (td->layer != INVALID_TEXTURE_LAYER) {
+                storage->staging_ring.cancel(td->layer);
+                storage->texture_layers.free(td->layer);
+            }
+
+            memdelete(td);
+            storage->textures_trackers.write[p_item.lod].erase(p_item.key);
+        } break;
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+bool MapStorage::_evict_texture_layer(void *p_storage, const NodeKey &p_key, uint8_t p_lod) {
+    MapStorage *storage = static_cast<MapStorage *>(p_storage);
+    HashMap<NodeKey, Tracker> &trackers = storage->textures_trackers.write[p_lod];
+    Tracker *tracker = trackers.getptr(p_key);
+    ERR_FAIL_NULL_V(tracker, true);
+
+    if (!tracker->is_loaded()) {
+        return false;
+    }
+
+    // The node data goes with its layer, it is requested again when needed.
+    TextureData *td = (TextureData *)tracker->pointer;
+
+    if (tracker->budget_handle != ResourceBudget::INVALID_HANDLE) {
+        storage->memory_budget.remove(tracker->budget_handle);
+    }
+
+    if (td->layer_budget_handle != ResourceBudget::INVALID_HANDLE) {
+        storage->memory_budget.remove(td->layer_budget_handle);
+    }
+
+    if (td->heights) {
+        storage->hmap_buffer->free(td->heights);
+    }
+
+    storage->staging_ring.cancel(td->layer);
+    memdelete(td);
+    trackers.erase(p_key);
+    return true;
+}
+
+void MapStorage::_release_minmax(Tracker &p_tracker) {
+    if (p_tracker.is_loaded()) {
+        minmax_buffer->free((hmap_t *)p_tracker.pointer);
+    }
+
+    if (p_tracker.budget_handle != ResourceBudget::INVALID_HANDLE) {
+        memory_budget.remove(p_tracker.budget_handle);
+    }
+
+    p_tracker = Tracker();
+}
+
+void MapStorage::_reset_minmax() {
+    memory_budget.clear(ResourceBudget::RESOURCE_MINMAX);
+    minmax_grid.clear();
+
+    // Their sectors left the grid, they are requested again when drawn.
+    for (int i = io_pending.size() - 1; i >= 0; --i) {
+        if (io_pending[i].data_type == DATA_TYPE_MINMAX) {
+            io_pending.remove_at(i);
         }
     }
 }
 
-void MapStorage::_allocate_textures() {
-    if (requested_layers > num_layers) {
-        RenderingDevice *rd = RenderingServer::get_singleton()->get_rendering_device();
+void MapStorage::_register_monitors() {
+    Performance *performance = Performance::get_singleton();
 
-        if (num_layers != 0) {
-            rd->free_rid(rd_heightmap_texture);
+    if (!performance || !monitor_category.is_empty()) {
+        return;
+    }
+
+    // Every active storage gets its own category, so several terrains can be profiled together.
+    String category = MONITOR_CATEGORY;
+
+    for (int i = 2; performance->has_custom_monitor(category + "/" + MONITOR_NAMES[0]); ++i) {
+        category = vformat("%s %d", MONITOR_CATEGORY, i);
+    }
+
+    for (int i = 0; i < MONITOR_MAX; ++i) {
+        performance->add_custom_monitor(category + "/" + MONITOR_NAMES[i], callable_mp(this, &MapStorage::_get_monitor), varray(i));
+    }
+
+    monitor_category = category;
+    monitor_window_start = OS::get_singleton()->get_ticks_usec();
+    monitor_window_bytes = io_bytes_read.load(std::memory_order_relaxed);
+    monitor_window_evictions = memory_budget.get_total_evictions();
+}
+
+void MapStorage::_unregister_monitors() {
+    Performance *performance = Performance::get_singleton();
+
+    if (!performance || monitor_category.is_empty()) {
+        return;
+    }
+
+    for (int i = 0; i < MONITOR_MAX; ++i) {
+        const StringName id = monitor_category + "/" + MONITOR_NAMES[i];
+
+        if (performance->has_custom_monitor(id)) {
+            performance->remove_custom_monitor(id);
         }
+    }
+
+    monitor_category = String();
+}
+
+void MapStorage::_update_monitor_rates() {
+    if (monitor_category.is_empty()) {
+        return;
+    }
 
-        num_layers = requested_layers + EXTRA_BUFFER_LAYERS;
+    const uint64_t now = OS::get_singleton()->get_ticks_usec();
+    const uint64_t elapsed = now - monitor_window_start;
+
+    if (elapsed < MONITOR_RATE_WINDOW_USEC) {
+        return;
+    }
+
+    const uint64_t bytes = io_bytes_read.load(std::memory_order_relaxed);
+    const uint64_t evictions = memory_budget.get_total_evictions();
+    const uint64_t uploads = staging_ring.get_total_uploads();
+    const uint64_t upload_latency = staging_ring.get_total_latency_usec();
+    const double seconds = double(elapsed) / 1000000.0;
+    io_bytes_per_second = double(bytes - monitor_window_bytes) / seconds;
+    evictions_per_second = double(evictions - monitor_window_evictions) / seconds;
+
+    if (uploads > monitor_window_uploads) {
+        upload_latency_usec = double(upload_latency - monitor_window_upload_latency) / double(uploads - monitor_window_uploads);
+    }
+
+    monitor_window_start = now;
+    monitor_window_bytes = bytes;
+    monitor_window_evictions = evictions;
+    monitor_window_uploads = uploads;
+    monitor_window_upload_latency = upload_latency;
+}
+
+Variant MapStorage::_get_monitor(int p_monitor) const {
+    switch (p_monitor) {
+        case MONITOR_MINMAX_POOL_UTILIZATION:
+            return minmax_buffer ? 100.0 * minmax_buffer->get_utilization() : 0.0;
+        case MONITOR_HMAP_POOL_UTILIZATION:
+            return hmap_buffer ? 100.0 * hmap_buffer->get_utilization() : 0.0;
+        case MONITOR_POOL_CAS_RETRIES:
+            return int64_t((minmax_buffer ? minmax_buffer->get_cas_retries() : 0) + (hmap_buffer ? hmap_buffer->get_cas_retries() : 0));
+        case MONITOR_PENDING_REQUESTS:
+            return io_pending.size();
+        case MONITOR_IN_FLIGHT_REQUESTS:
+            return int64_t(io_queue->size());
+        case MONITOR_IO_BYTES_PER_SECOND:
+            return io_bytes_per_second;
+        case MONITOR_RESULT_BACKLOG:
+            return int64_t(io_result->size());
+        case MONITOR_TEXTURE_LAYERS_IN_USE:
+            return texture_layers.get_used_count();
+        case MONITOR_EVICTIONS_PER_SECOND:
+            return evictions_per_second;
+        case MONITOR_STAGING_QUEUED_BYTES:
+            return int64_t(staging_ring.get_queued_bytes());
+        case MONITOR_UPLOAD_LATENCY_USEC:
+            return upload_latency_usec;
+        default:
+            return Variant();
+    }
+}
+
+void MapStorage::_allocate_textures() {
+    RenderingDevice *rd = RenderingServer::get_singleton()->get_rendering_device();
+
+    if (requested_layers == 0 || !rd || chunk_size == 0) {
+        requested_layers = 0;
+        return;
+    }
+
+    const int needed = texture_layers.get_used_count() + requested_layers;
+    const int prev_capacity = texture_layers.get_capacity();
+    texture_layers.set_max_capacity((int)MIN(rd->limit_get(RenderingDevice::LIMIT_MAX_TEXTURE_ARRAY_LAYERS), (uint64_t)INT32_MAX));
+
+    if (needed > prev_capacity && texture_layers.grow(needed + EXTRA_BUFFER_LAYERS) > prev_capacity) {
         RenderingDevice::TextureFormat height_format;
-        height_format.array_layers = num_layers;
+        height_format.array_layers = texture_layers.get_capacity();
         height_format.format = RenderingDevice::DATA_FORMAT_R8G8_UNORM;
         height_format.width = chunk_size + 1;
         height_format.height = chunk_size + 1;
-        height_format.mipmaps = 0;
+        height_format.mipmaps = 1;
         height_format.texture_type = RenderingDevice::TEXTURE_TYPE_2D_ARRAY;
-        height_format.usage_bits = RenderingDevice::TEXTURE_USAGE_SAMPLING_BIT | RenderingDevice::TEXTURE_USAGE_CAN_UPDATE_BIT;
+        height_format.usage_bits = RenderingDevice::TEXTURE_USAGE_SAMPLING_BIT | RenderingDevice::TEXTURE_USAGE_CAN_UPDATE_BIT | RenderingDevice::TEXTURE_USAGE_CAN_COPY_FROM_BIT | RenderingDevice::TEXTURE_USAGE_CAN_COPY_TO_BIT;
         RenderingDevice::TextureView tex_view;
-        rd_heightmap_texture = rd->texture_create(height_format, tex_view);
+        const RID texture = rd->texture_create(height_format, tex_view);
+
+        if (prev_capacity != 0) {
+            // Used layers keep their index, only they are worth copying.
+            const Vector3 size = Vector3(chunk_size + 1, chunk_size + 1, 1);
+
+            for (int i = 0; i < prev_capacity; ++i) {
+                if (!texture_layers.is_free(i)) {
+                    rd->texture_copy(rd_heightmap_texture, texture, Vector3(), Vector3(), size, 0, 0, i, i);
+                }
+            }
+
+            rd->free_rid(rd_heightmap_texture);
+        }
+
+        rd_heightmap_texture = texture;
+
+        if (heightmap_texture.is_null()) {
+            heightmap_texture.instantiate();
+        }
+
         heightmap_texture->set_texture_rd_rid(rd_heightmap_texture);
-        // TODO: Transfer data from prev texture
+    }
+
+    // At the maximum capacity, reclaim the layers least likely to be drawn again.
+    if (texture_layers.get_free_count() < requested_layers) {
+        texture_layers.evict(requested_layers - texture_layers.get_free_count(), viewer_pos, camera_far);
     }
 
     requested_layers = 0;
 }
 
-int MapStorage::_next_layer() {
-    if (!unused_texture_layers.is_empty()) {
-        int new_size = unused_texture_layers.size() - 1;
-        int layer = unused_texture_layers[new_size];
-        unused_texture_layers.resize(new_size);
-        return layer;
-    } else {
-        return used_layers++;
+Vector3 MapStorage::_get_node_center(const NodeKey &p_key, int p_lod) const {
+    const int sector_cells = sector_size * chunk_size;
+    const real_t node_cells = real_t(chunk_size << p_lod);
+    return p_key.position(sector_cells, p_lod, lods, map_scale.x, map_scale.z) + Vector3(node_cells * map_scale.x, 0.0, node_cells * map_scale.z) * 0.5;
+}
+
+int MapStorage::_next_layer(const NodeKey &p_key, int p_lod, const Tracker &p_tracker) {
+    return texture_layers.allocate(p_key, &p_tracker.frame, _get_node_center(p_key, p_lod), p_lod);
+}
+
+bool MapStorage::_stage_layer(int p_layer, float p_priority, const uint8_t *p_data, uint32_t p_size) {
+    ERR_FAIL_COND_V(p_size != _get_layer_bytes(), false);
+    return staging_ring.push(p_layer, p_priority, p_data, p_size);
+}
+
+void MapStorage::_upload_layer(void *p_storage, int p_layer, const uint8_t *p_data, uint32_t p_size) {
+    MapStorage *storage = static_cast<MapStorage *>(p_storage);
+    RenderingDevice *rd = RenderingServer::get_singleton()->get_rendering_device();
+
+    if (p_layer >= storage->texture_layers.get_capacity()) {
+        return;
+    }
+
+    // Drawn from now on, and free to evict.
+    const LayerAllocator &layers = storage->texture_layers;
+    Tracker *tracker = storage->textures_trackers.write[layers.get_lod(p_layer)].getptr(layers.get_key(p_layer));
+
+    if (tracker) {
+        tracker->status = Tracker::Status::LOADED;
     }
+
+    if (!rd || !storage->rd_heightmap_texture.is_valid()) {
+        return;
+    }
+
+    // Same size every time, the buffer is reused.
+    storage->upload_data.resize(p_size);
+    memcpy(storage->upload_data.ptrw(), p_data, p_size);
+    rd->texture_update(storage->rd_heightmap_texture, p_layer, storage->upload_data);
 }
 
 // void MapStorage::_clean_hmap() {
@@ -891,6 +1647,11 @@ int MapStorage::_next_layer() {
 MapStorage::MapStorage() {
     io_queue = memnew(SPSCQueue<IORequest>(MAX_QUEUE_SIZE));
     io_result = memnew(SPSCQueue<IOResult>(MAX_RES_QUEUE_SIZE));
+    memory_budget.set_owner(this, _evict_resource);
+    memory_budget.set_budget((size_t)DEFAULT_MEMORY_BUDGET_MB << 20);
+    texture_layers.set_owner(this, _evict_texture_layer);
+    staging_ring.set_owner(this, _upload_layer);
+    staging_ring.set_capacity(uint32_t(STAGING_RING_MB) << 20);
 }
 
 MapStorage::~MapStorage() {
@@ -899,7 +1660,7 @@ MapStorage::~MapStorage() {
     memdelete(io_queue);
     memdelete(io_result);
 
-    if (num_layers != 0) {
+    if (rd_heightmap_texture.is_valid()) {
         RenderingServer::get_singleton()->get_rendering_device()->free_rid(rd_heightmap_texture);
     }
 }
@@ -17,7 +17,11 @@
 #include "core/io/file_access.h"
 #include "core/io/resource.h"
 #include "core/os/thread.h"
+#include "memory_budget.h"
 #include "queue.h"
+#include "sector_grid.h"
+#include "staging_ring.h"
+#include "texture_layer_allocator.h"
 #include "scene/resources/texture_rd.h"
 #include "servers/rendering/rendering_server.h"
 
@@ -41,15 +45,34 @@ class MapStorage : public Resource {
 public:
     typedef uint16_t hmap_t;
 
+    // Cell coordinates, 32-bit with TERRAINER_WIDE_CELL_KEYS for worlds over 65536 sectors per axis.
+#ifdef TERRAINER_WIDE_CELL_KEYS
+    typedef uint32_t cell_t;
+    typedef uint64_t cell_key_t;
+    static constexpr int CELL_LIMIT = INT32_MAX; // Coordinates are also used as int.
+#else
+    typedef uint16_t cell_t;
+    typedef uint32_t cell_key_t;
+    static constexpr int CELL_LIMIT = UINT16_MAX;
+#endif
+
+    _FORCE_INLINE_ static uint32_t hash_cell_key(cell_key_t p_key, uint32_t p_seed = HASH_MURMUR3_SEED) {
+#ifdef TERRAINER_WIDE_CELL_KEYS
+        return hash_murmur3_one_64(p_key, p_seed);
+#else
+        return hash_murmur3_one_32(p_key, p_seed);
+#endif
+    }
+
     union CellKey {
         struct {
-            uint16_t x;
-            uint16_t z;
+            cell_t x;
+            cell_t z;
         } cell;
-        uint32_t key;
+        cell_key_t key;
 
         constexpr CellKey() : key(0) {}
-        constexpr CellKey(uint16_t p_x, uint16_t p_z) : cell({p_x, p_z}) {}
+        constexpr CellKey(cell_t p_x, cell_t p_z) : cell({p_x, p_z}) {}
 
         constexpr CellKey operator+(CellKey p_k) const { return CellKey(cell.x + p_k.cell.x, cell.z + p_k.cell.z); }
         constexpr void operator+=(CellKey p_k) { cell.x += p_k.cell.x; cell.z += p_k.cell.z; }
@@ -59,14 +82,14 @@ public:
         constexpr bool operator!=(CellKey p_k) const { return key != p_k.key; }
 
         _FORCE_INLINE_ Vector3 position(real_t p_scale_x, real_t p_scale_z) const {
-            return Vector3(cell.x * p_scale_x, 0.0, cell.z * p_scale_z);
+            return Vector3(real_t(cell.x) * p_scale_x, 0.0, real_t(cell.z) * p_scale_z);
         }
 
         uint32_t hash() const {
-            return hash_murmur3_one_32(key);
+            return hash_cell_key(key);
 	    }
     };
-    static_assert(sizeof(CellKey) == 4);
+    static_assert(sizeof(CellKey) == sizeof(cell_key_t));
 
     struct NodeKey {
         CellKey sector;
@@ -82,16 +105,18 @@ public:
         _FORCE_INLINE_ Vector3 position(int p_sector_size, int p_lod, int p_num_lods, real_t p_scale_x, real_t p_scale_z) const {
             int lod_shift = p_num_lods - p_lod - 1;
             int cell_size = p_sector_size >> lod_shift;
-            return Vector3((sector.cell.x * p_sector_size + cell.cell.x * cell_size) * p_scale_x, 0.0, (sector.cell.z * p_sector_size + cell.cell.z * cell_size) * p_scale_x);
+            const int64_t x = int64_t(sector.cell.x) * p_sector_size + int64_t(cell.cell.x) * cell_size;
+            const int64_t z = int64_t(sector.cell.z) * p_sector_size + int64_t(cell.cell.z) * cell_size;
+            return Vector3(real_t(x) * p_scale_x, 0.0, real_t(z) * p_scale_z);
         }
 
         uint32_t hash() const {
-            uint32_t h = hash_murmur3_one_32(uint32_t(sector.key));
-            h = hash_murmur3_one_32(uint32_t(cell.key), h);
+            uint32_t h = hash_cell_key(sector.key);
+            h = hash_cell_key(cell.key, h);
             return hash_fmix32(h);
         }
     };
-    static_assert(sizeof(NodeKey) == 8);
+    static_assert(sizeof(NodeKey) == 2 * sizeof(CellKey));
 
     enum BufferType {
         BUFFER_MINMAX,
@@ -108,12 +133,33 @@ public:
         STAT_AVAILABLE_BLOCKS,
         STAT_AVAILABLE_BYTES,
         STAT_BLOCK_SIZE,
-        STAT_BLOCK_COUNT
+        STAT_BLOCK_COUNT,
+        STAT_CAS_RETRIES
+    };
+
+    struct RayResult {
+        Vector3 position;
+        Vector3 normal;
+        real_t distance = -1.0;
+        bool hit = false;
+        bool exact = false; // False when hit against minmax bounds, with no resident heights.
+    };
+
+    // Cell order inside each LOD of a sector minmax block.
+    enum MinmaxLayout {
+        MINMAX_LAYOUT_LINEAR, // Row-major, as stored in region files.
+        MINMAX_LAYOUT_MORTON, // Z-order, the four children of a node are contiguous.
+        MINMAX_LAYOUT_MAX
     };
 
 private:
     static constexpr float CLEANUP_BUFFER_UTILIZATION = 0.8f;
     static constexpr float BUFFER_EXTRA_ALLOCATION_FACTOR = 1.25f;
+    static const int DEFAULT_MEMORY_BUDGET_MB = 256;
+    static const uint64_t MEMORY_BUDGET_TIME_SLICE_USEC = 500;
+    static const int STAGING_RING_MB = 16;
+    static const size_t UPLOAD_BYTES_PER_FRAME = 4 << 20;
+    static const uint64_t UPLOAD_TIME_SLICE_USEC = 2000;
 
     static constexpr uint16_t HMAP_HOLE_VALUE = UINT16_MAX;
     static constexpr uint16_t HMAP_MAX = HMAP_HOLE_VALUE - 1;
@@ -127,7 +173,7 @@ private:
     static const size_t FILE_HEADER_SIZE = 64;
     static const size_t MAGIC_SIZE = 4;
     static constexpr char unsigned MAGIC_STRING[MAGIC_SIZE] = {'T', 'E', 'R', 'R'};
-    static const uint8_t FORMAT_VERSION = 1ui8;
+    static const uint8_t FORMAT_VERSION = 1;
 
     static const uint8_t FORMAT_PACKED = 0x00;
     static const uint8_t FORMAT_SPARSE = 0x10;
@@ -138,6 +184,7 @@ private:
     static const uint8_t FORMAT_BIG_ENDIAN = 0x22;
 
     static constexpr uint8_t REGION_FLAG_HAS_MINMAX = 1 << 0;
+    static constexpr uint8_t REGION_FLAG_HAS_ERROR = 1 << 1; // Node error pyramid, right after the minmax one.
 
     // static constexpr uint32_t CHUNK_FLAG_HAS_MINMAX = 1 << 0;
     // static constexpr uint32_t CHUNK_FLAG_HAS_HEIGHT = 1 << 1;
@@ -169,6 +216,30 @@ private:
     static const int INVALID_TEXTURE_LAYER = -1;
     static const int EXTRA_BUFFER_LAYERS = 8;
 
+    static const int QUERY_BLOCK_SIZE = 256; // Queries per worker task.
+    static const int RAY_BLOCK_SIZE = 32; // Rays per worker task.
+    static constexpr real_t VISIBILITY_END_MARGIN = 0.05;
+
+    static const String MONITOR_CATEGORY;
+    static const uint64_t MONITOR_RATE_WINDOW_USEC = 1000000;
+
+    enum Monitor {
+        MONITOR_MINMAX_POOL_UTILIZATION,
+        MONITOR_HMAP_POOL_UTILIZATION,
+        MONITOR_POOL_CAS_RETRIES,
+        MONITOR_PENDING_REQUESTS,
+        MONITOR_IN_FLIGHT_REQUESTS,
+        MONITOR_IO_BYTES_PER_SECOND,
+        MONITOR_RESULT_BACKLOG,
+        MONITOR_TEXTURE_LAYERS_IN_USE,
+        MONITOR_EVICTIONS_PER_SECOND,
+        MONITOR_STAGING_QUEUED_BYTES,
+        MONITOR_UPLOAD_LATENCY_USEC,
+        MONITOR_MAX
+    };
+
+    static const char *MONITOR_NAMES[MONITOR_MAX];
+
     // enum class ChunkState : uint8_t {
     //     Unloaded,
     //     Requested,
@@ -277,6 +348,7 @@ private:
         void *pointer;
         mutable uint64_t frame;
         mutable bool in_frustum;
+        uint32_t budget_handle = UINT32_MAX;
 
         enum class Status : uint8_t {
             UNINITIALIZED,
@@ -291,8 +363,6 @@ private:
 
     };
 
-    const Tracker default_tracker;
-
     struct IORequest {
         NodeKey key;
         Tracker* tracker;
@@ -344,16 +414,26 @@ private:
     struct TextureData {
         PackedByteArray height;
         PackedByteArray splat;
+        hmap_t *heights = nullptr; // (chunk_size + 1)^2 samples, row-major.
         int layer = INVALID_TEXTURE_LAYER;
+        uint32_t layer_budget_handle = UINT32_MAX; // The heights use the tracker one.
     };
 
+    using ResourceBudget = MemoryBudget<NodeKey>;
+    using LayerAllocator = TextureLayerAllocator<NodeKey>;
+
+    struct HeightCache;
+    struct HeightBatch;
+    struct Ray;
+    struct RayBatch;
+
     String directory_path;
-    uint16_t chunk_size = 32ui16;
-    uint16_t region_size = 32ui16;
+    uint16_t chunk_size = 32;
+    uint16_t region_size = 32;
     bool size_locked = false;
     bool data_locked = false;
 
-    uint16_t sector_size = 0ui16; // In terms of chunks.
+    uint16_t sector_size = 0; // In terms of chunks.
     int lods = 0;
     int saved_lods = 5; // log2(32)
 
@@ -375,21 +455,39 @@ private:
     HashMap<CellKey, Region*> regions;
     Vector<size_t> minmax_lod_offsets;
     BufferPool<hmap_t> *minmax_buffer = nullptr;
-    HashMap<CellKey, Tracker> minmax_trackers;
+    SectorGrid<CellKey, Tracker> minmax_grid;
     Vector<hmap_t> minmax_read;
-    const mutable Tracker* cached_minmax_tracker = nullptr;
-    mutable CellKey cached_sector = CellKey(UINT16_MAX, UINT16_MAX);
+    Vector<hmap_t> minmax_swizzle;
+    Vector<size_t> error_lod_offsets; // Node errors follow the minmax levels in each sector block.
+    Vector<hmap_t> error_read;
+    std::atomic<MinmaxLayout> minmax_layout{ MINMAX_LAYOUT_LINEAR };
+    uint64_t minmax_layout_request = 0; // Older minmax results use the previous layout.
     real_t camera_far = 0.0;
     hmap_t default_height = 0;
 
     BufferPool<hmap_t> *hmap_buffer = nullptr;
+    uint64_t hmap_buffer_request = 0; // Older height results were allocated from a deleted buffer.
     Vector<HashMap<NodeKey, Tracker>> textures_trackers;
-    Vector<int> unused_texture_layers;
-    int num_layers = 0;
-    int used_layers = 0;
+    LayerAllocator texture_layers; // Layers of the heightmap texture, and the nodes using them.
     int requested_layers = 0;
     RID rd_heightmap_texture;
     Ref<Texture2DArrayRD> heightmap_texture;
+    // Decoded layers waiting for their upload, a few per frame.
+    StagingRing staging_ring;
+    PackedByteArray upload_data;
+
+    ResourceBudget memory_budget;
+
+    String monitor_category;
+    std::atomic<uint64_t> io_bytes_read{0};
+    uint64_t monitor_window_start = 0;
+    uint64_t monitor_window_bytes = 0;
+    uint64_t monitor_window_evictions = 0;
+    uint64_t monitor_window_uploads = 0;
+    uint64_t monitor_window_upload_latency = 0;
+    double io_bytes_per_second = 0.0;
+    double evictions_per_second = 0.0;
+    double upload_latency_usec = 0.0; // Average from staging to upload, over the last window.
 
     void _clear();
     static void _process_requests(void *p_storage);
@@ -397,16 +495,48 @@ private:
     void _submit_requests();
     void _process_results();
     _FORCE_INLINE_ void _load_region_minmax(CellKey p_region_key, hmap_t *p_buffer, size_t p_size);
+    void _load_region_error(CellKey p_region_key, const hmap_t *p_minmax, hmap_t *p_buffer, int p_lods);
     void _load_sector_minmax(const NodeKey &p_key, const IORequest &p_request);
+    void _load_node_height(const NodeKey &p_key, const IORequest &p_request);
+    void _process_height_result(const IOResult &p_result);
+    void _swizzle_minmax(hmap_t *p_block);
     Region* _create_region(CellKey p_region_key);
     float _calc_request_priority(const Vector3 &p_chunk_pos, bool p_in_frustum);
     _FORCE_INLINE_ bool _is_format_correct(Ref<FileAccess> &p_file) const;
 
-    void _clean_minmax();
-    void _cache_minmax(CellKey p_sector) const;
+    void _update_memory_budget();
+    static bool _evict_resource(void *p_storage, const ResourceBudget::Item &p_item);
+    static bool _evict_texture_layer(void *p_storage, const NodeKey &p_key, uint8_t p_lod);
+    void _release_minmax(Tracker &p_tracker);
+    void _reset_minmax();
+
+    void _register_monitors();
+    void _unregister_monitors();
+    void _update_monitor_rates();
+    Variant _get_monitor(int p_monitor) const;
+
+    _FORCE_INLINE_ bool _sample_chunk(const hmap_t *p_heights, real_t p_u, real_t p_v, real_t &r_height) const;
+    _FORCE_INLINE_ const hmap_t *_get_chunk(CellKey p_sector, int p_lod, CellKey p_cell, HeightCache &r_cache) const;
+    real_t _sample_height(real_t p_x, real_t p_z, HeightCache &r_cache) const;
+    bool _intersect_leaf(const Ray &p_ray, CellKey p_sector, CellKey p_cell, real_t p_t0, real_t p_t1, hmap_t p_min_y, hmap_t p_max_y, HeightCache &r_cache, RayResult &r_result) const;
+    bool _intersect_sector(const Ray &p_ray, CellKey p_sector, real_t p_t0, real_t p_t1, HeightCache &r_cache, RayResult &r_result) const;
+    Ray _make_ray(const Vector3 &p_from, const Vector3 &p_direction) const;
+    bool _trace_ray(const Ray &p_ray, real_t p_t0, real_t p_t1, RayResult &r_result) const;
+    static void _rays_task(void *p_batch, uint32_t p_block);
+    static void _visibility_task(void *p_batch, uint32_t p_block);
+    Dictionary _intersect_ray_dict(const Vector3 &p_from, const Vector3 &p_direction, real_t p_max_distance) const;
+    PackedFloat32Array _intersect_rays_packed(const PackedVector3Array &p_from, const PackedVector3Array &p_directions, real_t p_max_distance) const;
+    static void _heights_task(void *p_batch, uint32_t p_block);
+    static void _heights_rect_task(void *p_batch, uint32_t p_row);
+    PackedFloat32Array _get_heights_packed(const PackedVector2Array &p_positions) const;
+    PackedFloat32Array _get_heights_rect_packed(const Rect2 &p_rect, const Vector2i &p_resolution) const;
 
     void _allocate_textures();
-    int _next_layer();
+    _FORCE_INLINE_ Vector3 _get_node_center(const NodeKey &p_key, int p_lod) const;
+    int _next_layer(const NodeKey &p_key, int p_lod, const Tracker &p_tracker);
+    _FORCE_INLINE_ uint32_t _get_layer_bytes() const { return uint32_t(chunk_size + 1) * (chunk_size + 1) * 2; }
+    bool _stage_layer(int p_layer, float p_priority, const uint8_t *p_data, uint32_t p_size);
+    static void _upload_layer(void *p_storage, int p_layer, const uint8_t *p_data, uint32_t p_size);
     // void _clean_hmap();
 
 protected:
@@ -422,7 +552,19 @@ public:
     Error load_headers();
     bool is_sector_loaded(CellKey p_sector) const;
     void load_minmax(CellKey p_sector, bool p_in_frustum);
+    // Make a sector resident from its finest minmax level, p_minmax holding a (min, max) pair
+    // per chunk, row-major. Coarser levels and node errors are derived. For generated terrain
+    // and tests, the sector isn't read from its region until evicted.
+    bool set_sector_minmax(CellKey p_sector, const hmap_t *p_minmax);
+    // Make the heights of a node resident for queries, p_heights holding (chunk_size + 1)^2
+    // samples, row-major. Like set_sector_minmax, for generated terrain and tests. The node
+    // texture layer is still read from its region.
+    bool set_node_heights(const NodeKey &p_key, int p_lod, const hmap_t *p_heights);
     void get_minmax(const NodeKey &p_key, int p_lod, hmap_t &r_min, hmap_t &r_max, bool &r_has_data) const;
+    // Minmax of the four children of p_parent at p_lod, ordered tl, tr, bl, br.
+    void get_children_minmax(const NodeKey &p_parent, int p_lod, hmap_t *r_min, hmap_t *r_max, bool &r_has_data) const;
+    // Geometric error of a node drawn at its LOD, in height map units. HMAP_MAX when unknown.
+    hmap_t get_node_error(const NodeKey &p_key, int p_lod) const;
     void allocate_buffers(int p_sector_chunks, int p_num_nodes, int p_lods, const Vector3 &p_map_scale, real_t p_far_view);
 
     int get_node_texture_layer(const NodeKey &p_key, int p_lod);
@@ -445,15 +587,34 @@ public:
     void set_data_locked(bool p_locked);
     bool is_data_locked() const;
     void set_default_height(hmap_t p_height);
+    void set_memory_budget(int p_megabytes);
+    int get_memory_budget() const;
+    void set_minmax_layout(MinmaxLayout p_layout);
+    MinmaxLayout get_minmax_layout() const;
 
     int get_minmax_allocated_sectors() const;
 
+    // Height queries, in map space (the viewer space of update_viewer), with heights
+    // scaled to world units. They read resident data without locking, so they must
+    // not overlap process() or allocate_buffers().
+    real_t get_height(const Vector2 &p_position) const;
+    Vector3 get_normal(const Vector2 &p_position) const;
+    void get_heights(const Vector2 *p_positions, int p_count, float *r_heights) const;
+    void get_heights_rect(const Rect2 &p_rect, const Vector2i &p_resolution, float *r_heights, bool p_parallel = true) const;
+    bool intersect_ray(const Vector3 &p_from, const Vector3 &p_direction, real_t p_max_distance, RayResult &r_result) const;
+    void intersect_rays(const Vector3 *p_from, const Vector3 *p_directions, int p_count, real_t p_max_distance, RayResult *r_results) const;
+    // Line of sight, only reported blocked when resident data proves it.
+    bool is_visible(const Vector3 &p_from, const Vector3 &p_to) const;
+    // Bit i of r_mask is set when p_to[i] is visible from p_from[i].
+    void get_visibility(const Vector3 *p_from, const Vector3 *p_to, int p_count, uint8_t *r_mask) const;
+
     MapStorage();
     ~MapStorage();
 };
 
 VARIANT_ENUM_CAST(MapStorage::BufferType);
 VARIANT_ENUM_CAST(MapStorage::BufferStat);
+VARIANT_ENUM_CAST(MapStorage::MinmaxLayout);
 
 } // namespace Terrainer
 
@@ -0,0 +1,676 @@
+/**
+ * map_storage_query.cpp
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#include "map_storage.h"
+
+#include "core/math/geometry_3d.h"
+#include "core/object/worker_thread_pool.h"
+
+using namespace Terrainer;
+
+struct MapStorage::HeightCache {
+    NodeKey keys[MAX_LOD_LEVELS];
+    const hmap_t *heights[MAX_LOD_LEVELS] = {};
+    bool valid[MAX_LOD_LEVELS] = {};
+};
+
+struct MapStorage::HeightBatch {
+    const MapStorage *storage = nullptr;
+    const Vector2 *positions = nullptr;
+    float *heights = nullptr;
+    int count = 0;
+    Rect2 rect;
+    Vector2i resolution;
+};
+
+// Ray in grid space: x and z in cells, y in height units, t in map space distance.
+struct MapStorage::Ray {
+    Vector3 origin;
+    Vector3 direction;
+    Vector3 inv_direction;
+    Vector3 map_origin;
+    Vector3 map_direction;
+    // Any hit, reporting only certain occlusion where heights aren't resident.
+    bool occlusion = false;
+};
+
+struct MapStorage::RayBatch {
+    const MapStorage *storage = nullptr;
+    const Vector3 *from = nullptr;
+    const Vector3 *directions = nullptr;
+    RayResult *results = nullptr;
+    real_t max_distance = 0.0;
+    int count = 0;
+    // Visibility queries.
+    const Vector3 *to = nullptr;
+    uint8_t *mask = nullptr;
+};
+
+namespace {
+
+// Entry and exit distances of the ray over a rectangle in the XZ plane.
+_FORCE_INLINE_ bool _ray_rect(const Vector3 &p_origin, const Vector3 &p_inv_direction, real_t p_x0, real_t p_z0, real_t p_x1, real_t p_z1, real_t &r_t0, real_t &r_t1) {
+    const real_t tx0 = (p_x0 - p_origin.x) * p_inv_direction.x;
+    const real_t tx1 = (p_x1 - p_origin.x) * p_inv_direction.x;
+    const real_t tz0 = (p_z0 - p_origin.z) * p_inv_direction.z;
+    const real_t tz1 = (p_z1 - p_origin.z) * p_inv_direction.z;
+    r_t0 = MAX(MAX(r_t0, MIN(tx0, tx1)), MIN(tz0, tz1));
+    r_t1 = MIN(MIN(r_t1, MAX(tx0, tx1)), MAX(tz0, tz1));
+    return r_t0 <= r_t1;
+}
+
+// The ray height over [p_t0, p_t1] overlaps [p_min_y, p_max_y].
+_FORCE_INLINE_ bool _ray_overlaps_height(const Vector3 &p_origin, const Vector3 &p_direction, real_t p_t0, real_t p_t1, real_t p_min_y, real_t p_max_y) {
+    const real_t y0 = p_origin.y + p_direction.y * p_t0;
+    const real_t y1 = p_origin.y + p_direction.y * p_t1;
+    return MIN(y0, y1) <= p_max_y && MAX(y0, y1) >= p_min_y;
+}
+
+// Part of the ray over [p_t0, p_t1] is under p_min_y.
+_FORCE_INLINE_ bool _ray_under_height(const Vector3 &p_origin, const Vector3 &p_direction, real_t p_t0, real_t p_t1, real_t p_min_y) {
+    return MIN(p_origin.y + p_direction.y * p_t0, p_origin.y + p_direction.y * p_t1) < p_min_y;
+}
+
+_FORCE_INLINE_ real_t _safe_inverse(real_t p_value) {
+    return Math::is_zero_approx(p_value) ? (p_value < 0.0 ? -1e30 : 1e30) : 1.0 / p_value;
+}
+
+} // namespace
+
+_FORCE_INLINE_ bool MapStorage::_sample_chunk(const hmap_t *p_heights, real_t p_u, real_t p_v, real_t &r_height) const {
+    const int stride = chunk_size + 1;
+    const int x = CLAMP(int(p_u), 0, chunk_size - 1);
+    const int z = CLAMP(int(p_v), 0, chunk_size - 1);
+    const real_t fx = CLAMP(p_u - x, 0.0, 1.0);
+    const real_t fz = CLAMP(p_v - z, 0.0, 1.0);
+    const hmap_t *row = p_heights + z * stride + x;
+    const hmap_t h00 = row[0];
+    const hmap_t h10 = row[1];
+    const hmap_t h01 = row[stride];
+    const hmap_t h11 = row[stride + 1];
+
+    if (h00 == HMAP_HOLE_VALUE || h10 == HMAP_HOLE_VALUE || h01 == HMAP_HOLE_VALUE || h11 == HMAP_HOLE_VALUE) {
+        return false;
+    }
+
+    const real_t h0 = h00 + (h10 - real_t(h00)) * fx;
+    const real_t h1 = h01 + (h11 - real_t(h01)) * fx;
+    r_height = h0 + (h1 - h0) * fz;
+    return true;
+}
+
+_FORCE_INLINE_ const MapStorage::hmap_t *MapStorage::_get_chunk(CellKey p_sector, int p_lod, CellKey p_cell, HeightCache &r_cache) const {
+    const NodeKey key = NodeKey(p_sector, p_cell);
+
+    if (!r_cache.valid[p_lod] || !(r_cache.keys[p_lod] == key)) {
+        // Heights may be resident before the texture layer, see set_node_heights.
+        const Tracker *tracker = textures_trackers[p_lod].getptr(key);
+        const TextureData *td = tracker ? (const TextureData *)tracker->pointer : nullptr;
+        r_cache.keys[p_lod] = key;
+        r_cache.heights[p_lod] = td ? td->heights : nullptr;
+        r_cache.valid[p_lod] = true;
+    }
+
+    return r_cache.heights[p_lod];
+}
+
+real_t MapStorage::_sample_height(real_t p_x, real_t p_z, HeightCache &r_cache) const {
+    const real_t gx = p_x / map_scale.x;
+    const real_t gz = p_z / map_scale.z;
+    const int sector_cells = sector_size * chunk_size;
+
+    if (sector_cells == 0 || gx < 0.0 || gz < 0.0 || gx >= real_t(sector_cells) * CELL_LIMIT || gz >= real_t(sector_cells) * CELL_LIMIT) {
+        return default_height * map_scale.y;
+    }
+
+    const CellKey sector = CellKey(cell_t(gx / sector_cells), cell_t(gz / sector_cells));
+    const real_t lx = gx - real_t(sector.cell.x) * sector_cells;
+    const real_t lz = gz - real_t(sector.cell.z) * sector_cells;
+
+    // Finest resident chunk first.
+    for (int ilod = 0; ilod < lods && ilod < textures_trackers.size(); ++ilod) {
+        const int node_cells = chunk_size << ilod;
+        const CellKey cell = CellKey(int(lx) / node_cells, int(lz) / node_cells);
+        const hmap_t *heights = _get_chunk(sector, ilod, cell, r_cache);
+        real_t h;
+
+        if (heights) {
+            const real_t step = real_t(1 << ilod);
+            const real_t u = (lx - cell.cell.x * node_cells) / step;
+            const real_t v = (lz - cell.cell.z * node_cells) / step;
+
+            if (_sample_chunk(heights, u, v, h)) {
+                return h * map_scale.y;
+            }
+        }
+    }
+
+    // Midpoint of the finest minmax bounds.
+    hmap_t min_y;
+    hmap_t max_y;
+    bool has_data;
+    get_minmax(NodeKey(sector, CellKey(int(lx) / chunk_size, int(lz) / chunk_size)), 0, min_y, max_y, has_data);
+    return has_data ? 0.5 * (real_t(min_y) + real_t(max_y)) * map_scale.y : default_height * map_scale.y;
+}
+
+bool MapStorage::_intersect_leaf(const Ray &p_ray, CellKey p_sector, CellKey p_cell, real_t p_t0, real_t p_t1, hmap_t p_min_y, hmap_t p_max_y, HeightCache &r_cache, RayResult &r_result) const {
+    const int sector_cells = sector_size * chunk_size;
+    const int leaf_x = p_sector.cell.x * sector_cells + p_cell.cell.x * chunk_size;
+    const int leaf_z = p_sector.cell.z * sector_cells + p_cell.cell.z * chunk_size;
+    const hmap_t *heights = nullptr;
+    int lod = 0;
+    int chunk_x = 0;
+    int chunk_z = 0;
+
+    // Finest resident chunk covering the leaf.
+    for (; lod < lods && lod < textures_trackers.size(); ++lod) {
+        const int node_cells = chunk_size << lod;
+        const CellKey cell = CellKey((p_cell.cell.x * chunk_size) / node_cells, (p_cell.cell.z * chunk_size) / node_cells);
+        heights = _get_chunk(p_sector, lod, cell, r_cache);
+
+        if (heights) {
+            chunk_x = p_sector.cell.x * sector_cells + cell.cell.x * node_cells;
+            chunk_z = p_sector.cell.z * sector_cells + cell.cell.z * node_cells;
+            break;
+        }
+    }
+
+    if (!heights && p_ray.occlusion) {
+        // Rays under the leaf minimum were already blocked by _intersect_sector, the
+        // bounds alone don't prove anything else.
+        return false;
+    }
+
+    if (!heights) {
+        // No heights, hit the midpoint of the bounds.
+        const real_t mid_y = 0.5 * (real_t(p_min_y) + real_t(p_max_y));
+        real_t t = p_t0;
+
+        if (!Math::is_zero_approx(p_ray.direction.y)) {
+            t = (mid_y - p_ray.origin.y) / p_ray.direction.y;
+
+            if (t < p_t0 || t > p_t1) {
+                return false;
+            }
+        } else if (p_ray.origin.y > mid_y) {
+            return false;
+        }
+
+        r_result.hit = true;
+        r_result.exact = false;
+        r_result.distance = t;
+        r_result.position = p_ray.map_origin + p_ray.map_direction * t;
+        r_result.normal = Vector3(0.0, 1.0, 0.0);
+        return true;
+    }
+
+    // Walk the chunk cells crossed inside the leaf.
+    const int step = 1 << lod;
+    const int stride = chunk_size + 1;
+    const int first_x = (leaf_x - chunk_x) / step;
+    const int first_z = (leaf_z - chunk_z) / step;
+    const int last_x = first_x + MAX(chunk_size / step, 1) - 1;
+    const int last_z = first_z + MAX(chunk_size / step, 1) - 1;
+    const Vector3 entry = p_ray.origin + p_ray.direction * p_t0;
+    int ix = CLAMP(int(Math::floor((entry.x - chunk_x) / step)), first_x, last_x);
+    int iz = CLAMP(int(Math::floor((entry.z - chunk_z) / step)), first_z, last_z);
+    const int step_x = p_ray.inv_direction.x > 0.0 ? 1 : -1;
+    const int step_z = p_ray.inv_direction.z > 0.0 ? 1 : -1;
+    const real_t delta_x = step * Math::abs(p_ray.inv_direction.x);
+    const real_t delta_z = step * Math::abs(p_ray.inv_direction.z);
+    real_t next_x = (chunk_x + (ix + (step_x > 0)) * step - p_ray.origin.x) * p_ray.inv_direction.x;
+    real_t next_z = (chunk_z + (iz + (step_z > 0)) * step - p_ray.origin.z) * p_ray.inv_direction.z;
+    real_t t = p_t0;
+
+    while (t <= p_t1) {
+        const real_t t_exit = MIN(MIN(next_x, next_z), p_t1);
+        const hmap_t *row = heights + iz * stride + ix;
+        const hmap_t h00 = row[0];
+        const hmap_t h10 = row[1];
+        const hmap_t h01 = row[stride];
+        const hmap_t h11 = row[stride + 1];
+        const bool hole = h00 == HMAP_HOLE_VALUE || h10 == HMAP_HOLE_VALUE || h01 == HMAP_HOLE_VALUE || h11 == HMAP_HOLE_VALUE;
+        const real_t cell_min = MIN(MIN(h00, h10), MIN(h01, h11));
+        const real_t cell_max = MAX(MAX(h00, h10), MAX(h01, h11));
+
+        if (!hole && p_ray.occlusion && _ray_under_height(p_ray.origin, p_ray.direction, t, t_exit, cell_min)) {
+            // Both triangles are over the lowest corner, the ray is underground.
+            r_result.hit = true;
+            r_result.exact = true;
+            return true;
+        }
+
+        if (!hole && _ray_overlaps_height(p_ray.origin, p_ray.direction, t, t_exit, cell_min, cell_max)) {
+            const real_t x0 = (chunk_x + ix * step) * map_scale.x;
+            const real_t z0 = (chunk_z + iz * step) * map_scale.z;
+            const real_t x1 = x0 + step * map_scale.x;
+            const real_t z1 = z0 + step * map_scale.z;
+            const Vector3 v00 = Vector3(x0, h00 * map_scale.y, z0);
+            const Vector3 v10 = Vector3(x1, h10 * map_scale.y, z0);
+            const Vector3 v01 = Vector3(x0, h01 * map_scale.y, z1);
+            const Vector3 v11 = Vector3(x1, h11 * map_scale.y, z1);
+            // Split like the chunk mesh, see chunk_mesh.h.
+            const bool even = ((ix + iz) & 1) == 0;
+            const Vector3 triangles[2][3] = {
+                { v00, even ? v01 : v11, v10 },
+                { even ? v10 : v00, v01, v11 }
+            };
+            real_t best = p_t1 + CMP_EPSILON;
+            int best_triangle = -1;
+            Vector3 best_point;
+
+            for (int i = 0; i < 2; ++i) {
+                Vector3 point;
+
+                if (Geometry3D::ray_intersects_triangle(p_ray.map_origin, p_ray.map_direction, triangles[i][0], triangles[i][1], triangles[i][2], &point)) {
+                    const real_t d = p_ray.map_direction.dot(point - p_ray.map_origin);
+
+                    if (d >= p_t0 - CMP_EPSILON && d < best) {
+                        best = d;
+                        best_triangle = i;
+                        best_point = point;
+                    }
+                }
+            }
+
+            if (best_triangle >= 0) {
+                const Vector3 *tri = triangles[best_triangle];
+                Vector3 normal = (tri[1] - tri[0]).cross(tri[2] - tri[0]).normalized();
+                r_result.hit = true;
+                r_result.exact = true;
+                r_result.distance = best;
+                r_result.position = best_point;
+                r_result.normal = normal.y < 0.0 ? -normal : normal;
+                return true;
+            }
+        }
+
+        if (next_x < next_z) {
+            ix += step_x;
+            t = next_x;
+            next_x += delta_x;
+        } else {
+            iz += step_z;
+            t = next_z;
+            next_z += delta_z;
+        }
+
+        if (ix < first_x || ix > last_x || iz < first_z || iz > last_z) {
+            break;
+        }
+    }
+
+    return false;
+}
+
+bool MapStorage::_intersect_sector(const Ray &p_ray, CellKey p_sector, real_t p_t0, real_t p_t1, HeightCache &r_cache, RayResult &r_result) const {
+    struct Entry {
+        CellKey cell;
+        int lod;
+        real_t t0;
+        real_t t1;
+    };
+
+    const int sector_cells = sector_size * chunk_size;
+    const real_t sector_x = p_sector.cell.x * sector_cells;
+    const real_t sector_z = p_sector.cell.z * sector_cells;
+    Entry stack[4 * MAX_LOD_LEVELS];
+    int stack_size = 0;
+    stack[stack_size++] = { CellKey(), lods - 1, p_t0, p_t1 };
+
+    // Nearest child first, so the first hit is the closest one.
+    while (stack_size > 0) {
+        const Entry entry = stack[--stack_size];
+        hmap_t min_y;
+        hmap_t max_y;
+        bool has_data;
+        get_minmax(NodeKey(p_sector, entry.cell), entry.lod, min_y, max_y, has_data);
+
+        if (p_ray.occlusion && _ray_under_height(p_ray.origin, p_ray.direction, entry.t0, entry.t1, min_y)) {
+            // Under the lowest ground of the node, blocked whatever its heights are.
+            r_result.hit = true;
+            r_result.exact = false;
+            return true;
+        }
+
+        if (!_ray_overlaps_height(p_ray.origin, p_ray.direction, entry.t0, entry.t1, min_y, max_y)) {
+            continue;
+        }
+
+        if (entry.lod == 0) {
+            if (_intersect_leaf(p_ray, p_sector, entry.cell, entry.t0, entry.t1, min_y, max_y, r_cache, r_result)) {
+                return true;
+            }
+
+            continue;
+        }
+
+        const int child_lod = entry.lod - 1;
+        const int child_cells = chunk_size << child_lod;
+        Entry children[4];
+        int count = 0;
+
+        for (int i = 0; i < 4; ++i) {
+            const CellKey cell = CellKey(2 * entry.cell.cell.x + (i & 1), 2 * entry.cell.cell.z + (i >> 1));
+            const real_t x0 = sector_x + cell.cell.x * child_cells;
+            const real_t z0 = sector_z + cell.cell.z * child_cells;
+            real_t t0 = entry.t0;
+            real_t t1 = entry.t1;
+
+            if (_ray_rect(p_ray.origin, p_ray.inv_direction, x0, z0, x0 + child_cells, z0 + child_cells, t0, t1)) {
+                int j = count++;
+
+                // Sorted by decreasing entry distance, the nearest ends on top of the stack.
+                while (j > 0 && children[j - 1].t0 < t0) {
+                    children[j] = children[j - 1];
+                    j--;
+                }
+
+                children[j] = { cell, child_lod, t0, t1 };
+            }
+        }
+
+        for (int i = 0; i < count; ++i) {
+            stack[stack_size++] = children[i];
+        }
+    }
+
+    return false;
+}
+
+void MapStorage::_heights_task(void *p_batch, uint32_t p_block) {
+    const HeightBatch *batch = static_cast<const HeightBatch *>(p_batch);
+    const MapStorage *storage = batch->storage;
+    const int from = p_block * QUERY_BLOCK_SIZE;
+    const int to = MIN(from + QUERY_BLOCK_SIZE, batch->count);
+    HeightCache cache;
+
+    for (int i = from; i < to; ++i) {
+        const Vector2 &p = batch->positions[i];
+        batch->heights[i] = storage->_sample_height(p.x, p.y, cache);
+    }
+}
+
+void MapStorage::_heights_rect_task(void *p_batch, uint32_t p_row) {
+    const HeightBatch *batch = static_cast<const HeightBatch *>(p_batch);
+    const MapStorage *storage = batch->storage;
+    const int width = batch->resolution.x;
+    const real_t step_x = width > 1 ? batch->rect.size.x / (width - 1) : 0.0;
+    const real_t step_z = batch->resolution.y > 1 ? batch->rect.size.y / (batch->resolution.y - 1) : 0.0;
+    const real_t z = batch->rect.position.y + p_row * step_z;
+    float *out = batch->heights + size_t(p_row) * width;
+    HeightCache cache;
+
+    for (int ix = 0; ix < width; ++ix) {
+        out[ix] = storage->_sample_height(batch->rect.position.x + ix * step_x, z, cache);
+    }
+}
+
+void MapStorage::_rays_task(void *p_batch, uint32_t p_block) {
+    const RayBatch *batch = static_cast<const RayBatch *>(p_batch);
+    const int from = p_block * RAY_BLOCK_SIZE;
+    const int to = MIN(from + RAY_BLOCK_SIZE, batch->count);
+
+    for (int i = from; i < to; ++i) {
+        batch->storage->intersect_ray(batch->from[i], batch->directions[i], batch->max_distance, batch->results[i]);
+    }
+}
+
+Dictionary MapStorage::_intersect_ray_dict(const Vector3 &p_from, const Vector3 &p_direction, real_t p_max_distance) const {
+    Dictionary result;
+    RayResult hit;
+
+    if (intersect_ray(p_from, p_direction, p_max_distance, hit)) {
+        result["position"] = hit.position;
+        result["normal"] = hit.normal;
+        result["distance"] = hit.distance;
+        result["exact"] = hit.exact;
+    }
+
+    return result;
+}
+
+PackedFloat32Array MapStorage::_intersect_rays_packed(const PackedVector3Array &p_from, const PackedVector3Array &p_directions, real_t p_max_distance) const {
+    PackedFloat32Array distances;
+    ERR_FAIL_COND_V(p_from.size() != p_directions.size(), distances);
+    LocalVector<RayResult> results;
+    results.resize(p_from.size());
+    intersect_rays(p_from.ptr(), p_directions.ptr(), p_from.size(), p_max_distance, results.ptr());
+    distances.resize(p_from.size());
+    float *w = distances.ptrw();
+
+    for (uint32_t i = 0; i < results.size(); ++i) {
+        w[i] = results[i].distance;
+    }
+
+    return distances;
+}
+
+void MapStorage::_visibility_task(void *p_batch, uint32_t p_block) {
+    const RayBatch *batch = static_cast<const RayBatch *>(p_batch);
+    const int from = p_block * RAY_BLOCK_SIZE;
+    const int to = MIN(from + RAY_BLOCK_SIZE, batch->count);
+
+    // Blocks are byte aligned, tasks never share a mask byte.
+    for (int i = from; i < to; i += 8) {
+        uint8_t bits = 0;
+
+        for (int j = 0; j < 8 && i + j < to; ++j) {
+            bits |= uint8_t(batch->storage->is_visible(batch->from[i + j], batch->to[i + j])) << j;
+        }
+
+        batch->mask[i / 8] = bits;
+    }
+}
+
+PackedFloat32Array MapStorage::_get_heights_packed(const PackedVector2Array &p_positions) const {
+    PackedFloat32Array heights;
+    heights.resize(p_positions.size());
+    get_heights(p_positions.ptr(), p_positions.size(), heights.ptrw());
+    return heights;
+}
+
+PackedFloat32Array MapStorage::_get_heights_rect_packed(const Rect2 &p_rect, const Vector2i &p_resolution) const {
+    PackedFloat32Array heights;
+    ERR_FAIL_COND_V(p_resolution.x <= 0 || p_resolution.y <= 0, heights);
+    heights.resize(p_resolution.x * p_resolution.y);
+    get_heights_rect(p_rect, p_resolution, heights.ptrw());
+    return heights;
+}
+
+real_t MapStorage::get_height(const Vector2 &p_position) const {
+    HeightCache cache;
+    return _sample_height(p_position.x, p_position.y, cache);
+}
+
+Vector3 MapStorage::get_normal(const Vector2 &p_position) const {
+    HeightCache cache;
+    const real_t dx = map_scale.x;
+    const real_t dz = map_scale.z;
+    const real_t left = _sample_height(p_position.x - dx, p_position.y, cache);
+    const real_t right = _sample_height(p_position.x + dx, p_position.y, cache);
+    const real_t back = _sample_height(p_position.x, p_position.y - dz, cache);
+    const real_t front = _sample_height(p_position.x, p_position.y + dz, cache);
+    return Vector3((left - right) / (2.0 * dx), 1.0, (back - front) / (2.0 * dz)).normalized();
+}
+
+void MapStorage::get_heights(const Vector2 *p_positions, int p_count, float *r_heights) const {
+    ERR_FAIL_COND(p_count < 0);
+    HeightBatch batch;
+    batch.storage = this;
+    batch.positions = p_positions;
+    batch.heights = r_heights;
+    batch.count = p_count;
+    const int blocks = (p_count + QUERY_BLOCK_SIZE - 1) / QUERY_BLOCK_SIZE;
+
+    if (blocks <= 1) {
+        if (blocks == 1) {
+            _heights_task(&batch, 0);
+        }
+
+        return;
+    }
+
+    WorkerThreadPool *pool = WorkerThreadPool::get_singleton();
+    WorkerThreadPool::GroupID group = pool->add_native_group_task(_heights_task, &batch, blocks, -1, true, SNAME("Terrainer height queries"));
+    pool->wait_for_group_task_completion(group);
+}
+
+void MapStorage::get_heights_rect(const Rect2 &p_rect, const Vector2i &p_resolution, float *r_heights, bool p_parallel) const {
+    ERR_FAIL_COND(p_resolution.x <= 0 || p_resolution.y <= 0);
+    HeightBatch batch;
+    batch.storage = this;
+    batch.heights = r_heights;
+    batch.rect = p_rect;
+    batch.resolution = p_resolution;
+
+    if (!p_parallel || p_resolution.x * p_resolution.y <= QUERY_BLOCK_SIZE) {
+        for (int iz = 0; iz < p_resolution.y; ++iz) {
+            _heights_rect_task(&batch, iz);
+        }
+
+        return;
+    }
+
+    WorkerThreadPool *pool = WorkerThreadPool::get_singleton();
+    WorkerThreadPool::GroupID group = pool->add_native_group_task(_heights_rect_task, &batch, p_resolution.y, -1, true, SNAME("Terrainer height rect query"));
+    pool->wait_for_group_task_completion(group);
+}
+
+MapStorage::Ray MapStorage::_make_ray(const Vector3 &p_from, const Vector3 &p_direction) const {
+    Ray ray;
+    ray.map_origin = p_from;
+    ray.map_direction = p_direction;
+    ray.origin = Vector3(p_from.x / map_scale.x, p_from.y / map_scale.y, p_from.z / map_scale.z);
+    ray.direction = Vector3(p_direction.x / map_scale.x, p_direction.y / map_scale.y, p_direction.z / map_scale.z);
+    ray.inv_direction = Vector3(_safe_inverse(ray.direction.x), _safe_inverse(ray.direction.y), _safe_inverse(ray.direction.z));
+    return ray;
+}
+
+bool MapStorage::_trace_ray(const Ray &p_ray, real_t p_t0, real_t p_t1, RayResult &r_result) const {
+    const int sector_cells = sector_size * chunk_size;
+
+    // Clip to the addressable sectors.
+    const real_t map_extent = real_t(sector_cells) * CELL_LIMIT;
+    real_t t = p_t0;
+    real_t t_end = p_t1;
+
+    if (!_ray_rect(p_ray.origin, p_ray.inv_direction, 0.0, 0.0, map_extent, map_extent, t, t_end)) {
+        return false;
+    }
+
+    // Walk the sectors crossed by the p_ray.
+    const Vector3 entry = p_ray.origin + p_ray.direction * t;
+    int sx = int(CLAMP(Math::floor(entry.x / sector_cells), (real_t)0.0, real_t(CELL_LIMIT - 1)));
+    int sz = int(CLAMP(Math::floor(entry.z / sector_cells), (real_t)0.0, real_t(CELL_LIMIT - 1)));
+    const int step_x = p_ray.inv_direction.x > 0.0 ? 1 : -1;
+    const int step_z = p_ray.inv_direction.z > 0.0 ? 1 : -1;
+    const real_t delta_x = sector_cells * Math::abs(p_ray.inv_direction.x);
+    const real_t delta_z = sector_cells * Math::abs(p_ray.inv_direction.z);
+    real_t next_x = ((sx + (step_x > 0)) * real_t(sector_cells) - p_ray.origin.x) * p_ray.inv_direction.x;
+    real_t next_z = ((sz + (step_z > 0)) * real_t(sector_cells) - p_ray.origin.z) * p_ray.inv_direction.z;
+    HeightCache cache;
+
+    while (t <= t_end && sx >= 0 && sz >= 0 && sx < CELL_LIMIT && sz < CELL_LIMIT) {
+        const CellKey sector = CellKey(sx, sz);
+        const Tracker *tracker = minmax_grid.getptr(sector);
+        const real_t t_exit = MIN(MIN(next_x, next_z), t_end);
+
+        if (tracker && tracker->is_loaded() && _intersect_sector(p_ray, sector, t, t_exit, cache, r_result)) {
+            return true;
+        }
+
+        if (next_x < next_z) {
+            sx += step_x;
+            t = next_x;
+            next_x += delta_x;
+        } else {
+            sz += step_z;
+            t = next_z;
+            next_z += delta_z;
+        }
+    }
+
+    return false;
+}
+
+bool MapStorage::intersect_ray(const Vector3 &p_from, const Vector3 &p_direction, real_t p_max_distance, RayResult &r_result) const {
+    r_result = RayResult();
+
+    if (sector_size == 0 || !minmax_buffer || p_direction.is_zero_approx()) {
+        return false;
+    }
+
+    return _trace_ray(_make_ray(p_from, p_direction.normalized()), 0.0, p_max_distance, r_result);
+}
+
+bool MapStorage::is_visible(const Vector3 &p_from, const Vector3 &p_to) const {
+    const Vector3 segment = p_to - p_from;
+    const real_t length = segment.length();
+
+    if (sector_size == 0 || !minmax_buffer || length <= 2.0 * VISIBILITY_END_MARGIN) {
+        return true;
+    }
+
+    Ray ray = _make_ray(p_from, segment / length);
+    ray.occlusion = true;
+    RayResult result;
+    // Keep the ground right under the end points from occluding them.
+    return !_trace_ray(ray, VISIBILITY_END_MARGIN, length - VISIBILITY_END_MARGIN, result);
+}
+
+void MapStorage::intersect_rays(const Vector3 *p_from, const Vector3 *p_directions, int p_count, real_t p_max_distance, RayResult *r_results) const {
+    ERR_FAIL_COND(p_count < 0);
+    RayBatch batch;
+    batch.storage = this;
+    batch.from = p_from;
+    batch.directions = p_directions;
+    batch.results = r_results;
+    batch.max_distance = p_max_distance;
+    batch.count = p_count;
+    const int blocks = (p_count + RAY_BLOCK_SIZE - 1) / RAY_BLOCK_SIZE;
+
+    if (blocks <= 1) {
+        if (blocks == 1) {
+            _rays_task(&batch, 0);
+        }
+
+        return;
+    }
+
+    WorkerThreadPool *pool = WorkerThreadPool::get_singleton();
+    WorkerThreadPool::GroupID group = pool->add_native_group_task(_rays_task, &batch, blocks, -1, true, SNAME("Terrainer ray queries"));
+    pool->wait_for_group_task_completion(group);
+}
+
+void MapStorage::get_visibility(const Vector3 *p_from, const Vector3 *p_to, int p_count, uint8_t *r_mask) const {
+    static_assert(RAY_BLOCK_SIZE % 8 == 0);
+    ERR_FAIL_COND(p_count < 0);
+    RayBatch batch;
+    batch.storage = this;
+    batch.from = p_from;
+    batch.to = p_to;
+    batch.mask = r_mask;
+    batch.count = p_count;
+    const int blocks = (p_count + RAY_BLOCK_SIZE - 1) / RAY_BLOCK_SIZE;
+
+    if (blocks <= 1) {
+        if (blocks == 1) {
+            _visibility_task(&batch, 0);
+        }
+
+        return;
+    }
+
+    WorkerThreadPool *pool = WorkerThreadPool::get_singleton();
+    WorkerThreadPool::GroupID group = pool->add_native_group_task(_visibility_task, &batch, blocks, -1, true, SNAME("Terrainer visibility queries"));
+    pool->wait_for_group_task_completion(group);
+}
@@ -0,0 +1,236 @@
+/**
+ * memory_budget.h
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#ifndef TERRAINER_MEMORY_BUDGET_H
+#define TERRAINER_MEMORY_BUDGET_H
+
+#include "core/math/vector3.h"
+#include "core/os/os.h"
+#include "core/templates/local_vector.h"
+
+namespace Terrainer {
+
+/**
+ *
+ * MemoryBudget
+ * A single byte budget shared by every resident resource of a MapStorage.
+ * Features:
+ *   - One configurable limit for minmax sectors, height blocks and texture layers
+ *   - Shared eviction score built from distance to viewer, last used frame and LOD
+ *   - Items used in the current frame are never evicted
+ *   - Incremental eviction bounded by a time slice, never sweeping all items in one frame
+ *   - Per resource type pressure, to make room in a pool even when under budget
+ *
+ * Items are sampled in small batches from a rotating cursor, and the worst scored
+ * evictable item of each batch is handed to the owner through the evict callback.
+ *
+ * Template parameter K: Key type identifying the resource in its owner.
+ */
+template <typename K>
+class MemoryBudget {
+public:
+    enum ResourceType : uint8_t {
+        RESOURCE_MINMAX,
+        RESOURCE_HEIGHT,
+        RESOURCE_TEXTURE_LAYER,
+        RESOURCE_MAX
+    };
+
+    static const uint32_t INVALID_HANDLE = UINT32_MAX;
+
+    struct Item {
+        K key;
+        void *data = nullptr;
+        const uint64_t *frame = nullptr;
+        Vector3 position;
+        uint32_t bytes = 0;
+        ResourceType type = RESOURCE_MAX;
+        uint8_t lod = 0;
+
+        _FORCE_INLINE_ bool is_used() const { return type != RESOURCE_MAX; }
+    };
+
+    /**
+     * Called for the selected victim. Returns false if the item can't be evicted
+     * right now (e.g. it is still loading), in which case it is kept.
+     */
+    typedef bool (*EvictCallback)(void *p_owner, const Item &p_item);
+
+private:
+    static const int SAMPLE_SIZE = 8;
+    // Bounds a process() call even when the clock is too coarse for the time slice.
+    static const uint32_t MAX_SAMPLES_PER_PROCESS = SAMPLE_SIZE * 32;
+    static constexpr float SCORE_AGE_WEIGHT = 4.0f;
+
+    LocalVector<Item> items;
+    LocalVector<uint32_t> free_handles;
+    size_t used_bytes[RESOURCE_MAX] = {};
+    size_t total_used_bytes = 0;
+    size_t budget_bytes = 0;
+    uint32_t pressure_mask = 0;
+    uint32_t cursor = 0;
+    uint64_t total_evictions = 0;
+
+    void *owner = nullptr;
+    EvictCallback evict_callback = nullptr;
+
+    _FORCE_INLINE_ float _eviction_score(const Item &p_item, uint64_t p_frame, const Vector3 &p_viewer_pos) const {
+        const float age = float(p_frame - MIN(p_frame, *p_item.frame));
+        const float distance = p_viewer_pos.distance_to(p_item.position);
+        // Coarser LODs cover larger areas and stay visible from further away.
+        const float lod_scale = float(1 << p_item.lod);
+        return age * SCORE_AGE_WEIGHT + distance / lod_scale;
+    }
+
+    _FORCE_INLINE_ bool _must_evict(ResourceType p_type) const {
+        return total_used_bytes > budget_bytes || (pressure_mask & (1 << p_type));
+    }
+
+    _FORCE_INLINE_ bool _needs_eviction() const {
+        return total_used_bytes > budget_bytes || pressure_mask != 0;
+    }
+
+public:
+    void set_owner(void *p_owner, EvictCallback p_callback) {
+        owner = p_owner;
+        evict_callback = p_callback;
+    }
+
+    /**
+     * Register a resident resource. p_frame must point to the last used frame of the
+     * resource and stay valid until the item is removed or evicted.
+     */
+    uint32_t add(ResourceType p_type, const K &p_key, void *p_data, const uint64_t *p_frame, const Vector3 &p_position, uint8_t p_lod, size_t p_bytes) {
+        uint32_t handle;
+
+        if (free_handles.is_empty()) {
+            handle = items.size();
+            items.push_back(Item());
+        } else {
+            handle = free_handles[free_handles.size() - 1];
+            free_handles.resize(free_handles.size() - 1);
+        }
+
+        Item &item = items[handle];
+        item.key = p_key;
+        item.data = p_data;
+        item.frame = p_frame;
+        item.position = p_position;
+        item.bytes = p_bytes;
+        item.type = p_type;
+        item.lod = p_lod;
+        used_bytes[p_type] += p_bytes;
+        total_used_bytes += p_bytes;
+        return handle;
+    }
+
+    void remove(uint32_t p_handle) {
+        ERR_FAIL_UNSIGNED_INDEX(p_handle, items.size());
+        Item &item = items[p_handle];
+        ERR_FAIL_COND(!item.is_used());
+        used_bytes[item.type] -= item.bytes;
+        total_used_bytes -= item.bytes;
+        item = Item();
+        free_handles.push_back(p_handle);
+    }
+
+    /**
+     * Drop every item of the given type without calling the evict callback.
+     */
+    void clear(ResourceType p_type) {
+        for (uint32_t i = 0; i < items.size(); ++i) {
+            if (items[i].type == p_type) {
+                remove(i);
+            }
+        }
+    }
+
+    void clear() {
+        items.clear();
+        free_handles.clear();
+
+        for (int i = 0; i < RESOURCE_MAX; ++i) {
+            used_bytes[i] = 0;
+        }
+
+        total_used_bytes = 0;
+        cursor = 0;
+    }
+
+    /**
+     * Evict items while over budget or under pressure, until p_time_slice_usec
+     * is spent or MAX_SAMPLES_PER_PROCESS items are sampled. The cursor carries
+     * on from there in the next call. Returns the number of evicted items.
+     */
+    int process(uint64_t p_frame, const Vector3 &p_viewer_pos, uint64_t p_time_slice_usec) {
+        if (!_needs_eviction() || items.is_empty() || !evict_callback) {
+            return 0;
+        }
+
+        OS *os = OS::get_singleton();
+        const uint64_t start = os->get_ticks_usec();
+        const uint32_t count = items.size();
+        const uint32_t max_samples = MIN(count, MAX_SAMPLES_PER_PROCESS);
+        uint32_t scanned = 0;
+        int evicted = 0;
+
+        while (_needs_eviction() && scanned < max_samples) {
+            uint32_t victim = INVALID_HANDLE;
+            float victim_score = -1.0f;
+
+            for (int i = 0; i < SAMPLE_SIZE && scanned < max_samples; ++i, ++scanned) {
+                cursor = cursor + 1 < count ? cursor + 1 : 0;
+                const Item &item = items[cursor];
+
+                // Items used this frame may be drawn or queried right now.
+                if (!item.is_used() || !_must_evict(item.type) || *item.frame >= p_frame) {
+                    continue;
+                }
+
+                const float score = _eviction_score(item, p_frame, p_viewer_pos);
+
+                if (score > victim_score) {
+                    victim = cursor;
+                    victim_score = score;
+                }
+            }
+
+            if (victim != INVALID_HANDLE && evict_callback(owner, items[victim])) {
+                remove(victim);
+                total_evictions++;
+                evicted++;
+            }
+
+            if (os->get_ticks_usec() - start > p_time_slice_usec) {
+                break;
+            }
+        }
+
+        return evicted;
+    }
+
+    void set_budget(size_t p_bytes) { budget_bytes = p_bytes; }
+    size_t get_budget() const { return budget_bytes; }
+    void set_pressure(ResourceType p_type, bool p_pressure) {
+        if (p_pressure) {
+            pressure_mask |= 1 << p_type;
+        } else {
+            pressure_mask &= ~(1 << p_type);
+        }
+    }
+    size_t get_used_bytes() const { return total_used_bytes; }
+    size_t get_used_bytes(ResourceType p_type) const { return used_bytes[p_type]; }
+    uint64_t get_total_evictions() const { return total_evictions; }
+};
+
+} // namespace Terrainer
+
+#endif // TERRAINER_MEMORY_BUDGET_H
@@ -0,0 +1,293 @@
+/**
+ * minmax_reduce.cpp
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#include "minmax_reduce.h"
+
+#ifdef TESTS_ENABLED
+#include "core/templates/local_vector.h"
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define TERRAINER_REDUCE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__aarch64__) || defined(_M_ARM64)
+#define TERRAINER_REDUCE_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(TERRAINER_REDUCE_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TERRAINER_TARGET(m_target) __attribute__((target(m_target)))
+#else
+#define TERRAINER_TARGET(m_target)
+#endif
+
+using namespace Terrainer;
+
+namespace {
+
+// Side of the source tile reduced in one go, in cells. 64 x 64 pairs are 16 KiB.
+const int TILE_SIZE = 64;
+
+// Reduce two source rows into p_count output pairs.
+typedef void (*ReduceRowFunc)(const uint16_t *p_row0, const uint16_t *p_row1, uint16_t *p_out, int p_count);
+
+void _reduce_row_scalar(const uint16_t *p_row0, const uint16_t *p_row1, uint16_t *p_out, int p_count) {
+    for (int i = 0; i < p_count; ++i) {
+        const uint16_t *a = p_row0 + 4 * i;
+        const uint16_t *b = p_row1 + 4 * i;
+        p_out[2 * i] = MIN(MIN(a[0], a[2]), MIN(b[0], b[2]));
+        p_out[2 * i + 1] = MAX(MAX(a[1], a[3]), MAX(b[1], b[3]));
+    }
+}
+
+#ifdef TERRAINER_REDUCE_X86
+// Min in the even (min) lanes, max in the odd (max) lanes.
+TERRAINER_TARGET("sse4.1")
+inline __m128i _minmax_sse(__m128i p_a, __m128i p_b) {
+    return _mm_blend_epi16(_mm_min_epu16(p_a, p_b), _mm_max_epu16(p_a, p_b), 0xAA);
+}
+
+TERRAINER_TARGET("sse4.1")
+void _reduce_row_sse41(const uint16_t *p_row0, const uint16_t *p_row1, uint16_t *p_out, int p_count) {
+    int i = 0;
+
+    for (; i + 4 <= p_count; i += 4) {
+        const __m128i *a = reinterpret_cast<const __m128i *>(p_row0 + 4 * i);
+        const __m128i *b = reinterpret_cast<const __m128i *>(p_row1 + 4 * i);
+        // Children in z.
+        const __m128i v0 = _minmax_sse(_mm_loadu_si128(a), _mm_loadu_si128(b));
+        const __m128i v1 = _minmax_sse(_mm_loadu_si128(a + 1), _mm_loadu_si128(b + 1));
+        // Children in x, each pair is a 32-bit element.
+        const __m128i h0 = _minmax_sse(v0, _mm_srli_epi64(v0, 32));
+        const __m128i h1 = _minmax_sse(v1, _mm_srli_epi64(v1, 32));
+        const __m128 packed = _mm_shuffle_ps(_mm_castsi128_ps(h0), _mm_castsi128_ps(h1), _MM_SHUFFLE(2, 0, 2, 0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p_out + 2 * i), _mm_castps_si128(packed));
+    }
+
+    _reduce_row_scalar(p_row0 + 4 * i, p_row1 + 4 * i, p_out + 2 * i, p_count - i);
+}
+
+TERRAINER_TARGET("avx2")
+inline __m256i _minmax_avx2(__m256i p_a, __m256i p_b) {
+    return _mm256_blend_epi16(_mm256_min_epu16(p_a, p_b), _mm256_max_epu16(p_a, p_b), 0xAA);
+}
+
+TERRAINER_TARGET("avx2")
+void _reduce_row_avx2(const uint16_t *p_row0, const uint16_t *p_row1, uint16_t *p_out, int p_count) {
+    int i = 0;
+
+    for (; i + 8 <= p_count; i += 8) {
+        const __m256i *a = reinterpret_cast<const __m256i *>(p_row0 + 4 * i);
+        const __m256i *b = reinterpret_cast<const __m256i *>(p_row1 + 4 * i);
+        const __m256i v0 = _minmax_avx2(_mm256_loadu_si256(a), _mm256_loadu_si256(b));
+        const __m256i v1 = _minmax_avx2(_mm256_loadu_si256(a + 1), _mm256_loadu_si256(b + 1));
+        const __m256i h0 = _minmax_avx2(v0, _mm256_srli_epi64(v0, 32));
+        const __m256i h1 = _minmax_avx2(v1, _mm256_srli_epi64(v1, 32));
+        // Shuffles stay inside 128-bit lanes, put the 64-bit halves back in order.
+        const __m256 packed = _mm256_shuffle_ps(_mm256_castsi256_ps(h0), _mm256_castsi256_ps(h1), _MM_SHUFFLE(2, 0, 2, 0));
+        const __m256i ordered = _mm256_permute4x64_epi64(_mm256_castps_si256(packed), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(p_out + 2 * i), ordered);
+    }
+
+    _reduce_row_sse41(p_row0 + 4 * i, p_row1 + 4 * i, p_out + 2 * i, p_count - i);
+}
+
+bool _cpu_has(bool p_avx2) {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    const bool sse41 = (info[2] & (1 << 19)) != 0;
+
+    if (!p_avx2) {
+        return sse41;
+    }
+
+    // AVX state must also be enabled by the OS.
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+
+    if (!sse41 || !osxsave || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return p_avx2 ? __builtin_cpu_supports("avx2") : __builtin_cpu_supports("sse4.1");
+#endif
+}
+#endif // TERRAINER_REDUCE_X86
+
+#ifdef TERRAINER_REDUCE_NEON
+void _reduce_row_neon(const uint16_t *p_row0, const uint16_t *p_row1, uint16_t *p_out, int p_count) {
+    int i = 0;
+
+    for (; i + 4 <= p_count; i += 4) {
+        // Deinterleave eight pairs per row into mins and maxes.
+        const uint16x8x2_t a = vld2q_u16(p_row0 + 4 * i);
+        const uint16x8x2_t b = vld2q_u16(p_row1 + 4 * i);
+        const uint16x8_t mins = vminq_u16(a.val[0], b.val[0]);
+        const uint16x8_t maxs = vmaxq_u16(a.val[1], b.val[1]);
+        uint16x4x2_t out;
+        out.val[0] = vpmin_u16(vget_low_u16(mins), vget_high_u16(mins));
+        out.val[1] = vpmax_u16(vget_low_u16(maxs), vget_high_u16(maxs));
+        vst2_u16(p_out + 2 * i, out);
+    }
+
+    _reduce_row_scalar(p_row0 + 4 * i, p_row1 + 4 * i, p_out + 2 * i, p_count - i);
+}
+#endif // TERRAINER_REDUCE_NEON
+
+struct ReduceKernel {
+    ReduceRowFunc func;
+    const char *name;
+};
+
+ReduceKernel _select_kernel() {
+#if defined(TERRAINER_REDUCE_X86)
+    if (_cpu_has(true)) {
+        return { _reduce_row_avx2, "avx2" };
+    }
+
+    if (_cpu_has(false)) {
+        return { _reduce_row_sse41, "sse4.1" };
+    }
+#elif defined(TERRAINER_REDUCE_NEON)
+    return { _reduce_row_neon, "neon" };
+#endif
+    return { _reduce_row_scalar, "scalar" };
+}
+
+const ReduceKernel &_get_kernel() {
+    static const ReduceKernel kernel = _select_kernel();
+    return kernel;
+}
+
+// Reduce a p_tile x p_tile source square at (p_x, p_z) one level down.
+_FORCE_INLINE_ void _reduce_tile(ReduceRowFunc p_func, const uint16_t *p_src, int p_size, uint16_t *p_dst, int p_x, int p_z, int p_tile) {
+    const int half = p_tile >> 1;
+    const int dst_size = p_size >> 1;
+
+    for (int iz = 0; iz < half; ++iz) {
+        const uint16_t *row0 = p_src + 2 * (size_t(p_z + 2 * iz) * p_size + p_x);
+        const uint16_t *row1 = row0 + 2 * p_size;
+        uint16_t *out = p_dst + 2 * (size_t((p_z >> 1) + iz) * dst_size + (p_x >> 1));
+        p_func(row0, row1, out, half);
+    }
+}
+
+void _minmax_reduce(ReduceRowFunc p_func, const uint16_t *p_src, int p_size, uint16_t *const *p_dst, int p_count) {
+    ERR_FAIL_COND((p_size & (p_size - 1)) != 0);
+    int max_count = 0;
+
+    while ((p_size >> max_count) > 1) {
+        max_count++;
+    }
+
+    p_count = MIN(p_count, max_count);
+
+    if (p_count <= 0) {
+        return;
+    }
+
+    const int tile = MIN(TILE_SIZE, p_size);
+    int tile_levels = 0;
+
+    while ((tile >> tile_levels) > 1 && tile_levels < p_count) {
+        tile_levels++;
+    }
+
+    // Every level a tile can reach, one tile at a time.
+    for (int tz = 0; tz < p_size; tz += tile) {
+        for (int tx = 0; tx < p_size; tx += tile) {
+            const uint16_t *src = p_src;
+            int size = p_size;
+            int x = tx;
+            int z = tz;
+            int t = tile;
+
+            for (int ilevel = 0; ilevel < tile_levels; ++ilevel) {
+                _reduce_tile(p_func, src, size, p_dst[ilevel], x, z, t);
+                src = p_dst[ilevel];
+                size >>= 1;
+                x >>= 1;
+                z >>= 1;
+                t >>= 1;
+            }
+        }
+    }
+
+    // The remaining levels are smaller than a tile.
+    int size = p_size >> tile_levels;
+
+    for (int ilevel = tile_levels; ilevel < p_count; ++ilevel) {
+        _reduce_tile(p_func, p_dst[ilevel - 1], size, p_dst[ilevel], 0, 0, size);
+        size >>= 1;
+    }
+}
+
+#ifdef TESTS_ENABLED
+LocalVector<ReduceKernel> _get_supported_kernels() {
+    LocalVector<ReduceKernel> kernels;
+    kernels.push_back({ _reduce_row_scalar, "scalar" });
+#if defined(TERRAINER_REDUCE_X86)
+    if (_cpu_has(false)) {
+        kernels.push_back({ _reduce_row_sse41, "sse4.1" });
+    }
+
+    if (_cpu_has(true)) {
+        kernels.push_back({ _reduce_row_avx2, "avx2" });
+    }
+#elif defined(TERRAINER_REDUCE_NEON)
+    kernels.push_back({ _reduce_row_neon, "neon" });
+#endif
+    return kernels;
+}
+
+const LocalVector<ReduceKernel> &_get_test_kernels() {
+    static const LocalVector<ReduceKernel> kernels = _get_supported_kernels();
+    return kernels;
+}
+#endif // TESTS_ENABLED
+
+} // namespace
+
+void Terrainer::minmax_reduce(const uint16_t *p_src, int p_size, uint16_t *const *p_dst, int p_count) {
+    _minmax_reduce(_get_kernel().func, p_src, p_size, p_dst, p_count);
+}
+
+const char *Terrainer::minmax_reduce_kernel_name() {
+    return _get_kernel().name;
+}
+
+#ifdef TESTS_ENABLED
+int Terrainer::minmax_reduce_get_kernel_count() {
+    return _get_test_kernels().size();
+}
+
+const char *Terrainer::minmax_reduce_get_kernel_name(int p_kernel) {
+    ERR_FAIL_INDEX_V(p_kernel, minmax_reduce_get_kernel_count(), "");
+    return _get_test_kernels()[p_kernel].name;
+}
+
+void Terrainer::minmax_reduce_row(int p_kernel, const uint16_t *p_row0, const uint16_t *p_row1, uint16_t *p_out, int p_count) {
+    ERR_FAIL_INDEX(p_kernel, minmax_reduce_get_kernel_count());
+    _get_test_kernels()[p_kernel].func(p_row0, p_row1, p_out, p_count);
+}
+
+void Terrainer::minmax_reduce_with_kernel(int p_kernel, const uint16_t *p_src, int p_size, uint16_t *const *p_dst, int p_count) {
+    ERR_FAIL_INDEX(p_kernel, minmax_reduce_get_kernel_count());
+    _minmax_reduce(_get_test_kernels()[p_kernel].func, p_src, p_size, p_dst, p_count);
+}
+#endif // TESTS_ENABLED
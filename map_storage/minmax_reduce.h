@@ -0,0 +1,50 @@
+/**
+ * minmax_reduce.h
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#ifndef TERRAINER_MINMAX_REDUCE_H
+#define TERRAINER_MINMAX_REDUCE_H
+
+#include "core/typedefs.h"
+
+namespace Terrainer {
+
+/**
+ * Build p_count coarser levels of a minmax pyramid.
+ *
+ * p_src is a square level of p_size x p_size cells, stored row-major as interleaved
+ * (min, max) uint16 pairs. p_dst[i] receives level i + 1 below p_src, of size
+ * (p_size >> (i + 1)) squared, where each cell holds the min of the mins and the
+ * max of the maxes of its four children. p_size must be a power of two, and
+ * p_count is clamped to log2(p_size).
+ *
+ * The source is walked in tiles that fit in L1, reducing every level of a tile
+ * before moving to the next one, so intermediate levels are read back while hot.
+ * Rows are reduced with the widest kernel the CPU supports (AVX2, SSE4.1 or NEON),
+ * picked once at runtime, with a scalar fallback.
+ */
+void minmax_reduce(const uint16_t *p_src, int p_size, uint16_t *const *p_dst, int p_count);
+
+// Name of the row kernel selected for this CPU, for diagnostics.
+const char *minmax_reduce_kernel_name();
+
+#ifdef TESTS_ENABLED
+// Row kernels this CPU can run, the scalar one first. Each reduces two source rows of
+// 2 * p_count pairs into p_count pairs.
+int minmax_reduce_get_kernel_count();
+const char *minmax_reduce_get_kernel_name(int p_kernel);
+void minmax_reduce_row(int p_kernel, const uint16_t *p_row0, const uint16_t *p_row1, uint16_t *p_out, int p_count);
+// minmax_reduce with the given row kernel instead of the selected one.
+void minmax_reduce_with_kernel(int p_kernel, const uint16_t *p_src, int p_size, uint16_t *const *p_dst, int p_count);
+#endif // TESTS_ENABLED
+
+} // namespace Terrainer
+
+#endif // TERRAINER_MINMAX_REDUCE_H
@@ -0,0 +1,132 @@
+/**
+ * node_error.cpp
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#include "node_error.h"
+
+#include "core/math/math_funcs.h"
+
+using namespace Terrainer;
+
+namespace {
+
+const uint16_t HOLE_VALUE = UINT16_MAX;
+
+// Height of the coarse mesh at (p_fx, p_fz) inside a quad, split like the chunk mesh:
+// quads with even x + z use the (1, 0) - (0, 1) diagonal, odd ones the (0, 0) - (1, 1) one.
+_FORCE_INLINE_ float _quad_height(float p_h00, float p_h10, float p_h01, float p_h11, float p_fx, float p_fz, bool p_even) {
+    if (p_even) {
+        if (p_fx + p_fz <= 1.0f) {
+            return p_h00 + p_fx * (p_h10 - p_h00) + p_fz * (p_h01 - p_h00);
+        }
+
+        return p_h11 + (1.0f - p_fx) * (p_h01 - p_h11) + (1.0f - p_fz) * (p_h10 - p_h11);
+    }
+
+    if (p_fx >= p_fz) {
+        return p_h00 + p_fx * (p_h10 - p_h00) + p_fz * (p_h11 - p_h10);
+    }
+
+    return p_h00 + p_fz * (p_h01 - p_h00) + p_fx * (p_h11 - p_h01);
+}
+
+// Children never have more error than their parent.
+void _propagate_children(const uint16_t *p_children, int p_size, uint16_t *p_level) {
+    const int child_size = p_size << 1;
+
+    for (int iz = 0; iz < p_size; ++iz) {
+        for (int ix = 0; ix < p_size; ++ix) {
+            const uint16_t *c = p_children + 2 * iz * child_size + 2 * ix;
+            const uint16_t children = MAX(MAX(c[0], c[1]), MAX(c[child_size], c[child_size + 1]));
+            uint16_t &e = p_level[iz * p_size + ix];
+            e = MAX(e, children);
+        }
+    }
+}
+
+} // namespace
+
+void Terrainer::node_error_build(const uint16_t *p_heights, int p_chunks, int p_chunk_size, int p_lods, uint16_t *p_dst) {
+    ERR_FAIL_COND(p_chunks <= 0 || p_chunk_size <= 0);
+    const int cells = p_chunks * p_chunk_size;
+    const int row = cells + 1;
+    uint16_t *level = p_dst;
+    const uint16_t *children = nullptr;
+
+    for (int ilod = 0; ilod < p_lods && (p_chunks >> ilod) > 0; ++ilod) {
+        const int nodes = p_chunks >> ilod;
+        const int node_cells = p_chunk_size << ilod;
+        const int stride = 1 << ilod;
+        const int quads = cells >> ilod;
+        const float inv_stride = 1.0f / stride;
+        memset(level, 0, sizeof(uint16_t) * nodes * nodes);
+
+        if (ilod > 0) {
+            // The last row and column belong to the last quads.
+            for (int z = 0; z <= cells; ++z) {
+                const int qz = MIN(z >> ilod, quads - 1);
+                const float fz = (z - (qz << ilod)) * inv_stride;
+                const uint16_t *r0 = p_heights + size_t(qz << ilod) * row;
+                const uint16_t *r1 = r0 + size_t(stride) * row;
+                uint16_t *node_row = level + MIN(z / node_cells, nodes - 1) * nodes;
+
+                for (int x = 0; x <= cells; ++x) {
+                    const uint16_t h = p_heights[size_t(z) * row + x];
+                    const int qx = MIN(x >> ilod, quads - 1);
+                    const int x0 = qx << ilod;
+                    const uint16_t h00 = r0[x0];
+                    const uint16_t h10 = r0[x0 + stride];
+                    const uint16_t h01 = r1[x0];
+                    const uint16_t h11 = r1[x0 + stride];
+
+                    if (h == HOLE_VALUE || h00 == HOLE_VALUE || h10 == HOLE_VALUE || h01 == HOLE_VALUE || h11 == HOLE_VALUE) {
+                        continue;
+                    }
+
+                    const float fx = (x - x0) * inv_stride;
+                    const float coarse = _quad_height(h00, h10, h01, h11, fx, fz, ((qx + qz) & 1) == 0);
+                    const float error = Math::ceil(Math::abs(float(h) - coarse));
+                    uint16_t &e = node_row[MIN(x / node_cells, nodes - 1)];
+                    e = MAX(e, uint16_t(MIN(error, float(UINT16_MAX))));
+                }
+            }
+
+            _propagate_children(children, nodes, level);
+        }
+
+        children = level;
+        level += size_t(nodes) * nodes;
+    }
+}
+
+void Terrainer::node_error_from_minmax(const uint16_t *p_minmax, int p_size, int p_first_lod, int p_lods, uint16_t *p_dst) {
+    const uint16_t *minmax = p_minmax;
+    uint16_t *level = p_dst;
+    const uint16_t *children = nullptr;
+
+    for (int ilod = 0; ilod < p_lods && (p_size >> ilod) > 0; ++ilod) {
+        const int size = p_size >> ilod;
+        const size_t count = size_t(size) * size;
+
+        if (ilod >= p_first_lod) {
+            for (size_t i = 0; i < count; ++i) {
+                level[i] = ilod == 0 ? 0 : uint16_t(minmax[2 * i + 1] - MIN(minmax[2 * i], minmax[2 * i + 1]));
+            }
+
+            if (children) {
+                _propagate_children(children, size, level);
+            }
+        }
+
+        children = level;
+        minmax += 2 * count;
+        level += count;
+    }
+}
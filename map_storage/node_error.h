@@ -0,0 +1,57 @@
+/**
+ * node_error.h
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#ifndef TERRAINER_NODE_ERROR_H
+#define TERRAINER_NODE_ERROR_H
+
+#include "core/typedefs.h"
+
+#include <cstddef>
+
+namespace Terrainer {
+
+/**
+ * Per-node geometric error pyramid.
+ *
+ * One uint16 per quadtree node and LOD, in height map units, stored level after level
+ * like the minmax pyramid: level i is (p_size >> i) squared, row-major. The error of a
+ * node is the largest vertical distance between the full resolution heights and the
+ * chunk mesh drawn for that node, and never less than the error of its children.
+ * LOD 0 nodes are drawn at full resolution and have no error.
+ */
+
+// Number of values in a pyramid of p_lods levels over a p_size x p_size base.
+_FORCE_INLINE_ size_t node_error_pyramid_size(int p_size, int p_lods) {
+    size_t size = 0;
+
+    for (int i = 0; i < p_lods && (p_size >> i) > 0; ++i) {
+        size += size_t(p_size >> i) * size_t(p_size >> i);
+    }
+
+    return size;
+}
+
+/**
+ * Build the exact error pyramid of a square of p_chunks x p_chunks chunks, for writers
+ * and importers. p_heights holds (p_chunks * p_chunk_size + 1) squared samples, row-major.
+ * Samples touching a hole are ignored. The triangulation matches the terrain chunk mesh.
+ */
+void node_error_build(const uint16_t *p_heights, int p_chunks, int p_chunk_size, int p_lods, uint16_t *p_dst);
+
+/**
+ * Fill levels [p_first_lod, p_lods) of an error pyramid from the matching minmax pyramid,
+ * when no error was stored. The height range of a node bounds its error.
+ */
+void node_error_from_minmax(const uint16_t *p_minmax, int p_size, int p_first_lod, int p_lods, uint16_t *p_dst);
+
+} // namespace Terrainer
+
+#endif // TERRAINER_NODE_ERROR_H
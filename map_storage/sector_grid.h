@@ -0,0 +1,203 @@
+/**
+ * sector_grid.h
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#ifndef TERRAINER_SECTOR_GRID_H
+#define TERRAINER_SECTOR_GRID_H
+
+#include "core/math/vector2i.h"
+#include "core/templates/local_vector.h"
+
+namespace Terrainer {
+
+/**
+ *
+ * SectorGrid
+ * Fixed size toroidal 2D array of sector slots, indexed by sector coordinates
+ * modulo the window size.
+ *
+ * Resident sectors always sit in a window around the viewer. As long as the window
+ * covers every resident sector, each of them owns a distinct slot, so lookups are a
+ * mask and a key compare, and moving the window only visits the rows and columns
+ * that left it.
+ *
+ * Template parameter K: Sector key, exposing cell.x and cell.z coordinates.
+ * Template parameter T: Value stored per sector.
+ */
+template <typename K, typename T>
+class SectorGrid {
+public:
+    struct Slot {
+        K key;
+        T value;
+        bool used = false;
+    };
+
+private:
+    LocalVector<Slot> slots;
+    uint32_t mask_x = 0;
+    uint32_t mask_z = 0;
+    uint32_t shift_x = 0;
+    Vector2i origin;
+
+    static uint32_t _po2_shift(int p_size) {
+        uint32_t shift = 0;
+
+        while ((1 << shift) < p_size) {
+            shift++;
+        }
+
+        return shift;
+    }
+
+    _FORCE_INLINE_ uint32_t _index(int p_x, int p_z) const {
+        return (uint32_t(p_x) & mask_x) | ((uint32_t(p_z) & mask_z) << shift_x);
+    }
+
+    template <typename F>
+    _FORCE_INLINE_ void _evict_outside(Slot &p_slot, F &p_evict) {
+        if (p_slot.used && !is_inside(p_slot.key)) {
+            p_evict(p_slot.key, p_slot.value);
+            p_slot.used = false;
+        }
+    }
+
+public:
+    /**
+     * Size the window to hold at least p_size_x by p_size_z sectors. Both sizes are
+     * rounded up to a power of two. All slots are cleared.
+     */
+    void resize(int p_size_x, int p_size_z) {
+        shift_x = _po2_shift(p_size_x);
+        const uint32_t shift_z = _po2_shift(p_size_z);
+        mask_x = (1u << shift_x) - 1;
+        mask_z = (1u << shift_z) - 1;
+        slots.clear();
+        slots.resize(1u << (shift_x + shift_z));
+    }
+
+    bool needs_resize(int p_size_x, int p_size_z) const {
+        return slots.is_empty() || get_size_x() != (1 << _po2_shift(p_size_x)) || get_size_z() != (1 << _po2_shift(p_size_z));
+    }
+
+    void clear() {
+        for (uint32_t i = 0; i < slots.size(); ++i) {
+            slots[i] = Slot();
+        }
+    }
+
+    /**
+     * Call p_func(key, value) for every used slot.
+     */
+    template <typename F>
+    void for_each(F p_func) {
+        for (uint32_t i = 0; i < slots.size(); ++i) {
+            if (slots[i].used) {
+                p_func(slots[i].key, slots[i].value);
+            }
+        }
+    }
+
+    _FORCE_INLINE_ Slot &get_slot(K p_key) {
+        return slots[_index(p_key.cell.x, p_key.cell.z)];
+    }
+
+    _FORCE_INLINE_ T *getptr(K p_key) {
+        Slot &slot = get_slot(p_key);
+        return slot.used && slot.key == p_key ? &slot.value : nullptr;
+    }
+
+    _FORCE_INLINE_ const T *getptr(K p_key) const {
+        const Slot &slot = slots[_index(p_key.cell.x, p_key.cell.z)];
+        return slot.used && slot.key == p_key ? &slot.value : nullptr;
+    }
+
+    _FORCE_INLINE_ bool has(K p_key) const {
+        return getptr(p_key) != nullptr;
+    }
+
+    /**
+     * Store p_value for p_key. A different sector sharing the slot is overwritten, so
+     * the caller must release it first.
+     */
+    T *insert(K p_key, const T &p_value) {
+        Slot &slot = get_slot(p_key);
+        slot.key = p_key;
+        slot.value = p_value;
+        slot.used = true;
+        return &slot.value;
+    }
+
+    void erase(K p_key) {
+        Slot &slot = get_slot(p_key);
+
+        if (slot.used && slot.key == p_key) {
+            slot.used = false;
+        }
+    }
+
+    _FORCE_INLINE_ bool is_inside(K p_key) const {
+        const int dx = int(p_key.cell.x) - origin.x;
+        const int dz = int(p_key.cell.z) - origin.y;
+        return uint32_t(dx) <= mask_x && uint32_t(dz) <= mask_z;
+    }
+
+    /**
+     * Move the window to p_origin. p_evict(key, value) is called for every used slot
+     * left outside, visiting only the columns and rows that left the window.
+     */
+    template <typename F>
+    void slide(const Vector2i &p_origin, F p_evict) {
+        if (p_origin == origin || slots.is_empty()) {
+            origin = p_origin;
+            return;
+        }
+
+        const Vector2i prev = origin;
+        const int size_x = get_size_x();
+        const int size_z = get_size_z();
+        const Vector2i delta = p_origin - prev;
+        origin = p_origin;
+
+        if (ABS(delta.x) >= size_x || ABS(delta.y) >= size_z) {
+            for (uint32_t i = 0; i < slots.size(); ++i) {
+                _evict_outside(slots[i], p_evict);
+            }
+
+            return;
+        }
+
+        // Columns that left the window.
+        const int x_from = delta.x > 0 ? prev.x : origin.x + size_x;
+
+        for (int i = 0; i < ABS(delta.x); ++i) {
+            for (int iz = 0; iz < size_z; ++iz) {
+                _evict_outside(slots[_index(x_from + i, iz)], p_evict);
+            }
+        }
+
+        // Rows that left the window.
+        const int z_from = delta.y > 0 ? prev.y : origin.y + size_z;
+
+        for (int i = 0; i < ABS(delta.y); ++i) {
+            for (int ix = 0; ix < size_x; ++ix) {
+                _evict_outside(slots[_index(ix, z_from + i)], p_evict);
+            }
+        }
+    }
+
+    Vector2i get_origin() const { return origin; }
+    int get_size_x() const { return mask_x + 1; }
+    int get_size_z() const { return mask_z + 1; }
+};
+
+} // namespace Terrainer
+
+#endif // TERRAINER_SECTOR_GRID_H
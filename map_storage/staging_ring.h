@@ -0,0 +1,242 @@
+/**
+ * staging_ring.h
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#ifndef TERRAINER_STAGING_RING_H
+#define TERRAINER_STAGING_RING_H
+
+#include "core/os/os.h"
+#include "core/templates/local_vector.h"
+#include "core/templates/sort_array.h"
+
+#include <cstring>
+
+namespace Terrainer {
+
+/**
+ *
+ * StagingRing
+ * Fixed size byte ring holding decoded texture layers until they are uploaded.
+ * Features:
+ *   - Layers are copied in contiguously, wrapping to the start when the end is short
+ *   - Uploads go most important first, within a byte and a time budget per call
+ *   - Space is reclaimed in ring order, as soon as the oldest layers are uploaded
+ *   - A full ring refuses layers, so producers can hold back their requests
+ *   - Queued bytes and queue to upload latency, for monitoring
+ *
+ * A layer replaced or freed before its upload must be cancelled, or its stale data
+ * would overwrite the new owner of the layer.
+ */
+class StagingRing {
+public:
+    typedef void (*UploadCallback)(void *p_owner, int p_layer, const uint8_t *p_data, uint32_t p_size);
+
+private:
+    struct Entry {
+        uint32_t start = 0; // Where its space begins, before the wrap if it wrapped.
+        uint32_t offset = 0;
+        uint32_t size = 0;
+        int layer = -1;
+        float priority = 0.0f;
+        uint64_t queued_usec = 0;
+        bool done = false;
+    };
+
+    struct PriorityCompare {
+        const Entry *entries = nullptr;
+        _FORCE_INLINE_ bool operator()(uint32_t p_a, uint32_t p_b) const { return entries[p_a].priority > entries[p_b].priority; }
+    };
+
+    LocalVector<uint8_t> buffer;
+    LocalVector<Entry> entries; // Ring order, oldest first.
+    LocalVector<uint32_t> order; // Pending entries by priority, reused between uploads.
+    uint32_t head = 0;
+    size_t queued_bytes = 0;
+    uint64_t total_uploaded_bytes = 0;
+    uint64_t total_uploads = 0;
+    uint64_t total_latency_usec = 0;
+
+    void *owner = nullptr;
+    UploadCallback upload_callback = nullptr;
+
+    // Offset where p_size bytes fit after the head, or UINT32_MAX.
+    uint32_t _find_space(uint32_t p_size) const {
+        const uint32_t capacity = buffer.size();
+
+        if (entries.is_empty()) {
+            return p_size <= capacity ? 0 : UINT32_MAX;
+        }
+
+        const uint32_t tail = entries[0].start;
+
+        if (head > tail) {
+            if (p_size <= capacity - head) {
+                return head;
+            }
+
+            return p_size <= tail ? 0 : UINT32_MAX;
+        }
+
+        // Wrapped, the free space is between the head and the tail. Equal means full.
+        return head < tail && p_size <= tail - head ? head : UINT32_MAX;
+    }
+
+    void _reclaim() {
+        uint32_t first = 0;
+
+        while (first < entries.size() && entries[first].done) {
+            first++;
+        }
+
+        if (first == 0) {
+            return;
+        }
+
+        const uint32_t count = entries.size() - first;
+
+        for (uint32_t i = 0; i < count; ++i) {
+            entries[i] = entries[first + i];
+        }
+
+        entries.resize(count);
+
+        if (entries.is_empty()) {
+            head = 0;
+        }
+    }
+
+public:
+    void set_owner(void *p_owner, UploadCallback p_callback) {
+        owner = p_owner;
+        upload_callback = p_callback;
+    }
+
+    // Drops every queued layer.
+    void set_capacity(uint32_t p_bytes) {
+        clear();
+        buffer.resize(p_bytes);
+    }
+
+    /**
+     * Copy a decoded layer in. Returns false when it doesn't fit, the producer should
+     * retry once uploads free some space.
+     */
+    bool push(int p_layer, float p_priority, const uint8_t *p_data, uint32_t p_size) {
+        ERR_FAIL_COND_V(p_size == 0, false);
+        const uint32_t offset = _find_space(p_size);
+
+        if (offset == UINT32_MAX) {
+            return false;
+        }
+
+        Entry entry;
+        entry.start = entries.is_empty() ? offset : head;
+        entry.offset = offset;
+        entry.size = p_size;
+        entry.layer = p_layer;
+        entry.priority = p_priority;
+        entry.queued_usec = OS::get_singleton()->get_ticks_usec();
+        memcpy(buffer.ptr() + offset, p_data, p_size);
+        entries.push_back(entry);
+        head = offset + p_size;
+        queued_bytes += p_size;
+        return true;
+    }
+
+    // Skip the queued uploads of a layer.
+    void cancel(int p_layer) {
+        for (Entry &entry : entries) {
+            if (!entry.done && entry.layer == p_layer) {
+                entry.done = true;
+                queued_bytes -= entry.size;
+            }
+        }
+
+        _reclaim();
+    }
+
+    /**
+     * Upload the most important layers until p_max_bytes or p_max_usec is spent, at least
+     * one layer per call. Returns the number of uploaded layers.
+     */
+    int upload(size_t p_max_bytes, uint64_t p_max_usec) {
+        if (queued_bytes == 0 || !upload_callback) {
+            return 0;
+        }
+
+        order.clear();
+
+        for (uint32_t i = 0; i < entries.size(); ++i) {
+            if (!entries[i].done) {
+                order.push_back(i);
+            }
+        }
+
+        SortArray<uint32_t, PriorityCompare> sorter;
+        sorter.compare.entries = entries.ptr();
+        sorter.sort(order.ptr(), order.size());
+
+        OS *os = OS::get_singleton();
+        const uint64_t start = os->get_ticks_usec();
+        size_t bytes = 0;
+        int uploaded = 0;
+
+        for (const uint32_t index : order) {
+            Entry &entry = entries[index];
+
+            if (uploaded > 0 && bytes + entry.size > p_max_bytes) {
+                break;
+            }
+
+            upload_callback(owner, entry.layer, buffer.ptr() + entry.offset, entry.size);
+            const uint64_t now = os->get_ticks_usec();
+            entry.done = true;
+            queued_bytes -= entry.size;
+            bytes += entry.size;
+            total_uploaded_bytes += entry.size;
+            total_latency_usec += now - entry.queued_usec;
+            total_uploads++;
+            uploaded++;
+
+            if (now - start > p_max_usec) {
+                break;
+            }
+        }
+
+        _reclaim();
+        return uploaded;
+    }
+
+    void clear() {
+        entries.clear();
+        head = 0;
+        queued_bytes = 0;
+    }
+
+    uint32_t get_capacity() const { return buffer.size(); }
+    bool can_push(uint32_t p_size) const { return _find_space(p_size) != UINT32_MAX; }
+    size_t get_queued_bytes() const { return queued_bytes; }
+    int get_queued_count() const {
+        int count = 0;
+
+        for (const Entry &entry : entries) {
+            count += entry.done ? 0 : 1;
+        }
+
+        return count;
+    }
+    uint64_t get_total_uploaded_bytes() const { return total_uploaded_bytes; }
+    uint64_t get_total_uploads() const { return total_uploads; }
+    uint64_t get_total_latency_usec() const { return total_latency_usec; }
+};
+
+} // namespace Terrainer
+
+#endif // TERRAINER_STAGING_RING_H
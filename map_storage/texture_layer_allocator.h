@@ -0,0 +1,232 @@
+/**
+ * texture_layer_allocator.h
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#ifndef TERRAINER_TEXTURE_LAYER_ALLOCATOR_H
+#define TERRAINER_TEXTURE_LAYER_ALLOCATOR_H
+
+#include "core/math/vector3.h"
+#include "core/templates/local_vector.h"
+
+namespace Terrainer {
+
+/**
+ *
+ * TextureLayerAllocator
+ * CPU side bookkeeping of the layers of a texture array, without touching the GPU.
+ * Features:
+ *   - Page table of layers, with a free mask per page of 64 layers
+ *   - Lowest free layer first, so used layers stay packed at the start of the array
+ *   - Capacity that only grows, at least doubling, and never moves a used layer, so
+ *     the owner keeps resident data by copying the used layers to the same index
+ *   - CLOCK eviction, where layers used since the hand last passed get a second
+ *     chance, and nearer layers get more chances
+ *
+ * Template parameter K: Key type identifying the owner of a layer.
+ */
+template <typename K>
+class TextureLayerAllocator {
+public:
+    static const int INVALID_LAYER = -1;
+    static const int PAGE_LAYERS = 64;
+
+    /**
+     * Called for the selected victim. Returns false if the layer can't be evicted
+     * right now, in which case it is kept.
+     */
+    typedef bool (*EvictCallback)(void *p_owner, const K &p_key, uint8_t p_lod);
+
+private:
+    static const int MAX_CHANCES = 3; // Extra chances of a layer next to the viewer.
+
+    struct Layer {
+        K key;
+        const uint64_t *frame = nullptr;
+        uint64_t seen_frame = 0;
+        Vector3 position;
+        uint8_t lod = 0;
+        uint8_t chances = 0;
+    };
+
+    LocalVector<Layer> layers;
+    LocalVector<uint64_t> page_free_masks; // Bit set for each unused layer.
+    int capacity = 0;
+    int max_capacity = INT32_MAX;
+    int used_count = 0;
+    int hand = 0;
+    uint64_t total_evictions = 0;
+
+    void *owner = nullptr;
+    EvictCallback evict_callback = nullptr;
+
+    _FORCE_INLINE_ void _set_free(int p_layer, bool p_free) {
+        const uint64_t bit = uint64_t(1) << (p_layer % PAGE_LAYERS);
+
+        if (p_free) {
+            page_free_masks[p_layer / PAGE_LAYERS] |= bit;
+        } else {
+            page_free_masks[p_layer / PAGE_LAYERS] &= ~bit;
+        }
+    }
+
+    // Chances of a layer once its use is seen, from its distance relative to its LOD.
+    _FORCE_INLINE_ static uint8_t _chances(const Layer &p_layer, const Vector3 &p_viewer_pos, real_t p_far_distance) {
+        const real_t distance = p_viewer_pos.distance_to(p_layer.position) / real_t(1 << p_layer.lod);
+        const real_t nearness = p_far_distance > 0.0 ? 1.0 - MIN(distance / p_far_distance, (real_t)1.0) : 0.0;
+        return uint8_t(1 + int(nearness * MAX_CHANCES));
+    }
+
+public:
+    void set_owner(void *p_owner, EvictCallback p_callback) {
+        owner = p_owner;
+        evict_callback = p_callback;
+    }
+
+    /**
+     * Grow to at least p_min_capacity layers, in whole pages, and at least double the
+     * current capacity, up to the maximum. Used layers keep their index. Returns the
+     * new capacity.
+     */
+    int grow(int p_min_capacity) {
+        if (p_min_capacity <= capacity || capacity >= max_capacity) {
+            return capacity;
+        }
+
+        int new_capacity = MAX(p_min_capacity, capacity * 2);
+        new_capacity = MIN(((new_capacity + PAGE_LAYERS - 1) / PAGE_LAYERS) * PAGE_LAYERS, max_capacity);
+        const int pages = (new_capacity + PAGE_LAYERS - 1) / PAGE_LAYERS;
+        const int prev_pages = page_free_masks.size();
+        layers.resize(new_capacity);
+        page_free_masks.resize(pages);
+
+        for (int i = prev_pages; i < pages; ++i) {
+            page_free_masks[i] = 0;
+        }
+
+        for (int i = capacity; i < new_capacity; ++i) {
+            _set_free(i, true);
+        }
+
+        capacity = new_capacity;
+        return capacity;
+    }
+
+    /**
+     * Take the lowest free layer for p_key. p_frame must point to the last used frame
+     * of the layer data and stay valid until the layer is freed or evicted. Returns
+     * INVALID_LAYER when full, see grow() and evict().
+     */
+    int allocate(const K &p_key, const uint64_t *p_frame, const Vector3 &p_position, uint8_t p_lod) {
+        for (uint32_t page = 0; page < page_free_masks.size(); ++page) {
+            const uint64_t mask = page_free_masks[page];
+
+            if (mask == 0) {
+                continue;
+            }
+
+            int bit = 0;
+
+            while (!(mask & (uint64_t(1) << bit))) {
+                bit++;
+            }
+
+            const int index = page * PAGE_LAYERS + bit;
+            Layer &layer = layers[index];
+            layer.key = p_key;
+            layer.frame = p_frame;
+            layer.seen_frame = *p_frame;
+            layer.position = p_position;
+            layer.lod = p_lod;
+            layer.chances = 1;
+            _set_free(index, false);
+            used_count++;
+            return index;
+        }
+
+        return INVALID_LAYER;
+    }
+
+    void free(int p_layer) {
+        ERR_FAIL_INDEX(p_layer, capacity);
+        ERR_FAIL_COND(is_free(p_layer));
+        layers[p_layer] = Layer();
+        _set_free(p_layer, true);
+        used_count--;
+    }
+
+    /**
+     * Advance the CLOCK hand until p_count layers are evicted or every layer was visited
+     * twice. Returns the number of evicted layers, which are free again.
+     */
+    int evict(int p_count, const Vector3 &p_viewer_pos, real_t p_far_distance) {
+        if (used_count == 0 || !evict_callback) {
+            return 0;
+        }
+
+        int evicted = 0;
+
+        for (int step = 0; step < 2 * capacity * (MAX_CHANCES + 1) && evicted < p_count && used_count > 0; ++step) {
+            const int index = hand;
+            hand = hand + 1 < capacity ? hand + 1 : 0;
+
+            if (is_free(index)) {
+                continue;
+            }
+
+            Layer &layer = layers[index];
+
+            // Used since the hand last passed, it starts over.
+            if (*layer.frame != layer.seen_frame) {
+                layer.seen_frame = *layer.frame;
+                layer.chances = _chances(layer, p_viewer_pos, p_far_distance);
+                continue;
+            }
+
+            if (layer.chances > 0) {
+                layer.chances--;
+                continue;
+            }
+
+            if (evict_callback(owner, layer.key, layer.lod)) {
+                free(index);
+                total_evictions++;
+                evicted++;
+            }
+        }
+
+        return evicted;
+    }
+
+    void clear() {
+        layers.clear();
+        page_free_masks.clear();
+        capacity = 0;
+        used_count = 0;
+        hand = 0;
+    }
+
+    _FORCE_INLINE_ bool is_free(int p_layer) const {
+        return page_free_masks[p_layer / PAGE_LAYERS] & (uint64_t(1) << (p_layer % PAGE_LAYERS));
+    }
+
+    // Owner of a used layer.
+    const K &get_key(int p_layer) const { return layers[p_layer].key; }
+    uint8_t get_lod(int p_layer) const { return layers[p_layer].lod; }
+    void set_max_capacity(int p_layers) { max_capacity = MAX(p_layers, 0); }
+    int get_max_capacity() const { return max_capacity; }
+    int get_capacity() const { return capacity; }
+    int get_used_count() const { return used_count; }
+    int get_free_count() const { return capacity - used_count; }
+    uint64_t get_total_evictions() const { return total_evictions; }
+};
+
+} // namespace Terrainer
+
+#endif // TERRAINER_TEXTURE_LAYER_ALLOCATOR_H
@@ -11,6 +11,8 @@
 
 #include "terrain.h"
 
+#include "chunk_mesh.h"
+
 // #include "utils/macros.h"
 // #include "utils/math.h"
 
@@ -37,7 +39,15 @@ void Terrain::set_camera(Camera3D *p_camera) {
 	use_viewport_camera = camera == nullptr;
 }
 
+void Terrain::set_shadow_light(DirectionalLight3D *p_light) {
+	shadow_light = p_light ? p_light->get_instance_id() : ObjectID();
+	shadow_light_direction = Vector3();
+	dirty = true;
+}
+
 void Terrain::set_storage(const Ref<MapStorage> &p_storage) {
+	collision.clear();
+
 	if (storage.is_valid()) {
 		storage->disconnect_changed(callable_mp(this, &Terrain::_storage_changed));
 		storage->disconnect(MapStorage::path_changed, callable_mp(this, &Terrain::_storage_path_changed));
@@ -127,6 +137,61 @@ real_t Terrain::get_lod_distance_ratio() const {
 	return quad_tree.lod_distance_ratio;
 }
 
+void Terrain::set_lod_occlusion_culling(bool p_enabled) {
+	quad_tree.occlusion_culling = p_enabled;
+	dirty = true;
+}
+
+bool Terrain::is_lod_occlusion_culling() const {
+	return quad_tree.occlusion_culling;
+}
+
+void Terrain::set_lod_parallel_selection(bool p_enabled) {
+	quad_tree.parallel_selection = p_enabled;
+}
+
+bool Terrain::is_lod_parallel_selection() const {
+	return quad_tree.parallel_selection;
+}
+
+void Terrain::set_lod_incremental_selection(bool p_enabled) {
+	quad_tree.incremental_selection = p_enabled;
+}
+
+bool Terrain::is_lod_incremental_selection() const {
+	return quad_tree.incremental_selection;
+}
+
+void Terrain::set_lod_node_budget(int p_nodes) {
+	ERR_FAIL_COND(p_nodes < 0);
+	quad_tree.node_budget = p_nodes;
+	dirty = true;
+}
+
+int Terrain::get_lod_node_budget() const {
+	return quad_tree.node_budget;
+}
+
+void Terrain::set_lod_mode(LODMode p_mode) {
+	ERR_FAIL_INDEX(p_mode, LOD_MODE_MAX);
+	quad_tree.screen_error_mode = p_mode == LOD_MODE_SCREEN_ERROR;
+	dirty = true;
+}
+
+Terrain::LODMode Terrain::get_lod_mode() const {
+	return quad_tree.screen_error_mode ? LOD_MODE_SCREEN_ERROR : LOD_MODE_DISTANCE;
+}
+
+void Terrain::set_lod_max_screen_error(real_t p_pixels) {
+	ERR_FAIL_COND_EDMSG(p_pixels <= 0.0, "Screen error must be positive.");
+	quad_tree.max_screen_error = p_pixels;
+	dirty = true;
+}
+
+real_t Terrain::get_lod_max_screen_error() const {
+	return quad_tree.max_screen_error;
+}
+
 int Terrain::info_get_lod_levels() const {
 	return quad_tree.lod_levels;
 }
@@ -139,6 +204,128 @@ int Terrain::info_get_selected_nodes_count() const {
 	return quad_tree.selection_count;
 }
 
+void Terrain::set_shadow_lod_bias(real_t p_bias) {
+	ERR_FAIL_COND_EDMSG(p_bias <= 0.0 || p_bias > 1.0, "Shadow LOD bias must be in (0, 1], shadows never use more detail than the camera.");
+	shadow_lod_bias = p_bias;
+	dirty = true;
+}
+
+real_t Terrain::get_shadow_lod_bias() const {
+	return shadow_lod_bias;
+}
+
+int Terrain::info_get_shadow_cascade_count() const {
+	return shadow_cascade_count;
+}
+
+int Terrain::info_get_shadow_nodes_count(int p_cascade) const {
+	ERR_FAIL_INDEX_V(p_cascade, shadow_cascade_count, 0);
+	return shadow_views[p_cascade].nodes.size();
+}
+
+Vector3 Terrain::rebase_origin(const Vector3 &p_position) {
+	ERR_FAIL_COND_V(storage.is_null(), Vector3());
+	// Whole chunks, so node positions stay exact integers relative to the origin.
+	const real_t chunk_x = storage->get_chunk_size() * map_scale.x;
+	const real_t chunk_z = storage->get_chunk_size() * map_scale.z;
+	const Vector2i chunks = Vector2i(int(Math::floor(p_position.x / chunk_x)), int(Math::floor(p_position.z / chunk_z)));
+
+	if (chunks == Vector2i()) {
+		return Vector3();
+	}
+
+	quad_tree.set_origin_shift(quad_tree.get_origin_shift() + chunks);
+	const Vector3 shift = Vector3(-chunks.x * chunk_x, 0.0, -chunks.y * chunk_z);
+	// The terrain moves its own camera, so the viewer never runs away from the origin
+	// whether origin_rebased is handled right away, deferred or not at all. Handlers move
+	// the rest of the world.
+	if (camera) {
+		camera->set_global_position(camera->get_global_position() + shift);
+	}
+
+	viewer_transform.origin += shift;
+	dirty = true;
+	emit_signal(SNAME("origin_rebased"), shift);
+	return shift;
+}
+
+Vector2i Terrain::get_origin_chunk() const {
+	return quad_tree.get_origin_chunk();
+}
+
+void Terrain::set_origin_rebase_distance(real_t p_distance) {
+	ERR_FAIL_COND(p_distance < 0.0);
+	origin_rebase_distance = p_distance;
+}
+
+real_t Terrain::get_origin_rebase_distance() const {
+	return origin_rebase_distance;
+}
+
+PackedByteArray Terrain::get_visibility(const PackedVector3Array &p_from, const PackedVector3Array &p_to) const {
+	PackedByteArray mask;
+	ERR_FAIL_COND_V(storage.is_null(), mask);
+	ERR_FAIL_COND_V(p_from.size() != p_to.size(), mask);
+	const int count = p_from.size();
+	mask.resize((count + 7) / 8);
+
+	if (count == 0) {
+		return mask;
+	}
+
+	// The storage works in map space, relative to the map corner.
+	PackedVector3Array from = p_from;
+	PackedVector3Array to = p_to;
+	Vector3 *from_w = from.ptrw();
+	Vector3 *to_w = to.ptrw();
+
+	for (int i = 0; i < count; ++i) {
+		from_w[i] -= quad_tree.world_offset;
+		to_w[i] -= quad_tree.world_offset;
+	}
+
+	storage->get_visibility(from.ptr(), to.ptr(), count, mask.ptrw());
+	return mask;
+}
+
+void Terrain::add_collision_body(Node3D *p_body) {
+	ERR_FAIL_NULL(p_body);
+	collision.add_body(p_body->get_instance_id());
+}
+
+void Terrain::remove_collision_body(Node3D *p_body) {
+	ERR_FAIL_NULL(p_body);
+	collision.remove_body(p_body->get_instance_id());
+}
+
+void Terrain::set_collision_radius(int p_tiles) {
+	collision.set_radius(p_tiles);
+}
+
+int Terrain::get_collision_radius() const {
+	return collision.get_radius();
+}
+
+void Terrain::set_collision_layer(uint32_t p_layer) {
+	collision.set_collision_layer(p_layer);
+}
+
+uint32_t Terrain::get_collision_layer() const {
+	return collision.get_collision_layer();
+}
+
+void Terrain::set_collision_mask(uint32_t p_mask) {
+	collision.set_collision_mask(p_mask);
+}
+
+uint32_t Terrain::get_collision_mask() const {
+	return collision.get_collision_mask();
+}
+
+int Terrain::info_get_collision_tiles_count() const {
+	return collision.get_tile_count();
+}
+
 void Terrain::set_debug_nodes_aabb_enabled(bool p_enabled) {
 	if (p_enabled == debug_nodes_aabb_enabled) {
 		return;
@@ -191,6 +378,8 @@ void Terrain::_notification(int p_what) {
 			_update_visibility();
 		} break;
 		case NOTIFICATION_INTERNAL_PROCESS: {
+			// Collision builds read the storage, finish them before it changes.
+			collision.finish_builds();
 			_update_viewer(get_process_delta_time());
 
 			if (dirty) {
@@ -198,6 +387,7 @@ void Terrain::_notification(int p_what) {
 			}
 
 			storage->process();
+			collision.update(storage, map_scale, quad_tree.get_origin_chunk());
 		} break;
 	}
 }
@@ -215,25 +405,80 @@ void Terrain::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("get_lod_detailed_chunks_radius"), &Terrain::get_lod_detailed_chunks_radius);
 	ClassDB::bind_method(D_METHOD("set_lod_distance_ratio", "ratio"), &Terrain::set_lod_distance_ratio);
 	ClassDB::bind_method(D_METHOD("get_lod_distance_ratio"), &Terrain::get_lod_distance_ratio);
+	ClassDB::bind_method(D_METHOD("set_lod_occlusion_culling", "enabled"), &Terrain::set_lod_occlusion_culling);
+	ClassDB::bind_method(D_METHOD("is_lod_occlusion_culling"), &Terrain::is_lod_occlusion_culling);
+	ClassDB::bind_method(D_METHOD("set_lod_parallel_selection", "enabled"), &Terrain::set_lod_parallel_selection);
+	ClassDB::bind_method(D_METHOD("is_lod_parallel_selection"), &Terrain::is_lod_parallel_selection);
+	ClassDB::bind_method(D_METHOD("set_lod_incremental_selection", "enabled"), &Terrain::set_lod_incremental_selection);
+	ClassDB::bind_method(D_METHOD("is_lod_incremental_selection"), &Terrain::is_lod_incremental_selection);
+	ClassDB::bind_method(D_METHOD("set_lod_node_budget", "nodes"), &Terrain::set_lod_node_budget);
+	ClassDB::bind_method(D_METHOD("get_lod_node_budget"), &Terrain::get_lod_node_budget);
+	ClassDB::bind_method(D_METHOD("set_lod_mode", "mode"), &Terrain::set_lod_mode);
+	ClassDB::bind_method(D_METHOD("get_lod_mode"), &Terrain::get_lod_mode);
+	ClassDB::bind_method(D_METHOD("set_lod_max_screen_error", "pixels"), &Terrain::set_lod_max_screen_error);
+	ClassDB::bind_method(D_METHOD("get_lod_max_screen_error"), &Terrain::get_lod_max_screen_error);
 
 	ClassDB::bind_method(D_METHOD("info_get_lod_levels"), &Terrain::info_get_lod_levels);
 	ClassDB::bind_method(D_METHOD("info_get_lod_nodes_count", "level"), &Terrain::info_get_lod_nodes_count);
 	ClassDB::bind_method(D_METHOD("info_get_selected_nodes_count"), &Terrain::info_get_selected_nodes_count);
 
+	ClassDB::bind_method(D_METHOD("set_shadow_light", "light"), &Terrain::set_shadow_light);
+	ClassDB::bind_method(D_METHOD("set_shadow_lod_bias", "bias"), &Terrain::set_shadow_lod_bias);
+	ClassDB::bind_method(D_METHOD("get_shadow_lod_bias"), &Terrain::get_shadow_lod_bias);
+	ClassDB::bind_method(D_METHOD("info_get_shadow_cascade_count"), &Terrain::info_get_shadow_cascade_count);
+	ClassDB::bind_method(D_METHOD("info_get_shadow_nodes_count", "cascade"), &Terrain::info_get_shadow_nodes_count);
+
+	ClassDB::bind_method(D_METHOD("rebase_origin", "position"), &Terrain::rebase_origin);
+	ClassDB::bind_method(D_METHOD("get_origin_chunk"), &Terrain::get_origin_chunk);
+	ClassDB::bind_method(D_METHOD("set_origin_rebase_distance", "distance"), &Terrain::set_origin_rebase_distance);
+	ClassDB::bind_method(D_METHOD("get_origin_rebase_distance"), &Terrain::get_origin_rebase_distance);
+
+	ClassDB::bind_method(D_METHOD("get_visibility", "from", "to"), &Terrain::get_visibility);
+
+	ClassDB::bind_method(D_METHOD("add_collision_body", "body"), &Terrain::add_collision_body);
+	ClassDB::bind_method(D_METHOD("remove_collision_body", "body"), &Terrain::remove_collision_body);
+	ClassDB::bind_method(D_METHOD("set_collision_radius", "tiles"), &Terrain::set_collision_radius);
+	ClassDB::bind_method(D_METHOD("get_collision_radius"), &Terrain::get_collision_radius);
+	ClassDB::bind_method(D_METHOD("set_collision_layer", "layer"), &Terrain::set_collision_layer);
+	ClassDB::bind_method(D_METHOD("get_collision_layer"), &Terrain::get_collision_layer);
+	ClassDB::bind_method(D_METHOD("set_collision_mask", "mask"), &Terrain::set_collision_mask);
+	ClassDB::bind_method(D_METHOD("get_collision_mask"), &Terrain::get_collision_mask);
+	ClassDB::bind_method(D_METHOD("info_get_collision_tiles_count"), &Terrain::info_get_collision_tiles_count);
+
 	ClassDB::bind_method(D_METHOD("set_debug_nodes_aabb_enabled", "enabled"), &Terrain::set_debug_nodes_aabb_enabled);
 	ClassDB::bind_method(D_METHOD("is_debug_nodes_aabb_enabled"), &Terrain::is_debug_nodes_aabb_enabled);
 
 	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "storage", PROPERTY_HINT_RESOURCE_TYPE, "MapStorage"), "set_storage", "get_storage");
 	ADD_PROPERTY(PropertyInfo(Variant::VECTOR3, "map_scale"), "set_map_scale", "get_map_scale");
 	ADD_PROPERTY(PropertyInfo(Variant::VECTOR2I, "world_regions"), "set_world_regions", "get_world_regions");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "origin_rebase_distance", PROPERTY_HINT_RANGE, "0,100000,1,or_greater,suffix:m"), "set_origin_rebase_distance", "get_origin_rebase_distance");
 // 	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "material", PROPERTY_HINT_RESOURCE_TYPE, "ShaderMaterial"), "set_material", "get_material");
 
 	ADD_GROUP("LOD", "lod_");
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "lod_detailed_chunks_radius", PROPERTY_HINT_RANGE, "1,16"), "set_lod_detailed_chunks_radius", "get_lod_detailed_chunks_radius");
 	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "lod_distance_ratio", PROPERTY_HINT_RANGE, "1.5,10.0,0.1"), "set_lod_distance_ratio", "get_lod_distance_ratio");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "lod_occlusion_culling"), "set_lod_occlusion_culling", "is_lod_occlusion_culling");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "lod_parallel_selection"), "set_lod_parallel_selection", "is_lod_parallel_selection");
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "lod_incremental_selection"), "set_lod_incremental_selection", "is_lod_incremental_selection");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "lod_node_budget", PROPERTY_HINT_RANGE, "0,65536,1,or_greater"), "set_lod_node_budget", "get_lod_node_budget");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "lod_mode", PROPERTY_HINT_ENUM, "Distance,Screen Error"), "set_lod_mode", "get_lod_mode");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "lod_max_screen_error", PROPERTY_HINT_RANGE, "0.25,32.0,0.25,suffix:px"), "set_lod_max_screen_error", "get_lod_max_screen_error");
+
+	ADD_GROUP("Shadow", "shadow_");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "shadow_lod_bias", PROPERTY_HINT_RANGE, "0.05,1.0,0.05"), "set_shadow_lod_bias", "get_shadow_lod_bias");
+
+	ADD_GROUP("Collision", "collision_");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "collision_radius", PROPERTY_HINT_RANGE, "0,16"), "set_collision_radius", "get_collision_radius");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "collision_layer", PROPERTY_HINT_LAYERS_3D_PHYSICS), "set_collision_layer", "get_collision_layer");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "collision_mask", PROPERTY_HINT_LAYERS_3D_PHYSICS), "set_collision_mask", "get_collision_mask");
 
 	ADD_GROUP("Debug", "debug_");
 	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "debug_nodes_aabb_enabled"), "set_debug_nodes_aabb_enabled", "is_debug_nodes_aabb_enabled");
+
+	ADD_SIGNAL(MethodInfo("origin_rebased", PropertyInfo(Variant::VECTOR3, "shift")));
+
+	BIND_ENUM_CONSTANT(LOD_MODE_DISTANCE);
+	BIND_ENUM_CONSTANT(LOD_MODE_SCREEN_ERROR);
 }
 
 PackedStringArray Terrain::get_configuration_warnings() const {
@@ -265,9 +510,12 @@ void Terrain::_enter_world() {
 
 	Transform3D xform = get_global_transform();
 	RID scenario = get_world_3d()->get_scenario();
+	collision.set_space(get_world_3d()->get_space());
 	RenderingServer *const rs = RenderingServer::get_singleton();
 	rs->instance_set_scenario(mm_instance, scenario);
 	rs->instance_set_transform(mm_instance, xform);
+	rs->instance_set_scenario(mm_shadow_instance, scenario);
+	rs->instance_set_transform(mm_shadow_instance, xform);
 
 	if (debug_nodes_aabb_enabled) {
 		rs->instance_set_scenario(debug_aabb.instance, scenario);
@@ -280,17 +528,21 @@ void Terrain::_enter_world() {
 void Terrain::_exit_world() {
 	RenderingServer *const rs = RenderingServer::get_singleton();
 	rs->instance_set_scenario(mm_instance, RID());
+	rs->instance_set_scenario(mm_shadow_instance, RID());
 
 	if (debug_nodes_aabb_enabled) {
 		rs->instance_set_scenario(debug_aabb.instance, RID());
 	}
 
+	collision.clear();
+	collision.set_space(RID());
 	inside_world = false;
 }
 
 void Terrain::_update_visibility() {
 	RenderingServer *const rs = RenderingServer::get_singleton();
 	rs->instance_set_visible(mm_instance, is_visible_in_tree());
+	rs->instance_set_visible(mm_shadow_instance, is_visible_in_tree());
 
 	if (debug_nodes_aabb_enabled) {
 		rs->instance_set_visible(debug_aabb.instance, is_visible_in_tree());
@@ -302,6 +554,7 @@ void Terrain::_update_transform() {
 	Transform3D xform = get_global_transform();
 	RenderingServer *const rs = RenderingServer::get_singleton();
 	rs->instance_set_transform(mm_instance, xform);
+	rs->instance_set_transform(mm_shadow_instance, xform);
 
 	if (debug_nodes_aabb_enabled) {
 		rs->instance_set_transform(debug_aabb.instance, xform);
@@ -327,17 +580,53 @@ void Terrain::_update_viewer(double p_delta) {
 		_set_lod_levels();
 	}
 
+	// Relative to the map, so it doesn't change with a rebase.
 	Vector3 prev_pos = viewer_transform.origin - quad_tree.world_offset;
 
+	// Far from the origin, move it under the camera. The camera is moved by the rebase.
+	bool rebased = false;
+
+	if (origin_rebase_distance > 0.0) {
+		const Transform3D cam_xform = camera->get_global_transform();
+		const Vector3 camera_position = cam_xform.origin;
+
+		if (camera_position.x * camera_position.x + camera_position.z * camera_position.z > origin_rebase_distance * origin_rebase_distance) {
+			const Vector3 shift = rebase_origin(camera_position);
+
+			if (shift != Vector3()) {
+				// The camera transform of this frame, shifted like the camera.
+				viewer_transform = cam_xform;
+				viewer_transform.origin += shift;
+				rebased = true;
+			}
+		}
+	}
+
 	if (dirty) {
-		viewer_transform = camera->get_global_transform();
+		if (!rebased) {
+			viewer_transform = camera->get_global_transform();
+		}
+
 		quad_tree.frustum = camera->get_frustum();
+		_update_screen_error_scale();
 	} else {
 		Transform3D cam_xform = camera->get_global_transform();
 
 		if (cam_xform.origin.distance_squared_to(viewer_transform.origin) > update_distance_tolerance_squared || !cam_xform.basis.get_euler().is_equal_approx(viewer_transform.basis.get_euler())) {
 			viewer_transform = cam_xform;
 			quad_tree.frustum = camera->get_frustum();
+			_update_screen_error_scale();
+			dirty = true;
+		}
+	}
+
+	DirectionalLight3D *light = Object::cast_to<DirectionalLight3D>(ObjectDB::get_instance(shadow_light));
+
+	if (light) {
+		const Vector3 light_direction = -light->get_global_transform().basis.get_column(2).normalized();
+
+		if (!light_direction.is_equal_approx(shadow_light_direction)) {
+			shadow_light_direction = light_direction;
 			dirty = true;
 		}
 	}
@@ -355,68 +644,272 @@ void Terrain::_update_chunks() {
 	const real_t sector_size_x = sector_size * map_scale.x;
 	const real_t sector_size_z = sector_size * map_scale.z;
 	const Vector3 viewer_position = viewer_transform.origin;
+	const Vector3 viewer_local = viewer_position - quad_tree.world_offset;
 	const real_t far_squared = far_view * far_view;
-	quad_tree.selection_count = 0;
-
-	for (uint16_t iz = 0; iz < quad_tree.sector_count_z; ++iz) {
-		for (uint16_t ix = 0; ix < quad_tree.sector_count_x; ++ix) {
-			const Vector3 sector_pos = Vector3(sector_size_x * ix, 0.0, sector_size_z * iz) + quad_tree.world_offset;
-			real_t dx = sector_pos.x - viewer_position.x;
-			dx = MIN(abs(dx), abs(dx + sector_size_x));
-			real_t dz = sector_pos.z - viewer_position.z;
-			dz = MIN(abs(dz), abs(dx + sector_size_z));
-
-			if (dx * dx + dz * dz < far_squared) {
-				CellKey sector = {ix, iz};
-
-				if (storage->is_sector_loaded(sector)) {
-					quad_tree.select_sector_nodes(viewer_transform.origin, sector, storage);
-				} else {
-					LODQuadTree::NodeSelectionResult result = quad_tree.select_sector_nodes(viewer_transform.origin, sector, storage, quad_tree.lod_levels - 1);
-
-					if (result != LODQuadTree::NodeSelectionResult::OutOfRange) {
-						storage->load_minmax(sector, result != LODQuadTree::NodeSelectionResult::OutOfFrustum);
-					}
+	sector_order.clear();
+	sector_update_frame++;
+
+	// Only the sectors overlapping the view distance disc: the rows it covers, and in each
+	// row the columns within its half width at the nearest edge of the row.
+	const int first_row = int(CLAMP(Math::floor((viewer_local.z - far_view) / sector_size_z), (real_t)0.0, (real_t)quad_tree.sector_count_z));
+	const int last_row = int(CLAMP(Math::floor((viewer_local.z + far_view) / sector_size_z), (real_t)-1.0, (real_t)quad_tree.sector_count_z - 1));
+
+	for (int iz = first_row; iz <= last_row; ++iz) {
+		const real_t z = iz * sector_size_z;
+		const real_t dz = MAX(MAX(z - viewer_local.z, viewer_local.z - z - sector_size_z), (real_t)0.0);
+		const real_t half_width = Math::sqrt(MAX(far_squared - dz * dz, (real_t)0.0));
+		const int first_column = int(CLAMP(Math::floor((viewer_local.x - half_width) / sector_size_x), (real_t)0.0, (real_t)quad_tree.sector_count_x));
+		const int last_column = int(CLAMP(Math::floor((viewer_local.x + half_width) / sector_size_x), (real_t)-1.0, (real_t)quad_tree.sector_count_x - 1));
+
+		for (int ix = first_column; ix <= last_column; ++ix) {
+			const real_t x = ix * sector_size_x;
+			const real_t dx = MAX(MAX(x - viewer_local.x, viewer_local.x - x - sector_size_x), (real_t)0.0);
+			const real_t distance_squared = dx * dx + dz * dz;
+
+			if (distance_squared >= far_squared) {
+				continue;
+			}
+
+			const CellKey sector = CellKey(ix, iz);
+			sector_order.push_back({ sector, distance_squared });
+			uint64_t *frame = active_sectors.getptr(sector);
+
+			if (frame) {
+				*frame = sector_update_frame;
+			} else {
+				// Entered the view distance, start loading its minmax right away.
+				active_sectors.insert(sector, sector_update_frame);
+
+				if (!storage->is_sector_loaded(sector)) {
+					storage->load_minmax(sector, false);
 				}
 			}
 		}
 	}
 
-	dirty = false;
+	// Sectors that left the view distance are no longer touched, the storage can evict them.
+	sector_exits.clear();
 
-	if (quad_tree.selection_count == 0) {
-		return;
+	for (const KeyValue<CellKey, uint64_t> &kv : active_sectors) {
+		if (kv.value != sector_update_frame) {
+			sector_exits.push_back(kv.key);
+		}
 	}
 
-	RenderingServer *const rs = RenderingServer::get_singleton();
-	rs->multimesh_allocate_data(mm_chunks, quad_tree.selection_count, RenderingServer::MULTIMESH_TRANSFORM_3D, true);
-	int lod_half = (quad_tree.lod_levels + 1) / 2;
-	int instance_index = 0;
+	for (const CellKey &sector : sector_exits) {
+		active_sectors.erase(sector);
+	}
+
+	// Front to back, nearer sectors occlude the ones behind them.
+	if (quad_tree.occlusion_culling) {
+		sector_order.sort();
+	}
+
+	// Sectors without minmax data only check their root node.
+	sector_selections.resize(sector_order.size());
+
+	for (uint32_t i = 0; i < sector_order.size(); ++i) {
+		LODQuadTree::SectorSelection &selection = sector_selections[i];
+		selection.sector = sector_order[i].sector;
+		selection.stop_at_lod_level = storage->is_sector_loaded(selection.sector) ? 0 : quad_tree.lod_levels - 1;
+	}
+
+	quad_tree.select_sectors(viewer_position, storage, sector_selections.ptr(), sector_selections.size());
+
+	// Sectors still loading get their requests raised once in view.
+	for (const LODQuadTree::SectorSelection &selection : sector_selections) {
+		if (selection.result == LODQuadTree::NodeSelectionResult::Selected && !storage->is_sector_loaded(selection.sector)) {
+			storage->load_minmax(selection.sector, true);
+		}
+	}
+
+	dirty = false;
+	_update_shadow_chunks();
+
+	// Texture requests change the storage, they stay on this thread.
+	instance_nodes.clear();
+	instance_layers.clear();
 
 	for (int i = 0; i < quad_tree.selection_count; ++i) {
 		const LODQuadTree::QTNode *node = quad_tree.get_selected_node(i);
-		int lod = node->get_lod_level();
-		int texture_layer = storage->get_node_texture_layer(node->key, lod);
-		// int lod_diff = quad_tree.lod_levels - lod - 1;
-		// int x = node->x >> lod_diff;
-// 		int z = node->z >> lod_diff;
-// 		Vector2i root_node = Vector2i(x, z);
-// 		int texture_layer = 0;
-// 		bool node_ready = storage->get_node_texture_layer(root_node, texture_layer);
-// 		int node_size = 1 << lod_diff;
-// 		Vector2i uv_shift = Vector2i(node->x - x * node_size, node->z - z * node_size);
-
-// 		if (node_ready) {
-// 			_configure_chunk_mesh(rs, node, instance_index);
-// 			instance_index++;
-// 		}
+		const int texture_layer = storage->get_node_texture_layer(node->key, node->get_lod_level());
+
+		// Drawn once its textures are resident.
+		if (texture_layer != MapStorage::INVALID_TEXTURE_LAYER) {
+			instance_nodes.push_back(i);
+			instance_layers.push_back(texture_layer);
+		}
 	}
 
+	const int count = instance_nodes.size();
+	const int blocks = (count + INSTANCE_BLOCK_SIZE - 1) / INSTANCE_BLOCK_SIZE;
+	instance_data = _reserve_instances(mm_chunks, mm_chunks_buffer, count, true);
+
+	// Blocks are encoded independently, parallel as soon as there is more than one.
+	if (blocks > 1) {
+		WorkerThreadPool::GroupID group = WorkerThreadPool::get_singleton()->add_native_group_task(_encode_instances_task, this, blocks, -1, true, SNAME("Terrainer chunk instances"));
+		WorkerThreadPool::get_singleton()->wait_for_group_task_completion(group);
+	} else {
+		for (int i = 0; i < blocks; ++i) {
+			_encode_instances_task(this, i);
+		}
+	}
+
+	instance_data = nullptr;
+	_upload_instances(mm_chunks, mm_chunks_buffer, count);
+
 	if (debug_nodes_aabb_enabled) {
 		_debug_nodes_aabb_draw();
 	}
+}
+
+float *Terrain::_reserve_instances(RID p_multimesh, InstanceBuffer &r_buffer, int p_count, bool p_use_custom_data) {
+	const int stride = p_use_custom_data ? 16 : 12;
+
+	if (p_count > r_buffer.capacity || stride != r_buffer.stride) {
+		int capacity = MAX(r_buffer.capacity, MIN_INSTANCE_CAPACITY);
+
+		while (capacity < p_count) {
+			capacity *= 2;
+		}
+
+		RenderingServer::get_singleton()->multimesh_allocate_data(p_multimesh, capacity, RenderingServer::MULTIMESH_TRANSFORM_3D, false, p_use_custom_data);
+		r_buffer.data.resize(capacity * stride);
+		r_buffer.capacity = capacity;
+		r_buffer.stride = stride;
+	}
+
+	return r_buffer.data.ptrw();
+}
+
+void Terrain::_upload_instances(RID p_multimesh, const InstanceBuffer &p_buffer, int p_count) {
+	RenderingServer *const rs = RenderingServer::get_singleton();
+
+	// Instances past the count keep stale data, they aren't drawn.
+	if (p_count > 0) {
+		rs->multimesh_set_buffer(p_multimesh, p_buffer.data);
+	}
+
+	rs->multimesh_set_visible_instances(p_multimesh, p_count);
+}
+
+_FORCE_INLINE_ void Terrain::_write_instance_transform(float *p_dst, const Transform3D &p_transform) {
+	// Row-major 3x4, as in multimesh buffers.
+	for (int i = 0; i < 3; ++i) {
+		p_dst[4 * i + 0] = p_transform.basis.rows[i].x;
+		p_dst[4 * i + 1] = p_transform.basis.rows[i].y;
+		p_dst[4 * i + 2] = p_transform.basis.rows[i].z;
+		p_dst[4 * i + 3] = p_transform.origin[i];
+	}
+}
+
+void Terrain::_encode_instances_task(void *p_terrain, uint32_t p_block) {
+	const Terrain *terrain = static_cast<const Terrain *>(p_terrain);
+	const uint32_t from = p_block * INSTANCE_BLOCK_SIZE;
+	const uint32_t to = MIN(from + INSTANCE_BLOCK_SIZE, terrain->instance_nodes.size());
+	const int stride = terrain->mm_chunks_buffer.stride;
+
+	for (uint32_t i = from; i < to; ++i) {
+		const LODQuadTree::QTNode *node = terrain->quad_tree.get_selected_node(terrain->instance_nodes[i]);
+		const Vector2 morph = terrain->quad_tree.get_lod_morph(node->get_lod_level());
+		float *dst = terrain->instance_data + size_t(i) * stride;
+		_write_instance_transform(dst, terrain->quad_tree.get_node_transform(node));
+		ChunkInstance::encode(dst + 12, terrain->instance_layers[i], node->flags, morph.x, morph.y);
+	}
+}
+
+void Terrain::_update_shadow_views() {
+	shadow_cascade_count = 0;
+	const DirectionalLight3D *light = Object::cast_to<DirectionalLight3D>(ObjectDB::get_instance(shadow_light));
+
+	if (!light || !light->is_visible_in_tree() || !light->has_shadow()) {
+		return;
+	}
+
+	int count = 1;
+	real_t splits[MAX_SHADOW_CASCADES] = { 1.0, 1.0, 1.0, 1.0 };
+
+	if (light->get_shadow_mode() == DirectionalLight3D::SHADOW_PARALLEL_2_SPLITS) {
+		count = 2;
+		splits[0] = light->get_param(Light3D::PARAM_SHADOW_SPLIT_1_OFFSET);
+	} else if (light->get_shadow_mode() == DirectionalLight3D::SHADOW_PARALLEL_4_SPLITS) {
+		count = 4;
+		splits[0] = light->get_param(Light3D::PARAM_SHADOW_SPLIT_1_OFFSET);
+		splits[1] = light->get_param(Light3D::PARAM_SHADOW_SPLIT_2_OFFSET);
+		splits[2] = light->get_param(Light3D::PARAM_SHADOW_SPLIT_3_OFFSET);
+	}
 
-	rs->multimesh_set_visible_instances(mm_chunks, instance_index);
+	// Camera frustum slice of each cascade, from its corners on the near plane.
+	const Projection projection = camera->get_camera_projection();
+	const real_t z_near = projection.get_z_near();
+	const Vector2 near_half_extents = projection.get_viewport_half_extents();
+	const bool orthogonal = projection.is_orthogonal();
+	const real_t max_distance = MIN((real_t)light->get_param(Light3D::PARAM_SHADOW_MAX_DISTANCE), far_view);
+	real_t bias = shadow_lod_bias;
+	real_t from = z_near;
+
+	for (int i = 0; i < count; ++i) {
+		const real_t to = MAX(splits[i] * max_distance, from);
+		Vector3 corners[8];
+
+		for (int j = 0; j < 8; ++j) {
+			const real_t distance = (j & 4) ? to : from;
+			const real_t scale = orthogonal ? 1.0 : distance / z_near;
+			const Vector3 corner = Vector3((j & 1 ? 1.0 : -1.0) * near_half_extents.x * scale, (j & 2 ? 1.0 : -1.0) * near_half_extents.y * scale, -distance);
+			corners[j] = viewer_transform.xform(corner);
+		}
+
+		// Farther cascades have coarser shadow maps, coarser casters are enough.
+		LODQuadTree::set_shadow_cascade_view(shadow_views[i], viewer_transform.origin, corners, shadow_light_direction, bias);
+		bias *= SHADOW_CASCADE_LOD_FACTOR;
+		from = to;
+	}
+
+	shadow_cascade_count = count;
+}
+
+void Terrain::_update_shadow_chunks() {
+	_update_shadow_views();
+	RenderingServer *const rs = RenderingServer::get_singleton();
+	// The camera selection casts shadows only without a selection of its own.
+	rs->instance_geometry_set_cast_shadows_setting(mm_instance, shadow_cascade_count > 0 ? RenderingServer::SHADOW_CASTING_SETTING_OFF : RenderingServer::SHADOW_CASTING_SETTING_ON);
+
+	if (shadow_cascade_count == 0) {
+		_upload_instances(mm_shadow_chunks, mm_shadow_buffer, 0);
+		return;
+	}
+
+	// Same sectors as the camera, the shadow views share its position and far view.
+	shadow_selections.resize(sector_selections.size());
+
+	for (uint32_t i = 0; i < sector_selections.size(); ++i) {
+		shadow_selections[i].sector = sector_selections[i].sector;
+		shadow_selections[i].stop_at_lod_level = sector_selections[i].stop_at_lod_level;
+	}
+
+	quad_tree.select_views(storage, shadow_selections.ptr(), shadow_selections.size(), shadow_views, shadow_cascade_count);
+	// Finest LOD wherever cascades overlap, no caster is drawn twice into a shadow map.
+	quad_tree.merge_views(storage, shadow_views, shadow_cascade_count, shadow_nodes);
+	float *instances = _reserve_instances(mm_shadow_chunks, mm_shadow_buffer, shadow_nodes.size(), true);
+	int instance_index = 0;
+
+	for (const LODQuadTree::QTNode &node : shadow_nodes) {
+		const int lod = node.get_lod_level();
+		const int texture_layer = storage->get_node_texture_layer(node.key, lod);
+
+		// Like the camera nodes, cast once their textures are resident.
+		if (texture_layer == MapStorage::INVALID_TEXTURE_LAYER) {
+			continue;
+		}
+
+		const Vector2 morph = quad_tree.get_lod_morph(lod);
+		float *dst = instances + size_t(instance_index) * mm_shadow_buffer.stride;
+		_write_instance_transform(dst, quad_tree.get_node_transform(&node));
+		ChunkInstance::encode(dst + 12, texture_layer, node.flags, morph.x, morph.y);
+		instance_index++;
+	}
+
+	_upload_instances(mm_shadow_chunks, mm_shadow_buffer, instance_index);
 }
 
 void Terrain::_set_viewport_camera() {
@@ -435,51 +928,32 @@ void Terrain::_create_mesh() {
 
 	const int chunk_size = storage->get_chunk_size();
 	const int num_points = chunk_size + 1;
+	const int vertex_count = chunk_mesh_vertex_count(chunk_size);
 	PackedVector3Array vertices;
-	vertices.resize(num_points * num_points);
+	vertices.resize(vertex_count);
+	Vector3 *vertex = vertices.ptrw();
 	const real_t s = 1.0 / (real_t)chunk_size;
 
-	// Make vertices.
+	// Row-major, so shaders can also get the grid point from VERTEX_ID, see chunk_mesh.h.
 	for (int iz = 0; iz < num_points; ++iz) {
 		for (int ix = 0; ix < num_points; ++ix) {
-			real_t x = ix * s;
-			real_t z = iz * s;
-			vertices.set(ix + iz * num_points, Vector3(x, 0.0, z));
+			*vertex++ = Vector3(ix * s, 0.0, iz * s);
 		}
 	}
 
+	// Banded for the vertex cache. The server stores 16 bit indices up to 65536 vertices.
+	const int index_count = chunk_mesh_index_count(chunk_size);
 	PackedInt32Array indices;
-	indices.resize(6 * chunk_size * chunk_size);
-	bool tri_a = true;
-	int index = 0;
-
-	for (int iz = 0; iz < chunk_size; ++iz) {
-		for (int ix = 0; ix < chunk_size; ++ix) {
-			const int i1 = ix + num_points * iz;
-			const int i2 = i1 + 1;
-			const int i3 = i1 + num_points;
-			const int i4 = i3 + 1;
-
-			if (tri_a) {
-				indices.set(index++, i1);
-				indices.set(index++, i2);
-				indices.set(index++, i3);
-				indices.set(index++, i2);
-				indices.set(index++, i4);
-				indices.set(index++, i3);
-			} else {
-				indices.set(index++, i1);
-				indices.set(index++, i2);
-				indices.set(index++, i4);
-				indices.set(index++, i1);
-				indices.set(index++, i4);
-				indices.set(index++, i3);
-			}
-
-			tri_a = !tri_a;
-		}
-
-		tri_a = !tri_a;
+	indices.resize(index_count);
+	chunk_mesh_build_indices(chunk_size, chunk_mesh_band_quads(CHUNK_MESH_CACHE_SIZE), indices.ptrw());
+
+	if (is_print_verbose_enabled()) {
+		PackedInt32Array row_major;
+		row_major.resize(index_count);
+		chunk_mesh_build_indices(chunk_size, chunk_size, row_major.ptrw());
+		print_verbose(vformat("Terrainer: chunk mesh ACMR %.3f, %.3f in row-major order (%d entry FIFO cache).",
+				chunk_mesh_acmr(indices.ptr(), index_count, vertex_count, CHUNK_MESH_CACHE_SIZE),
+				chunk_mesh_acmr(row_major.ptr(), index_count, vertex_count, CHUNK_MESH_CACHE_SIZE), CHUNK_MESH_CACHE_SIZE));
 	}
 
 	RenderingServer *const rs = RenderingServer::get_singleton();
@@ -496,7 +970,19 @@ void Terrain::_create_mesh() {
 // 	}
 }
 
+void Terrain::_update_screen_error_scale() {
+	// Same factor for both projections, only perspective divides by the distance.
+	Viewport *viewport = camera->get_viewport();
+	const real_t height = viewport ? viewport->get_visible_rect().size.y : 0.0;
+	const Projection projection = camera->get_camera_projection();
+	quad_tree.screen_error_scale = 0.5 * height * projection.columns[1][1];
+	quad_tree.screen_error_orthogonal = projection.is_orthogonal();
+}
+
 void Terrain::_set_lod_levels() {
+	// Sectors may change size.
+	active_sectors.clear();
+
 	if (!camera || storage_status != OK) {
 		return;
 	}
@@ -762,6 +1248,11 @@ Terrain::Terrain() {
 	rs->multimesh_set_mesh(mm_chunks, mesh);
 	mm_instance = rs->instance_create();
 	rs->instance_set_base(mm_instance, mm_chunks);
+	mm_shadow_chunks = rs->multimesh_create();
+	rs->multimesh_set_mesh(mm_shadow_chunks, mesh);
+	mm_shadow_instance = rs->instance_create();
+	rs->instance_set_base(mm_shadow_instance, mm_shadow_chunks);
+	rs->instance_geometry_set_cast_shadows_setting(mm_shadow_instance, RenderingServer::SHADOW_CASTING_SETTING_SHADOWS_ONLY);
 	set_notify_transform(true);
 	set_process_internal(true);
 
@@ -778,6 +1269,8 @@ Terrain::~Terrain() {
 	RenderingServer *const rs = RenderingServer::get_singleton();
 	rs->free_rid(mm_instance);
 	rs->free_rid(mm_chunks);
+	rs->free_rid(mm_shadow_instance);
+	rs->free_rid(mm_shadow_chunks);
 	rs->free_rid(mesh);
 
 	if (debug_nodes_aabb_enabled) {
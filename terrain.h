@@ -12,18 +12,22 @@
 #ifndef TERRAINER_TERRAIN_H
 #define TERRAINER_TERRAIN_H
 
+#include "chunk_instance.h"
 #include "lod_quad_tree.h"
 #include "map_storage/map_storage.h"
+#include "terrain_collision.h"
 // #include "terrain_info.h"
 
 #ifdef TERRAINER_MODULE
 #include "scene/3d/node_3d.h"
 #include "scene/3d/camera_3d.h"
+#include "scene/3d/light_3d.h"
 #include "scene/resources/mesh.h"
 #endif // TERRAINER_MODULE
 
 #ifdef TERRAINER_GDEXTENSION
 #include <godot_cpp/classes/camera3d.hpp>
+#include <godot_cpp/classes/directional_light3d.hpp>
 #include <godot_cpp/classes/node3d.hpp>
 #include <godot_cpp/classes/shader_material.hpp>
 #endif // TERRAINER_GDEXTENSION
@@ -35,12 +39,24 @@ using CellKey = MapStorage::CellKey;
 class Terrain : public Node3D {
     GDCLASS(Terrain, Node3D);
 
+public:
+    enum LODMode {
+        LOD_MODE_DISTANCE, // Fixed distance rings.
+        LOD_MODE_SCREEN_ERROR, // Projected node geometric error.
+        LOD_MODE_MAX
+    };
+
 private:
     static constexpr real_t UPDATE_TOLERANCE_FACTOR = 0.05;
 
 //     static const int DIRTY_DATA = 1 << 1;
 //     static const int DIRTY_CHUNKS = 1 << 2;
 
+    static const int MIN_INSTANCE_CAPACITY = 64;
+    static const int INSTANCE_BLOCK_SIZE = 256; // Instances encoded by each parallel task.
+    static const int MAX_SHADOW_CASCADES = 4;
+    static constexpr real_t SHADOW_CASCADE_LOD_FACTOR = 0.75; // LOD bias of a cascade relative to the one before.
+
     static constexpr real_t DEBUG_AABB_LOD0_MARGIN = 2.0;
     static constexpr real_t DEBUG_AABB_MARGIN_LOD_SCALE_FACTOR = 0.5;
 
@@ -54,8 +70,26 @@ private:
     RID mesh;
     RID mm_chunks;
     RID mm_instance;
+    RID mm_shadow_chunks;
+    RID mm_shadow_instance;
+
+    // Instance data of a multimesh, kept between updates. The multimesh is reallocated
+    // only to grow, doubling its capacity, and each update uploads the buffer at once.
+    struct InstanceBuffer {
+        PackedFloat32Array data;
+        int capacity = 0;
+        int stride = 0; // Floats per instance.
+    };
+
+    InstanceBuffer mm_chunks_buffer;
+    InstanceBuffer mm_shadow_buffer;
+    // Selected nodes drawn by the last update and their texture layers.
+    LocalVector<uint32_t> instance_nodes;
+    LocalVector<int> instance_layers;
+    float *instance_data = nullptr; // Only while encoding.
 
     LODQuadTree quad_tree;
+    TerrainCollision collision;
     Transform3D last_transform;
     bool inside_world = false;
     Camera3D *camera = nullptr;
@@ -66,6 +100,33 @@ private:
     bool dirty = false;
 
     real_t update_distance_tolerance_squared = 1.0;
+    real_t origin_rebase_distance = 0.0; // 0 to never rebase automatically.
+
+    struct SectorDistance {
+        CellKey sector;
+        real_t distance_squared = 0.0;
+
+        bool operator<(const SectorDistance &p_other) const { return distance_squared < p_other.distance_squared; }
+    };
+
+    LocalVector<SectorDistance> sector_order;
+    // Sectors within the view distance at the last update, tagged with that update. Only
+    // sectors entering or leaving it change the set, loading starts when they enter.
+    HashMap<CellKey, uint64_t> active_sectors;
+    LocalVector<CellKey> sector_exits;
+    uint64_t sector_update_frame = 0;
+    LocalVector<LODQuadTree::SectorSelection> sector_selections;
+
+    // Shadow casters of a directional light, selected per cascade and drawn shadows only,
+    // so shadows never come from the camera selection. The one shadow instance goes into
+    // every cascade, so the cascades are merged into a single set of casters.
+    ObjectID shadow_light;
+    Vector3 shadow_light_direction;
+    real_t shadow_lod_bias = 0.5;
+    LODQuadTree::SelectionView shadow_views[MAX_SHADOW_CASCADES];
+    int shadow_cascade_count = 0;
+    LocalVector<LODQuadTree::SectorSelection> shadow_selections;
+    LocalVector<LODQuadTree::QTNode> shadow_nodes;
 
 
     struct DebugAABB {
@@ -85,10 +146,17 @@ private:
     void _update_transform();
     void _update_viewer(double p_delta);
     void _update_chunks();
+    void _update_shadow_views();
+    void _update_shadow_chunks();
+    float *_reserve_instances(RID p_multimesh, InstanceBuffer &r_buffer, int p_count, bool p_use_custom_data);
+    void _upload_instances(RID p_multimesh, const InstanceBuffer &p_buffer, int p_count);
+    _FORCE_INLINE_ static void _write_instance_transform(float *p_dst, const Transform3D &p_transform);
+    static void _encode_instances_task(void *p_terrain, uint32_t p_block);
 
     void _set_viewport_camera();
     void _create_mesh();
     void _set_lod_levels();
+    _FORCE_INLINE_ void _update_screen_error_scale();
     void _storage_changed();
     void _storage_path_changed();
     _FORCE_INLINE_ void _set_update_distance_tolerance_squared();
@@ -107,6 +175,7 @@ protected:
 
 public:
     void set_camera(Camera3D *p_camera);
+    void set_shadow_light(DirectionalLight3D *p_light);
 
     void set_storage(const Ref<MapStorage> &p_storage);
     Ref<MapStorage> get_storage() const;
@@ -120,11 +189,45 @@ public:
     int get_lod_detailed_chunks_radius() const;
     void set_lod_distance_ratio(real_t p_ratio);
     real_t get_lod_distance_ratio() const;
+    void set_lod_occlusion_culling(bool p_enabled);
+    bool is_lod_occlusion_culling() const;
+    void set_lod_parallel_selection(bool p_enabled);
+    bool is_lod_parallel_selection() const;
+    void set_lod_incremental_selection(bool p_enabled);
+    bool is_lod_incremental_selection() const;
+    void set_lod_node_budget(int p_nodes);
+    int get_lod_node_budget() const;
+    void set_lod_mode(LODMode p_mode);
+    LODMode get_lod_mode() const;
+    void set_lod_max_screen_error(real_t p_pixels);
+    real_t get_lod_max_screen_error() const;
 
     int info_get_lod_levels() const;
     int info_get_lod_nodes_count(int p_level) const;
     int info_get_selected_nodes_count() const;
 
+    void set_shadow_lod_bias(real_t p_bias);
+    real_t get_shadow_lod_bias() const;
+    int info_get_shadow_cascade_count() const;
+    int info_get_shadow_nodes_count(int p_cascade) const;
+
+    Vector3 rebase_origin(const Vector3 &p_position);
+    Vector2i get_origin_chunk() const;
+    void set_origin_rebase_distance(real_t p_distance);
+    real_t get_origin_rebase_distance() const;
+
+    PackedByteArray get_visibility(const PackedVector3Array &p_from, const PackedVector3Array &p_to) const;
+
+    void add_collision_body(Node3D *p_body);
+    void remove_collision_body(Node3D *p_body);
+    void set_collision_radius(int p_tiles);
+    int get_collision_radius() const;
+    void set_collision_layer(uint32_t p_layer);
+    uint32_t get_collision_layer() const;
+    void set_collision_mask(uint32_t p_mask);
+    uint32_t get_collision_mask() const;
+    int info_get_collision_tiles_count() const;
+
     void set_debug_nodes_aabb_enabled(bool p_enabled);
     bool is_debug_nodes_aabb_enabled() const;
 
@@ -132,6 +235,8 @@ public:
     ~Terrain();
 };
 
+VARIANT_ENUM_CAST(Terrain::LODMode);
+
 } // namespace Terrainer
 
 #endif // TERRAINER_TERRAIN_H
\ No newline at end of file
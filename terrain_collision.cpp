@@ -0,0 +1,333 @@
+/**
+ * terrain_collision.cpp
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#include "terrain_collision.h"
+
+#ifdef TERRAINER_MODULE
+#include "scene/3d/node_3d.h"
+#endif // TERRAINER_MODULE
+
+#ifdef TERRAINER_GDEXTENSION
+#include <godot_cpp/classes/node3d.hpp>
+#endif // TERRAINER_GDEXTENSION
+
+using namespace Terrainer;
+
+void TerrainCollision::_build_task(void *p_collision, uint32_t p_index) {
+    TerrainCollision *collision = static_cast<TerrainCollision *>(p_collision);
+    TileBuild &build = collision->builds[p_index];
+    const int chunk_size = collision->storage->get_chunk_size();
+    const int samples = (chunk_size >> build.lod) + 1;
+    const Vector3 &scale = collision->map_scale;
+    const Rect2 rect = Rect2(build.key.cell.x * chunk_size * scale.x, build.key.cell.z * chunk_size * scale.z, chunk_size * scale.x, chunk_size * scale.z);
+    LocalVector<float> heights;
+    heights.resize(samples * samples);
+    collision->storage->get_heights_rect(rect, Vector2i(samples, samples), heights.ptr(), false);
+
+    build.heights.resize(heights.size());
+    real_t *w = build.heights.ptrw();
+    real_t min_height = heights[0];
+    real_t max_height = heights[0];
+
+    for (uint32_t i = 0; i < heights.size(); ++i) {
+        w[i] = heights[i];
+        min_height = MIN(min_height, w[i]);
+        max_height = MAX(max_height, w[i]);
+    }
+
+    build.min_height = min_height;
+    build.max_height = max_height;
+}
+
+TerrainCollision::TileBody TerrainCollision::_acquire_body() {
+    if (!pool.is_empty()) {
+        TileBody body = pool[pool.size() - 1];
+        pool.resize(pool.size() - 1);
+        return body;
+    }
+
+    PhysicsServer3D *ps = PhysicsServer3D::get_singleton();
+    TileBody body;
+    body.body = ps->body_create();
+    body.shape = ps->heightmap_shape_create();
+    ps->body_set_mode(body.body, PhysicsServer3D::BODY_MODE_STATIC);
+    ps->body_add_shape(body.body, body.shape);
+    ps->body_set_collision_layer(body.body, collision_layer);
+    ps->body_set_collision_mask(body.body, collision_mask);
+    return body;
+}
+
+void TerrainCollision::_release_body(TileBody &p_body) {
+    if (!p_body.body.is_valid()) {
+        return;
+    }
+
+    PhysicsServer3D *ps = PhysicsServer3D::get_singleton();
+    ps->body_set_space(p_body.body, RID());
+
+    if (pool.size() < MAX_POOLED_BODIES) {
+        pool.push_back(p_body);
+    } else {
+        ps->free_rid(p_body.body);
+        ps->free_rid(p_body.shape);
+    }
+
+    p_body = TileBody();
+}
+
+_FORCE_INLINE_ Transform3D TerrainCollision::_get_tile_transform(CellKey p_key, int p_lod) const {
+    // Heightmap shapes are centered, with one unit between samples.
+    const int chunk_size = storage->get_chunk_size();
+    const real_t step = real_t(1 << p_lod);
+    const real_t x = real_t(int64_t(p_key.cell.x) - origin_chunk.x) + 0.5;
+    const real_t z = real_t(int64_t(p_key.cell.z) - origin_chunk.y) + 0.5;
+    const Vector3 center = Vector3(x * chunk_size * map_scale.x, 0.0, z * chunk_size * map_scale.z);
+    const Basis basis = Basis::from_scale(Vector3(step * map_scale.x, 1.0, step * map_scale.z));
+    return Transform3D(basis, center);
+}
+
+void TerrainCollision::set_space(RID p_space) {
+    if (space == p_space) {
+        return;
+    }
+
+    space = p_space;
+    PhysicsServer3D *ps = PhysicsServer3D::get_singleton();
+
+    for (KeyValue<CellKey, Tile> &kv : tiles) {
+        if (kv.value.body.body.is_valid()) {
+            ps->body_set_space(kv.value.body.body, space);
+        }
+    }
+}
+
+void TerrainCollision::add_body(ObjectID p_body) {
+    if (bodies.find(p_body) < 0) {
+        bodies.push_back(p_body);
+    }
+}
+
+void TerrainCollision::remove_body(ObjectID p_body) {
+    bodies.erase(p_body);
+}
+
+void TerrainCollision::set_radius(int p_tiles) {
+    ERR_FAIL_COND(p_tiles < 0);
+    radius = p_tiles;
+}
+
+void TerrainCollision::set_collision_layer(uint32_t p_layer) {
+    collision_layer = p_layer;
+    PhysicsServer3D *ps = PhysicsServer3D::get_singleton();
+
+    for (KeyValue<CellKey, Tile> &kv : tiles) {
+        if (kv.value.body.body.is_valid()) {
+            ps->body_set_collision_layer(kv.value.body.body, collision_layer);
+        }
+    }
+
+    for (const TileBody &body : pool) {
+        ps->body_set_collision_layer(body.body, collision_layer);
+    }
+}
+
+void TerrainCollision::set_collision_mask(uint32_t p_mask) {
+    collision_mask = p_mask;
+    PhysicsServer3D *ps = PhysicsServer3D::get_singleton();
+
+    for (KeyValue<CellKey, Tile> &kv : tiles) {
+        if (kv.value.body.body.is_valid()) {
+            ps->body_set_collision_mask(kv.value.body.body, collision_mask);
+        }
+    }
+
+    for (const TileBody &body : pool) {
+        ps->body_set_collision_mask(body.body, collision_mask);
+    }
+}
+
+void TerrainCollision::update(const Ref<MapStorage> &p_storage, const Vector3 &p_map_scale, const Vector2i &p_origin_chunk) {
+    finish_builds();
+    frame++;
+
+    if (p_storage.is_null() || !space.is_valid()) {
+        return;
+    }
+
+    if (storage != p_storage || map_scale != p_map_scale || origin_chunk != p_origin_chunk) {
+        clear();
+        storage = p_storage;
+        map_scale = p_map_scale;
+        origin_chunk = p_origin_chunk;
+    }
+
+    const int chunk_size = storage->get_chunk_size();
+    const real_t tile_x = chunk_size * map_scale.x;
+    const real_t tile_z = chunk_size * map_scale.z;
+    int max_lod = 0;
+
+    // Keep at least two cells per side.
+    while ((chunk_size >> (max_lod + 1)) >= 2) {
+        max_lod++;
+    }
+
+    // Tiles wanted by the bodies, with the finest LOD any of them needs.
+    wanted.clear();
+
+    for (uint32_t i = 0; i < bodies.size();) {
+        Node3D *node = Object::cast_to<Node3D>(ObjectDB::get_instance(bodies[i]));
+
+        if (!node || !node->is_inside_tree()) {
+            bodies.remove_at_unordered(i);
+            continue;
+        }
+
+        const Vector3 p = node->get_global_position();
+        const int cx = int(Math::floor(p.x / tile_x)) + origin_chunk.x;
+        const int cz = int(Math::floor(p.z / tile_z)) + origin_chunk.y;
+
+        for (int dz = -radius; dz <= radius; ++dz) {
+            for (int dx = -radius; dx <= radius; ++dx) {
+                const int x = cx + dx;
+                const int z = cz + dz;
+
+                if (x < 0 || z < 0 || x >= MapStorage::CELL_LIMIT || z >= MapStorage::CELL_LIMIT) {
+                    continue;
+                }
+
+                // One LOD coarser each time the distance doubles.
+                const int distance = MAX(ABS(dx), ABS(dz));
+                int lod = 0;
+
+                while ((2 << lod) <= distance && lod < max_lod) {
+                    lod++;
+                }
+
+                const CellKey key = CellKey(x, z);
+                int *current = wanted.getptr(key);
+
+                if (current) {
+                    *current = MIN(*current, lod);
+                } else {
+                    wanted.insert(key, lod);
+                }
+            }
+        }
+
+        i++;
+    }
+
+    // Drop the tiles no body has needed for a while.
+    LocalVector<CellKey> unused;
+
+    for (KeyValue<CellKey, Tile> &kv : tiles) {
+        if (wanted.has(kv.key)) {
+            kv.value.wanted_frame = frame;
+        } else if (frame - kv.value.wanted_frame > RETIRE_FRAMES) {
+            unused.push_back(kv.key);
+        }
+    }
+
+    for (const CellKey &key : unused) {
+        _release_body(tiles[key].body);
+        tiles.erase(key);
+    }
+
+    // Queue missing, stale and LOD changed tiles.
+    builds.clear();
+
+    for (const KeyValue<CellKey, int> &kv : wanted) {
+        if (builds.size() >= MAX_BUILDS_PER_UPDATE) {
+            break;
+        }
+
+        Tile &tile = tiles[kv.key];
+        tile.wanted_frame = frame;
+        const bool stale = tile.lod >= 0 && frame - tile.built_frame > REFRESH_FRAMES;
+
+        if (tile.lod != kv.value || stale) {
+            TileBuild build;
+            build.key = kv.key;
+            build.lod = kv.value;
+            builds.push_back(build);
+            tile.building_lod = kv.value;
+        }
+    }
+
+    if (!builds.is_empty()) {
+        build_group = WorkerThreadPool::get_singleton()->add_native_group_task(_build_task, this, builds.size(), -1, false, SNAME("Terrainer collision tiles"));
+    }
+}
+
+void TerrainCollision::finish_builds() {
+    if (build_group < 0) {
+        return;
+    }
+
+    WorkerThreadPool::get_singleton()->wait_for_group_task_completion(build_group);
+    build_group = -1;
+    PhysicsServer3D *ps = PhysicsServer3D::get_singleton();
+
+    for (TileBuild &build : builds) {
+        Tile *tile = tiles.getptr(build.key);
+
+        if (!tile || tile->building_lod != build.lod) {
+            continue;
+        }
+
+        // Fill a fresh body, then swap it with the current one.
+        const int samples = (storage->get_chunk_size() >> build.lod) + 1;
+        TileBody body = _acquire_body();
+        Dictionary data;
+        data["width"] = samples;
+        data["depth"] = samples;
+        data["heights"] = build.heights;
+        data["min_height"] = build.min_height;
+        data["max_height"] = build.max_height;
+        ps->shape_set_data(body.shape, data);
+        ps->body_set_state(body.body, PhysicsServer3D::BODY_STATE_TRANSFORM, _get_tile_transform(build.key, build.lod));
+        ps->body_set_space(body.body, space);
+        _release_body(tile->body);
+        tile->body = body;
+        tile->lod = build.lod;
+        tile->building_lod = -1;
+        tile->built_frame = frame;
+    }
+
+    builds.clear();
+}
+
+void TerrainCollision::clear() {
+    if (build_group >= 0) {
+        WorkerThreadPool::get_singleton()->wait_for_group_task_completion(build_group);
+        build_group = -1;
+    }
+
+    builds.clear();
+
+    for (KeyValue<CellKey, Tile> &kv : tiles) {
+        _release_body(kv.value.body);
+    }
+
+    tiles.clear();
+    PhysicsServer3D *ps = PhysicsServer3D::get_singleton();
+
+    for (const TileBody &body : pool) {
+        ps->free_rid(body.body);
+        ps->free_rid(body.shape);
+    }
+
+    pool.clear();
+}
+
+TerrainCollision::~TerrainCollision() {
+    clear();
+}
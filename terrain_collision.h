@@ -0,0 +1,119 @@
+/**
+ * terrain_collision.h
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#ifndef TERRAINER_TERRAIN_COLLISION_H
+#define TERRAINER_TERRAIN_COLLISION_H
+
+#include "map_storage/map_storage.h"
+
+#ifdef TERRAINER_MODULE
+#include "core/object/worker_thread_pool.h"
+#include "servers/physics_server_3d.h"
+#endif // TERRAINER_MODULE
+
+#ifdef TERRAINER_GDEXTENSION
+#include <godot_cpp/classes/physics_server3d.hpp>
+#include <godot_cpp/classes/worker_thread_pool.hpp>
+#endif // TERRAINER_GDEXTENSION
+
+namespace Terrainer {
+
+using CellKey = MapStorage::CellKey;
+
+/**
+ *
+ * TerrainCollision
+ * Streams HeightMapShape3D tiles around registered physics bodies.
+ * Features:
+ *   - One tile per chunk, only within a radius of each registered body
+ *   - Tiles kept for a while after the bodies leave, so bodies going back and forth reuse them
+ *   - Coarser sample spacing for tiles further from the bodies
+ *   - Heights sampled from the storage on worker threads, during the frame
+ *   - Static bodies and shapes reused from a pool, new tiles swapped in before the old ones leave
+ *
+ * Builds run between update() and the next finish_builds(), which must bracket
+ * any MapStorage mutation (process, allocate_buffers, minmax and texture requests).
+ */
+class TerrainCollision {
+private:
+    static const int MAX_BUILDS_PER_UPDATE = 16;
+    static const int MAX_POOLED_BODIES = 64;
+    static const uint64_t REFRESH_FRAMES = 120; // Rebuild tiles to pick up newly streamed heights.
+    static const uint64_t RETIRE_FRAMES = 60; // Unwanted tiles are dropped after this many frames.
+
+    struct TileBody {
+        RID body;
+        RID shape;
+    };
+
+    struct Tile {
+        TileBody body;
+        int lod = -1;
+        int building_lod = -1;
+        uint64_t built_frame = 0;
+        uint64_t wanted_frame = 0;
+    };
+
+    struct TileBuild {
+        CellKey key;
+        int lod = 0;
+        Vector<real_t> heights;
+        real_t min_height = 0.0;
+        real_t max_height = 0.0;
+    };
+
+    Ref<MapStorage> storage;
+    RID space;
+    LocalVector<ObjectID> bodies;
+    HashMap<CellKey, Tile> tiles;
+    HashMap<CellKey, int> wanted;
+    LocalVector<TileBody> pool;
+    LocalVector<TileBuild> builds;
+    WorkerThreadPool::GroupID build_group = -1;
+
+    int radius = 2; // In tiles.
+    uint32_t collision_layer = 1;
+    uint32_t collision_mask = 1;
+    Vector3 map_scale = Vector3(1.0, 1.0, 1.0);
+    Vector2i origin_chunk; // Chunk at the world origin, tiles are placed relative to it.
+    uint64_t frame = 0;
+
+    static void _build_task(void *p_collision, uint32_t p_index);
+    TileBody _acquire_body();
+    void _release_body(TileBody &p_body);
+    _FORCE_INLINE_ Transform3D _get_tile_transform(CellKey p_key, int p_lod) const;
+
+public:
+    void set_space(RID p_space);
+    void add_body(ObjectID p_body);
+    void remove_body(ObjectID p_body);
+
+    void set_radius(int p_tiles);
+    int get_radius() const { return radius; }
+    void set_collision_layer(uint32_t p_layer);
+    uint32_t get_collision_layer() const { return collision_layer; }
+    void set_collision_mask(uint32_t p_mask);
+    uint32_t get_collision_mask() const { return collision_mask; }
+
+    // Start building the tiles the bodies need. Call after MapStorage::process().
+    void update(const Ref<MapStorage> &p_storage, const Vector3 &p_map_scale, const Vector2i &p_origin_chunk);
+    // Wait for the builds started by update() and swap them in.
+    void finish_builds();
+    void clear();
+
+    int get_tile_count() const { return tiles.size(); }
+
+    ~TerrainCollision();
+};
+
+} // namespace Terrainer
+
+#endif // TERRAINER_TERRAIN_COLLISION_H
@@ -0,0 +1,91 @@
+/**
+ * test_chunk_instance.h
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#ifndef TERRAINER_TEST_CHUNK_INSTANCE_H
+#define TERRAINER_TEST_CHUNK_INSTANCE_H
+
+// Module defines, written by SCsub for the test build.
+#include "test_defines.gen.h"
+
+#include "../chunk_instance.h"
+
+#include "tests/test_macros.h"
+
+#include <cmath>
+
+namespace TestTerrainer {
+
+using Terrainer::ChunkInstance;
+
+TEST_CASE("[Terrainer][ChunkInstance] Encode and decode round trip") {
+    const int layers[] = { 0, 1, 255, 256, 0x7FFF, 0x8000, 0xFFFE, ChunkInstance::MAX_TEXTURE_LAYER };
+    float custom[ChunkInstance::CUSTOM_FLOATS];
+
+    for (int layer : layers) {
+        for (int flags = 0; flags <= UINT8_MAX; ++flags) {
+            ChunkInstance::encode(custom, layer, uint8_t(flags), 3.0f, 0.015625f);
+            int decoded_layer = -1;
+            uint8_t decoded_flags = 0;
+            float c1 = 0.0f;
+            float c2 = 0.0f;
+            ChunkInstance::decode(custom, decoded_layer, decoded_flags, c1, c2);
+
+            CHECK_MESSAGE(decoded_layer == layer, vformat("Layer %d with flags %d decoded as %d.", layer, flags, decoded_layer));
+            CHECK_MESSAGE(decoded_flags == flags, vformat("Flags %d with layer %d decoded as %d.", flags, layer, int(decoded_flags)));
+            CHECK(c1 == 3.0f);
+            CHECK(c2 == 0.015625f);
+            CHECK(custom[3] == 0.0f);
+        }
+    }
+}
+
+TEST_CASE("[Terrainer][ChunkInstance] Packed bits are a normal float") {
+    const int layers[] = { 0, 1, 0x00FF, 0xFF00, ChunkInstance::MAX_TEXTURE_LAYER };
+    float custom[ChunkInstance::CUSTOM_FLOATS];
+
+    // Zero, denormal, infinite and NaN bits could be flushed or changed by a copy as float.
+    for (int layer : layers) {
+        for (int flags = 0; flags <= UINT8_MAX; ++flags) {
+            ChunkInstance::encode(custom, layer, uint8_t(flags), 1.0f, 1.0f);
+            const float packed = custom[2];
+            CHECK_MESSAGE(std::fpclassify(packed) == FP_NORMAL, vformat("Layer %d with flags %d doesn't pack to a normal float.", layer, flags));
+
+            // Copied through float arithmetic, the bits must stay the same.
+            volatile float copy = packed;
+            float copied[ChunkInstance::CUSTOM_FLOATS] = { custom[0], custom[1], copy * 1.0f, custom[3] };
+            int decoded_layer = -1;
+            uint8_t decoded_flags = 0;
+            float c1 = 0.0f;
+            float c2 = 0.0f;
+            ChunkInstance::decode(copied, decoded_layer, decoded_flags, c1, c2);
+            CHECK(decoded_layer == layer);
+            CHECK(decoded_flags == flags);
+        }
+    }
+}
+
+TEST_CASE("[Terrainer][ChunkInstance] Out of range layers are masked") {
+    float custom[ChunkInstance::CUSTOM_FLOATS];
+    int layer = -1;
+    uint8_t flags = 0;
+    float c1 = 0.0f;
+    float c2 = 0.0f;
+
+    // Layers over 16 bits don't spill into the flags.
+    ChunkInstance::encode(custom, 0x10001, 0x5A, 0.0f, 0.0f);
+    ChunkInstance::decode(custom, layer, flags, c1, c2);
+    CHECK(layer == 1);
+    CHECK(flags == 0x5A);
+}
+
+} // namespace TestTerrainer
+
+#endif // TERRAINER_TEST_CHUNK_INSTANCE_H
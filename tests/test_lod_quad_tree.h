@@ -0,0 +1,571 @@
+/**
+ * test_lod_quad_tree.h
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#ifndef TERRAINER_TEST_LOD_QUAD_TREE_H
+#define TERRAINER_TEST_LOD_QUAD_TREE_H
+
+// Module defines, written by SCsub for the test build.
+#include "test_defines.gen.h"
+
+#include "../lod_quad_tree.h"
+#include "../utils/math.h"
+
+#include "core/math/projection.h"
+#include "core/object/worker_thread_pool.h"
+#include "core/os/os.h"
+#include "tests/test_macros.h"
+
+namespace Terrainer {
+
+/**
+ *
+ * TestLODQuadTree
+ * Checks the iterative selection against the recursive one it replaced, which tests
+ * every node on its own, with all eight corners against every frustum plane. Both
+ * must select the same nodes, in the same order, with or without the incremental
+ * and parallel paths.
+ */
+class TestLODQuadTree {
+public:
+    using QTNode = LODQuadTree::QTNode;
+    using NodeSelectionResult = LODQuadTree::NodeSelectionResult;
+    using SectorSelection = LODQuadTree::SectorSelection;
+
+    static const int CHUNK_SIZE = 32;
+    static const int REGION_SIZE = 4;
+    static constexpr real_t FAR_VIEW = 1000.0;
+    static const int DETAILED_CHUNKS_RADIUS = 2;
+
+    // 36 x 20 chunks, so the last column and row of sectors are partly out of the map.
+    static Vector2i get_world_regions() { return Vector2i(9, 5); }
+    // Heights scale exactly, so child boxes are never rounded out of their parent.
+    static Vector3 get_map_scale() { return Vector3(1.0, 0.25, 1.0); }
+    static CellKey get_sector_without_data() { return CellKey(2, 1); }
+    // 64 x 64 chunks, enough sectors to fill the view distance, still all resident.
+    static Vector2i get_benchmark_world_regions() { return Vector2i(16, 16); }
+
+    static void setup(LODQuadTree &r_tree, const Ref<MapStorage> &p_storage, MapStorage::MinmaxLayout p_layout, const Vector2i &p_world_regions = get_world_regions()) {
+        p_storage->set_chunk_size(CHUNK_SIZE);
+        p_storage->set_region_size(REGION_SIZE);
+        p_storage->set_minmax_layout(p_layout);
+        r_tree.set_map_info(CHUNK_SIZE, REGION_SIZE, p_world_regions, get_map_scale());
+        const int num_nodes = r_tree.set_lod_levels(FAR_VIEW, DETAILED_CHUNKS_RADIUS);
+        p_storage->allocate_buffers(r_tree.sector_size, num_nodes, r_tree.lod_levels, get_map_scale(), FAR_VIEW);
+
+        // Rolling heights with noise, every chunk holding a different range.
+        const int sector_size = r_tree.sector_size;
+        LocalVector<hmap_t> minmax;
+        minmax.resize(2 * sector_size * sector_size);
+
+        for (MapStorage::cell_t sz = 0; sz < r_tree.sector_count_z; ++sz) {
+            for (MapStorage::cell_t sx = 0; sx < r_tree.sector_count_x; ++sx) {
+                if (CellKey(sx, sz) == get_sector_without_data()) {
+                    continue;
+                }
+
+                for (int iz = 0; iz < sector_size; ++iz) {
+                    for (int ix = 0; ix < sector_size; ++ix) {
+                        const int x = sx * sector_size + ix;
+                        const int z = sz * sector_size + iz;
+                        const uint32_t noise = hash_murmur3_one_32(x, hash_murmur3_one_32(z));
+                        const int base = 2000 + int(1200.0 * Math::sin(x * 0.37) * Math::cos(z * 0.23)) + int(noise % 400);
+                        minmax[2 * (ix + iz * sector_size)] = hmap_t(base - int((noise >> 9) % 60));
+                        minmax[2 * (ix + iz * sector_size) + 1] = hmap_t(base + 40 + int((noise >> 17) % 90));
+                    }
+                }
+
+                CHECK(p_storage->set_sector_minmax(CellKey(sx, sz), minmax.ptr()));
+            }
+        }
+    }
+
+    static void set_modes(LODQuadTree &r_tree, bool p_parallel, bool p_incremental, bool p_screen_error) {
+        r_tree.parallel_selection = p_parallel;
+        r_tree.incremental_selection = p_incremental;
+        r_tree.screen_error_mode = p_screen_error;
+        r_tree.max_screen_error = 2.0;
+        r_tree.screen_error_scale = 1080.0 / (2.0 * Math::tan(Math::deg_to_rad(real_t(35.0))));
+    }
+
+    static void set_parallel_tasks(LODQuadTree &r_tree, int p_tasks) {
+        r_tree.parallel_tasks = p_tasks;
+    }
+
+    static void set_node_budget(LODQuadTree &r_tree, int p_budget) {
+        r_tree.node_budget = p_budget;
+    }
+
+    static real_t get_coarsen_distance(const LODQuadTree &p_tree) {
+        return p_tree.coarsen_distance;
+    }
+
+    static int get_selection_count(const LODQuadTree &p_tree) {
+        return p_tree.selection_count;
+    }
+
+    static void set_frustum(LODQuadTree &r_tree, const Vector<Plane> &p_planes) {
+        r_tree.frustum = p_planes;
+    }
+
+    static void get_sectors(const LODQuadTree &p_tree, LocalVector<SectorSelection> &r_sectors) {
+        r_sectors.clear();
+
+        for (MapStorage::cell_t sz = 0; sz < p_tree.sector_count_z; ++sz) {
+            for (MapStorage::cell_t sx = 0; sx < p_tree.sector_count_x; ++sx) {
+                SectorSelection selection;
+                selection.sector = CellKey(sx, sz);
+                // Some sectors stop above LOD 0, like the ones streamed in coarse first.
+                selection.stop_at_lod_level = (sx + sz) % 3 == 2 ? 1 : 0;
+                r_sectors.push_back(selection);
+            }
+        }
+
+        // One past the map, which selects nothing.
+        SectorSelection outside;
+        outside.sector = CellKey(p_tree.sector_count_x, 0);
+        r_sectors.push_back(outside);
+    }
+
+    // Helpers of the recursive selection. The traversal has inlined versions, not
+    // visible from here.
+    static AABB get_node_aabb(const LODQuadTree &p_tree, const NodeKey &p_key, hmap_t p_min_y, hmap_t p_max_y, uint16_t p_size) {
+        const int64_t x = int64_t(p_key.sector.cell.x) * p_tree.sector_size + int64_t(p_key.cell.cell.x) * p_size - p_tree.origin_chunk.x;
+        const int64_t z = int64_t(p_key.sector.cell.z) * p_tree.sector_size + int64_t(p_key.cell.cell.z) * p_size - p_tree.origin_chunk.y;
+        const real_t chunk_x = p_tree.chunk_size * p_tree.map_scale.x;
+        const real_t chunk_z = p_tree.chunk_size * p_tree.map_scale.z;
+        const Vector3 node_size = Vector3(p_size * chunk_x, (p_max_y - p_min_y) * p_tree.map_scale.y, p_size * chunk_z);
+        const Vector3 node_position = Vector3(real_t(x) * chunk_x, p_min_y * p_tree.map_scale.y, real_t(z) * chunk_z);
+        return AABB(node_position, node_size);
+    }
+
+    static LODQuadTree::IntersectType aabb_intersects_frustum(const LODQuadTree &p_tree, const AABB &p_aabb) {
+        int in = 0;
+
+        for (int iplane = 0; iplane < p_tree.frustum.size(); ++iplane) {
+            const Plane plane = p_tree.frustum[iplane];
+            int out = 0;
+
+            for (int icorner = 0; icorner < 8; ++icorner) {
+                if (plane.is_point_over(p_aabb.get_endpoint(icorner))) {
+                    out++;
+                }
+            }
+
+            if (out == 8) {
+                return LODQuadTree::Outside;
+            } else if (out == 0) {
+                in++;
+            }
+        }
+
+        return in == p_tree.frustum.size() ? LODQuadTree::Inside : LODQuadTree::Intersects;
+    }
+
+    static bool needs_refinement(const LODQuadTree &p_tree, const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, const NodeKey &p_key, int p_lod_level, const AABB &p_box, bool p_has_data) {
+        if (p_tree.screen_error_mode && p_has_data) {
+            real_t projected = p_storage->get_node_error(p_key, p_lod_level) * p_tree.map_scale.y * p_tree.screen_error_scale;
+
+            if (!p_tree.screen_error_orthogonal) {
+                const real_t distance = Math::sqrt(aabb_min_distance_sqrd_from_point(p_box, p_viewer_position));
+                projected /= MAX(distance, (real_t)CMP_EPSILON);
+            }
+
+            return projected > p_tree.max_screen_error;
+        }
+
+        return aabb_intersects_sphere(p_box, p_viewer_position, p_tree.lod_visibility_range[p_lod_level - 1]);
+    }
+
+    static NodeSelectionResult lod_select_recursive(const LODQuadTree &p_tree, const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, bool p_parent_inside_frustum, const NodeKey &p_key, uint16_t p_size, int p_lod_level, int p_stop_at_lod_level, LocalVector<QTNode> &r_nodes) {
+        hmap_t min_y = 0;
+        hmap_t max_y = 0;
+        bool has_data = false;
+        p_storage->get_minmax(p_key, p_lod_level, min_y, max_y, has_data);
+        const AABB box = get_node_aabb(p_tree, p_key, min_y, max_y, p_size);
+        const real_t distance_limit = p_tree.screen_error_mode ? p_tree.lod_visibility_range[p_tree.lod_levels - 1] : p_tree.lod_visibility_range[p_lod_level];
+
+        if (!aabb_intersects_sphere(box, p_viewer_position, distance_limit)) {
+            return LODQuadTree::OutOfRange;
+        }
+
+        const LODQuadTree::IntersectType frustum_it = p_parent_inside_frustum ? LODQuadTree::Inside : aabb_intersects_frustum(p_tree, box);
+
+        if (frustum_it == LODQuadTree::Outside) {
+            return LODQuadTree::OutOfFrustum;
+        }
+
+        NodeSelectionResult results[4] = { LODQuadTree::Undefined, LODQuadTree::Undefined, LODQuadTree::Undefined, LODQuadTree::Undefined };
+
+        if (p_lod_level > p_stop_at_lod_level) {
+            const int x = 2 * p_key.cell.cell.x;
+            const int z = 2 * p_key.cell.cell.z;
+            const int half_size = p_size / 2;
+
+            if (needs_refinement(p_tree, p_viewer_position, p_storage, p_key, p_lod_level, box, has_data)) {
+                // Nearest child first.
+                const Vector3 center = box.get_center();
+                const int nearest = (p_viewer_position.x >= center.x ? 1 : 0) | (p_viewer_position.z >= center.z ? 2 : 0);
+
+                for (int i = 0; i < 4; ++i) {
+                    const int child = nearest ^ i;
+                    const CellKey cell = CellKey(x + (child & 1), z + (child >> 1));
+                    results[child] = lod_select_recursive(p_tree, p_viewer_position, p_storage, frustum_it == LODQuadTree::Inside, NodeKey(p_key.sector, cell), half_size, p_lod_level - 1, p_stop_at_lod_level, r_nodes);
+                }
+            } else {
+                const int sector_x = int(p_key.sector.cell.x) * p_tree.sector_size;
+                const int sector_z = int(p_key.sector.cell.z) * p_tree.sector_size;
+
+                if (sector_x + x * half_size >= p_tree.world_size.x || sector_z + z * half_size >= p_tree.world_size.y) {
+                    for (int i = 0; i < 4; ++i) {
+                        results[i] = LODQuadTree::OutOfMap;
+                    }
+                } else {
+                    if (sector_x + (x + 1) * half_size >= p_tree.world_size.x) {
+                        results[1] = LODQuadTree::OutOfMap;
+                        results[3] = LODQuadTree::OutOfMap;
+                    }
+
+                    if (sector_z + (z + 1) * half_size >= p_tree.world_size.y) {
+                        results[2] = LODQuadTree::OutOfMap;
+                        results[3] = LODQuadTree::OutOfMap;
+                    }
+                }
+            }
+        }
+
+        bool selected[4];
+        bool remove[4];
+
+        for (int i = 0; i < 4; ++i) {
+            selected[i] = results[i] == LODQuadTree::Selected;
+            remove[i] = (results[i] & LODQuadTree::RESULT_DISCARD) || selected[i];
+        }
+
+        if (!(remove[0] && remove[1] && remove[2] && remove[3])) {
+            if (has_data) {
+                r_nodes.push_back(QTNode(p_key, p_size, min_y, max_y, p_lod_level, !remove[0], !remove[1], !remove[2], !remove[3]));
+            }
+
+            return LODQuadTree::Selected;
+        }
+
+        return selected[0] || selected[1] || selected[2] || selected[3] ? LODQuadTree::Selected : LODQuadTree::OutOfFrustum;
+    }
+
+    static void select_reference(const LODQuadTree &p_tree, const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, const LocalVector<SectorSelection> &p_sectors, LocalVector<QTNode> &r_nodes) {
+        r_nodes.clear();
+
+        for (const SectorSelection &selection : p_sectors) {
+            if (selection.sector.cell.x >= p_tree.sector_count_x || selection.sector.cell.z >= p_tree.sector_count_z) {
+                continue;
+            }
+
+            lod_select_recursive(p_tree, p_viewer_position, p_storage, false, NodeKey(selection.sector, CellKey()), p_tree.sector_size, p_tree.lod_levels - 1, selection.stop_at_lod_level, r_nodes);
+        }
+    }
+
+    // Select from p_viewer_position both ways and compare.
+    static void check_selection(LODQuadTree &r_tree, const Vector3 &p_viewer_position, const Ref<MapStorage> &p_storage, LocalVector<SectorSelection> &r_sectors, const String &p_case) {
+        LocalVector<QTNode> reference;
+        select_reference(r_tree, p_viewer_position, p_storage, r_sectors, reference);
+        r_tree.select_sectors(p_viewer_position, p_storage, r_sectors.ptr(), r_sectors.size());
+
+        CHECK_MESSAGE(r_tree.selection_count == int(reference.size()), vformat("%s: %d nodes selected, %d expected.", p_case, r_tree.selection_count, reference.size()));
+
+        if (r_tree.selection_count != int(reference.size())) {
+            return;
+        }
+
+        int mismatch = -1;
+
+        for (uint32_t i = 0; i < reference.size() && mismatch < 0; ++i) {
+            const QTNode &a = r_tree.selected_buffer[i];
+            const QTNode &b = reference[i];
+
+            if (!(a.key == b.key) || a.size != b.size || a.min_y != b.min_y || a.max_y != b.max_y || a.flags != b.flags) {
+                mismatch = i;
+            }
+        }
+
+        CHECK_MESSAGE(mismatch < 0, vformat("%s: node %d differs from the recursive selection.", p_case, mismatch));
+    }
+
+    // Both trees must have selected the same nodes.
+    static void check_same_selection(const LODQuadTree &p_tree, const LODQuadTree &p_expected, const String &p_case) {
+        CHECK_MESSAGE(p_tree.selection_count == p_expected.selection_count, vformat("%s: %d nodes selected, %d expected.", p_case, p_tree.selection_count, p_expected.selection_count));
+
+        if (p_tree.selection_count != p_expected.selection_count) {
+            return;
+        }
+
+        int mismatch = -1;
+
+        for (int i = 0; i < p_tree.selection_count && mismatch < 0; ++i) {
+            const QTNode &a = p_tree.selected_buffer[i];
+            const QTNode &b = p_expected.selected_buffer[i];
+
+            if (!(a.key == b.key) || a.size != b.size || a.flags != b.flags) {
+                mismatch = i;
+            }
+        }
+
+        CHECK_MESSAGE(mismatch < 0, vformat("%s: node %d differs from the full selection.", p_case, mismatch));
+    }
+
+    static Vector<Plane> get_perspective_frustum(const Vector3 &p_position, const Vector3 &p_target) {
+        Projection projection;
+        projection.set_perspective(70.0, 16.0 / 9.0, 0.05, FAR_VIEW);
+        return projection.get_projection_planes(Transform3D(Basis(), p_position).looking_at(p_target, Vector3(0.0, 1.0, 0.0)));
+    }
+
+    // A loop around the center of the benchmark map, looking ahead and down.
+    static Vector3 get_benchmark_position(int p_frame, int p_frames) {
+        const real_t t = Math_TAU * p_frame / p_frames;
+        return Vector3(600.0 * Math::cos(t), 450.0 + 100.0 * Math::sin(2.0 * t), 600.0 * Math::sin(t));
+    }
+
+    static Vector<Plane> get_benchmark_frustum(int p_frame, int p_frames) {
+        const Vector3 position = get_benchmark_position(p_frame, p_frames);
+        const real_t t = Math_TAU * p_frame / p_frames;
+        return get_perspective_frustum(position, position + Vector3(-Math::sin(t), -0.4, Math::cos(t)));
+    }
+
+    static Vector<Plane> get_orthogonal_frustum(const Vector3 &p_position) {
+        Projection projection;
+        projection.set_orthogonal(600.0, 1.0, 0.05, FAR_VIEW);
+        return projection.get_projection_planes(Transform3D(Basis(), p_position).looking_at(p_position + Vector3(0.0, -1.0, 0.0), Vector3(0.0, 0.0, -1.0)));
+    }
+};
+
+} // namespace Terrainer
+
+namespace TestTerrainer {
+
+using Terrainer::LODQuadTree;
+using Terrainer::MapStorage;
+using Terrainer::TestLODQuadTree;
+
+TEST_CASE("[Terrainer][LODQuadTree] Iterative selection matches the recursive one") {
+    // Over the map, at its corner, low over the sector without data, and past the map edge.
+    const Vector3 positions[] = {
+        Vector3(0.0, 700.0, 0.0),
+        Vector3(-540.0, 560.0, -290.0),
+        Vector3(60.0, 520.0, -70.0),
+        Vector3(530.0, 900.0, 250.0),
+        Vector3(900.0, 650.0, 100.0),
+    };
+    const MapStorage::MinmaxLayout layouts[] = { MapStorage::MINMAX_LAYOUT_LINEAR, MapStorage::MINMAX_LAYOUT_MORTON };
+
+    for (MapStorage::MinmaxLayout layout : layouts) {
+        LODQuadTree tree;
+        Ref<MapStorage> storage;
+        storage.instantiate();
+        TestLODQuadTree::setup(tree, storage, layout);
+        LocalVector<TestLODQuadTree::SectorSelection> sectors;
+        TestLODQuadTree::get_sectors(tree, sectors);
+
+        for (int mode = 0; mode < 4; ++mode) {
+            const bool parallel = mode & 1;
+            const bool screen_error = mode & 2;
+            TestLODQuadTree::set_modes(tree, parallel, false, screen_error);
+
+            for (int ipos = 0; ipos < int(sizeof(positions) / sizeof(positions[0])); ++ipos) {
+                const Vector3 &position = positions[ipos];
+                const Vector<Plane> frusta[] = {
+                    Vector<Plane>(),
+                    TestLODQuadTree::get_perspective_frustum(position, Vector3(0.0, 500.0, 0.0) + Vector3(1.0, 0.0, 0.5)),
+                    TestLODQuadTree::get_perspective_frustum(position, position + Vector3(-200.0, -300.0, 150.0)),
+                    TestLODQuadTree::get_orthogonal_frustum(position),
+                };
+
+                for (int ifrustum = 0; ifrustum < int(sizeof(frusta) / sizeof(frusta[0])); ++ifrustum) {
+                    TestLODQuadTree::set_frustum(tree, frusta[ifrustum]);
+                    const String name = vformat("Layout %d, parallel %s, screen error %s, position %d, frustum %d", layout, parallel, screen_error, ipos, ifrustum);
+                    TestLODQuadTree::check_selection(tree, position, storage, sectors, name);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("[Terrainer][LODQuadTree] Incremental selection matches the recursive one along a path") {
+    LODQuadTree tree;
+    Ref<MapStorage> storage;
+    storage.instantiate();
+    TestLODQuadTree::setup(tree, storage, MapStorage::MINMAX_LAYOUT_MORTON);
+    LocalVector<TestLODQuadTree::SectorSelection> sectors;
+    TestLODQuadTree::get_sectors(tree, sectors);
+
+    for (int mode = 0; mode < 4; ++mode) {
+        const bool parallel = mode & 1;
+        const bool screen_error = mode & 2;
+        TestLODQuadTree::set_modes(tree, parallel, true, screen_error);
+        const Vector3 direction = Vector3(-0.6, -0.35, -0.7);
+
+        // Small steps reuse most subtrees, the jump and the turn reuse none.
+        for (int frame = 0; frame < 120; ++frame) {
+            Vector3 position = Vector3(450.0 - 7.3 * frame, 600.0 - 1.1 * frame, 200.0 - 2.9 * frame);
+            Vector3 forward = direction;
+
+            if (frame == 60) {
+                position += Vector3(150.0, 0.0, 0.0);
+            }
+
+            if (frame >= 90) {
+                forward = Vector3(0.7, -0.35, 0.6);
+            }
+
+            TestLODQuadTree::set_frustum(tree, TestLODQuadTree::get_perspective_frustum(position, position + forward));
+            const String name = vformat("Parallel %s, screen error %s, frame %d", parallel, screen_error, frame);
+            TestLODQuadTree::check_selection(tree, position, storage, sectors, name);
+        }
+    }
+}
+
+TEST_CASE("[Terrainer][LODQuadTree] Incremental selection matches the full one under a node budget") {
+    Ref<MapStorage> storage;
+    storage.instantiate();
+    const Vector3 start = Vector3(300.0, 450.0, 100.0);
+    const Vector3 direction = Vector3(-0.6, -0.35, -0.7);
+
+    for (int mode = 0; mode < 2; ++mode) {
+        const bool screen_error = mode & 1;
+        LODQuadTree incremental;
+        LODQuadTree full;
+        TestLODQuadTree::setup(full, storage, MapStorage::MINMAX_LAYOUT_MORTON);
+        TestLODQuadTree::setup(incremental, storage, MapStorage::MINMAX_LAYOUT_MORTON);
+        TestLODQuadTree::set_modes(incremental, false, true, screen_error);
+        TestLODQuadTree::set_modes(full, false, false, screen_error);
+        LocalVector<TestLODQuadTree::SectorSelection> sectors;
+        TestLODQuadTree::get_sectors(full, sectors);
+
+        // Under half of what is selected without a limit, so coarsen_distance moves along the path.
+        TestLODQuadTree::set_frustum(full, TestLODQuadTree::get_perspective_frustum(start, start + direction));
+        full.select_sectors(start, storage, sectors.ptr(), sectors.size());
+        const int budget = TestLODQuadTree::get_selection_count(full) * 2 / 5;
+        TestLODQuadTree::set_node_budget(incremental, budget);
+        TestLODQuadTree::set_node_budget(full, budget);
+        int coarsened_frames = 0;
+
+        for (int frame = 0; frame < 90; ++frame) {
+            const Vector3 position = start + Vector3(-4.1 * frame, -1.3 * frame, -3.7 * frame);
+            const Vector<Plane> frustum = TestLODQuadTree::get_perspective_frustum(position, position + direction);
+            TestLODQuadTree::set_frustum(incremental, frustum);
+            TestLODQuadTree::set_frustum(full, frustum);
+            incremental.select_sectors(position, storage, sectors.ptr(), sectors.size());
+            full.select_sectors(position, storage, sectors.ptr(), sectors.size());
+            TestLODQuadTree::check_same_selection(incremental, full, vformat("Screen error %s, frame %d", screen_error, frame));
+            CHECK(TestLODQuadTree::get_coarsen_distance(incremental) == TestLODQuadTree::get_coarsen_distance(full));
+            coarsened_frames += TestLODQuadTree::get_coarsen_distance(full) < Math_INF ? 1 : 0;
+        }
+
+        CHECK_MESSAGE(coarsened_frames > 0, "The node budget was never applied.");
+    }
+}
+
+TEST_CASE("[Terrainer][LODQuadTree][Benchmark] Selection with the linear and Morton minmax layouts") {
+    const MapStorage::MinmaxLayout layouts[] = { MapStorage::MINMAX_LAYOUT_LINEAR, MapStorage::MINMAX_LAYOUT_MORTON };
+    const char *layout_names[] = { "linear", "Morton" };
+    const int frames = 240;
+    OS *os = OS::get_singleton();
+
+    for (int mode = 0; mode < 2; ++mode) {
+        const bool screen_error = mode & 1;
+        String line = vformat("Selection with %s:", screen_error ? "screen space error" : "distance rings");
+        int64_t selected[2] = {};
+
+        for (int ilayout = 0; ilayout < 2; ++ilayout) {
+            LODQuadTree tree;
+            Ref<MapStorage> storage;
+            storage.instantiate();
+            TestLODQuadTree::setup(tree, storage, layouts[ilayout], TestLODQuadTree::get_benchmark_world_regions());
+            LocalVector<TestLODQuadTree::SectorSelection> sectors;
+            TestLODQuadTree::get_sectors(tree, sectors);
+            // Serial and from scratch every frame, so only the minmax reads differ.
+            TestLODQuadTree::set_modes(tree, false, false, screen_error);
+            uint64_t usec = 0;
+
+            for (int frame = 0; frame < frames; ++frame) {
+                const Vector3 position = TestLODQuadTree::get_benchmark_position(frame, frames);
+                TestLODQuadTree::set_frustum(tree, TestLODQuadTree::get_benchmark_frustum(frame, frames));
+                const uint64_t start = os->get_ticks_usec();
+                tree.select_sectors(position, storage, sectors.ptr(), sectors.size());
+                usec += os->get_ticks_usec() - start;
+                selected[ilayout] += TestLODQuadTree::get_selection_count(tree);
+            }
+
+            line += vformat("%s %s %.1f us (%d nodes)", ilayout > 0 ? "," : "", layout_names[ilayout], double(usec) / frames, int(selected[ilayout] / frames));
+        }
+
+        MESSAGE(line);
+        CHECK_MESSAGE(selected[0] == selected[1], "Both layouts must select the same nodes.");
+    }
+}
+
+TEST_CASE("[Terrainer][LODQuadTree][Benchmark] Parallel selection scaling") {
+    LODQuadTree tree;
+    Ref<MapStorage> storage;
+    storage.instantiate();
+    TestLODQuadTree::setup(tree, storage, MapStorage::MINMAX_LAYOUT_MORTON, TestLODQuadTree::get_benchmark_world_regions());
+    LocalVector<TestLODQuadTree::SectorSelection> sectors;
+    TestLODQuadTree::get_sectors(tree, sectors);
+    const int frames = 240;
+    const int threads = WorkerThreadPool::get_singleton()->get_thread_count();
+    OS *os = OS::get_singleton();
+
+    // Serial first, then 1, 2, 4... worker tasks up to every thread of the pool.
+    LocalVector<int> task_counts;
+    task_counts.push_back(0);
+
+    for (int tasks = 1; tasks < threads; tasks *= 2) {
+        task_counts.push_back(tasks);
+    }
+
+    task_counts.push_back(threads);
+    String line = vformat("Selection with %d pool threads:", threads);
+    double serial_usec = 0.0;
+    int64_t serial_selected = 0;
+
+    for (uint32_t i = 0; i < task_counts.size(); ++i) {
+        const int tasks = task_counts[i];
+        // From scratch every frame, with the screen space error for more nodes per sector.
+        TestLODQuadTree::set_modes(tree, tasks > 0, false, true);
+        TestLODQuadTree::set_parallel_tasks(tree, MAX(tasks, 1));
+        uint64_t usec = 0;
+        int64_t selected = 0;
+
+        for (int frame = 0; frame < frames; ++frame) {
+            const Vector3 position = TestLODQuadTree::get_benchmark_position(frame, frames);
+            TestLODQuadTree::set_frustum(tree, TestLODQuadTree::get_benchmark_frustum(frame, frames));
+            const uint64_t start = os->get_ticks_usec();
+            tree.select_sectors(position, storage, sectors.ptr(), sectors.size());
+            usec += os->get_ticks_usec() - start;
+            selected += TestLODQuadTree::get_selection_count(tree);
+        }
+
+        const double frame_usec = MAX(double(usec), 1.0) / frames;
+
+        if (tasks == 0) {
+            serial_usec = frame_usec;
+            serial_selected = selected;
+            line += vformat(" serial %.1f us", frame_usec);
+        } else {
+            line += vformat(", %d tasks %.1f us (x%.2f)", tasks, frame_usec, serial_usec / frame_usec);
+            CHECK_MESSAGE(selected == serial_selected, vformat("%d tasks selected a different number of nodes.", tasks));
+        }
+    }
+
+    MESSAGE(line);
+}
+
+} // namespace TestTerrainer
+
+#endif // TERRAINER_TEST_LOD_QUAD_TREE_H
@@ -0,0 +1,353 @@
+/**
+ * test_map_storage_query.h
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#ifndef TERRAINER_TEST_MAP_STORAGE_QUERY_H
+#define TERRAINER_TEST_MAP_STORAGE_QUERY_H
+
+// Module defines, written by SCsub for the test build.
+#include "test_defines.gen.h"
+
+#include "../map_storage/map_storage.h"
+
+#include "core/math/geometry_3d.h"
+#include "core/math/random_pcg.h"
+#include "core/object/worker_thread_pool.h"
+#include "core/os/os.h"
+#include "tests/test_macros.h"
+
+namespace TestTerrainer {
+
+using Terrainer::MapStorage;
+
+static const int QUERY_CHUNK_SIZE = 32;
+static const int QUERY_SECTOR_CHUNKS = 4;
+static const int QUERY_LODS = 3;
+static const int QUERY_SECTORS = 2; // Per axis, all of them resident.
+static constexpr real_t QUERY_FAR_VIEW = 1000.0;
+
+static Vector3 get_query_map_scale() {
+    return Vector3(2.0, 0.02, 2.0);
+}
+
+// Rolling heights with noise, the same sample for every chunk sharing it.
+static MapStorage::hmap_t get_query_height(int p_x, int p_z) {
+    const uint32_t noise = hash_murmur3_one_32(p_x, hash_murmur3_one_32(p_z));
+    const real_t rolling = 4000.0 * Math::sin(p_x * real_t(0.045)) * Math::cos(p_z * real_t(0.061)) + 600.0 * Math::sin(p_x * real_t(0.31) + p_z * real_t(0.17));
+    return MapStorage::hmap_t(10000 + int(rolling) + int(noise % 200));
+}
+
+static void get_query_chunk(int p_chunk_x, int p_chunk_z, LocalVector<MapStorage::hmap_t> &r_heights) {
+    const int stride = QUERY_CHUNK_SIZE + 1;
+    r_heights.resize(stride * stride);
+
+    for (int iz = 0; iz < stride; ++iz) {
+        for (int ix = 0; ix < stride; ++ix) {
+            r_heights[ix + iz * stride] = get_query_height(p_chunk_x * QUERY_CHUNK_SIZE + ix, p_chunk_z * QUERY_CHUNK_SIZE + iz);
+        }
+    }
+}
+
+// Minmax bounds from the chunk heights, and the heights themselves when p_heights.
+static void setup_query_storage(const Ref<MapStorage> &p_storage, bool p_heights) {
+    const int chunks = QUERY_SECTORS * QUERY_SECTOR_CHUNKS;
+    p_storage->set_chunk_size(QUERY_CHUNK_SIZE);
+    p_storage->set_region_size(QUERY_SECTOR_CHUNKS);
+    p_storage->allocate_buffers(QUERY_SECTOR_CHUNKS, chunks * chunks, QUERY_LODS, get_query_map_scale(), QUERY_FAR_VIEW);
+    LocalVector<MapStorage::hmap_t> minmax;
+    LocalVector<MapStorage::hmap_t> heights;
+    minmax.resize(2 * QUERY_SECTOR_CHUNKS * QUERY_SECTOR_CHUNKS);
+
+    for (int sz = 0; sz < QUERY_SECTORS; ++sz) {
+        for (int sx = 0; sx < QUERY_SECTORS; ++sx) {
+            const MapStorage::CellKey sector = MapStorage::CellKey(sx, sz);
+
+            for (int cz = 0; cz < QUERY_SECTOR_CHUNKS; ++cz) {
+                for (int cx = 0; cx < QUERY_SECTOR_CHUNKS; ++cx) {
+                    get_query_chunk(sx * QUERY_SECTOR_CHUNKS + cx, sz * QUERY_SECTOR_CHUNKS + cz, heights);
+                    MapStorage::hmap_t min_y = UINT16_MAX;
+                    MapStorage::hmap_t max_y = 0;
+
+                    for (MapStorage::hmap_t h : heights) {
+                        min_y = MIN(min_y, h);
+                        max_y = MAX(max_y, h);
+                    }
+
+                    minmax[2 * (cx + cz * QUERY_SECTOR_CHUNKS)] = min_y;
+                    minmax[2 * (cx + cz * QUERY_SECTOR_CHUNKS) + 1] = max_y;
+
+                    if (p_heights) {
+                        CHECK(p_storage->set_node_heights(MapStorage::NodeKey(sector, MapStorage::CellKey(cx, cz)), 0, heights.ptr()));
+                    }
+                }
+            }
+
+            CHECK(p_storage->set_sector_minmax(sector, minmax.ptr()));
+        }
+    }
+}
+
+// Nearest hit against every triangle of the resident chunks, split like the chunk mesh.
+static bool brute_force_ray(const Vector3 &p_from, const Vector3 &p_direction, real_t p_max_distance, real_t &r_distance) {
+    const Vector3 scale = get_query_map_scale();
+    const int cells = QUERY_SECTORS * QUERY_SECTOR_CHUNKS * QUERY_CHUNK_SIZE;
+    r_distance = p_max_distance;
+    bool hit = false;
+
+    for (int z = 0; z < cells; ++z) {
+        for (int x = 0; x < cells; ++x) {
+            const real_t x0 = x * scale.x;
+            const real_t z0 = z * scale.z;
+            const Vector3 v00 = Vector3(x0, get_query_height(x, z) * scale.y, z0);
+            const Vector3 v10 = Vector3(x0 + scale.x, get_query_height(x + 1, z) * scale.y, z0);
+            const Vector3 v01 = Vector3(x0, get_query_height(x, z + 1) * scale.y, z0 + scale.z);
+            const Vector3 v11 = Vector3(x0 + scale.x, get_query_height(x + 1, z + 1) * scale.y, z0 + scale.z);
+            // Chunks start on even cells, so the local parity is the global one.
+            const bool even = ((x + z) & 1) == 0;
+            const Vector3 triangles[2][3] = {
+                { v00, even ? v01 : v11, v10 },
+                { even ? v10 : v00, v01, v11 }
+            };
+
+            for (int i = 0; i < 2; ++i) {
+                Vector3 point;
+
+                if (Geometry3D::ray_intersects_triangle(p_from, p_direction, triangles[i][0], triangles[i][1], triangles[i][2], &point)) {
+                    const real_t d = p_direction.dot(point - p_from);
+
+                    if (d <= r_distance) {
+                        r_distance = d;
+                        hit = true;
+                    }
+                }
+            }
+        }
+    }
+
+    return hit;
+}
+
+// Rays from above the terrain, most of them looking down, some starting outside the
+// resident sectors and some looking up.
+static void make_query_rays(LocalVector<Vector3> &r_from, LocalVector<Vector3> &r_directions, int p_count, uint64_t p_seed) {
+    const real_t extent = QUERY_SECTORS * QUERY_SECTOR_CHUNKS * QUERY_CHUNK_SIZE * get_query_map_scale().x;
+    RandomPCG rng(p_seed);
+    r_from.resize(p_count);
+    r_directions.resize(p_count);
+
+    for (int i = 0; i < p_count; ++i) {
+        const real_t margin = i % 8 == 0 ? -0.2 * extent : 0.05 * extent;
+        r_from[i] = Vector3(rng.random(margin, extent - margin), rng.random(310.0, 420.0), rng.random(margin, extent - margin));
+        const real_t angle = rng.random(0.0, Math_TAU);
+        const real_t y = i % 16 == 1 ? rng.random(0.05, 1.0) : rng.random(-1.0, -0.25);
+        const real_t xz = Math::sqrt(1.0 - y * y);
+        r_directions[i] = Vector3(xz * Math::cos(angle), y, xz * Math::sin(angle));
+    }
+}
+
+TEST_CASE("[Terrainer][MapStorage] Exact ray hits match a brute force triangle scan") {
+    Ref<MapStorage> storage;
+    storage.instantiate();
+    setup_query_storage(storage, true);
+    const int count = 256;
+    const real_t max_distance = 1500.0;
+    LocalVector<Vector3> from;
+    LocalVector<Vector3> directions;
+    LocalVector<MapStorage::RayResult> results;
+    make_query_rays(from, directions, count, 7);
+    results.resize(count);
+    storage->intersect_rays(from.ptr(), directions.ptr(), count, max_distance, results.ptr());
+    int hits = 0;
+
+    for (int i = 0; i < count; ++i) {
+        const MapStorage::RayResult &result = results[i];
+        real_t distance;
+        const bool hit = brute_force_ray(from[i], directions[i], max_distance, distance);
+        hits += hit;
+
+        CHECK_MESSAGE(result.hit == hit, vformat("Ray %d from %s: %s, the triangle scan %s.", i, from[i], result.hit ? "hit" : "missed", hit ? "hit" : "missed"));
+
+        if (!hit || !result.hit) {
+            continue;
+        }
+
+        CHECK_MESSAGE(result.exact, vformat("Ray %d hit the bounds with resident heights.", i));
+        CHECK_MESSAGE(Math::is_equal_approx(result.distance, distance, real_t(0.01)), vformat("Ray %d hit at %f, the triangle scan at %f.", i, result.distance, distance));
+        CHECK_MESSAGE(result.position.is_equal_approx(from[i] + directions[i] * distance), vformat("Ray %d hit at %s.", i, result.position));
+        CHECK(result.normal.y > 0.0);
+    }
+
+    // Most rays look down from over the terrain, but not all of them.
+    CHECK(hits > count / 2);
+    CHECK(hits < count);
+}
+
+TEST_CASE("[Terrainer][MapStorage][Benchmark] Ray queries per second") {
+    const int count = 1 << 16;
+    const real_t max_distance = 1500.0;
+    LocalVector<Vector3> from;
+    LocalVector<Vector3> directions;
+    LocalVector<MapStorage::RayResult> results;
+    make_query_rays(from, directions, count, 11);
+    results.resize(count);
+    OS *os = OS::get_singleton();
+    String line = vformat("Ray queries with %d pool threads:", WorkerThreadPool::get_singleton()->get_thread_count());
+
+    for (int heights = 0; heights < 2; ++heights) {
+        Ref<MapStorage> storage;
+        storage.instantiate();
+        setup_query_storage(storage, heights == 1);
+        // Warm up, then the batch and the same rays one by one.
+        storage->intersect_rays(from.ptr(), directions.ptr(), count, max_distance, results.ptr());
+        uint64_t start = os->get_ticks_usec();
+        storage->intersect_rays(from.ptr(), directions.ptr(), count, max_distance, results.ptr());
+        const double batch_usec = MAX(double(os->get_ticks_usec() - start), 1.0);
+        start = os->get_ticks_usec();
+
+        for (int i = 0; i < count; ++i) {
+            storage->intersect_ray(from[i], directions[i], max_distance, results[i]);
+        }
+
+        const double serial_usec = MAX(double(os->get_ticks_usec() - start), 1.0);
+        int hits = 0;
+
+        for (const MapStorage::RayResult &result : results) {
+            hits += result.hit;
+        }
+
+        line += vformat("%s %s %.2f M rays/s batched, %.2f M rays/s serial (%d%% hits)", heights ? "," : "", heights ? "exact" : "bounds only",
+                count / batch_usec, count / serial_usec, 100 * hits / count);
+    }
+
+    MESSAGE(line);
+}
+
+// Bounds of a chunk at LOD 0, as given to set_sector_minmax.
+static void get_query_chunk_minmax(int p_chunk_x, int p_chunk_z, real_t &r_min_y, real_t &r_max_y) {
+    LocalVector<MapStorage::hmap_t> heights;
+    get_query_chunk(p_chunk_x, p_chunk_z, heights);
+    MapStorage::hmap_t min_y = UINT16_MAX;
+    MapStorage::hmap_t max_y = 0;
+
+    for (MapStorage::hmap_t h : heights) {
+        min_y = MIN(min_y, h);
+        max_y = MAX(max_y, h);
+    }
+
+    r_min_y = min_y * get_query_map_scale().y;
+    r_max_y = max_y * get_query_map_scale().y;
+}
+
+TEST_CASE("[Terrainer][MapStorage] Sectors that aren't loaded never block the view") {
+    Ref<MapStorage> storage;
+    storage.instantiate();
+    setup_query_storage(storage, true);
+    const real_t sector_size = QUERY_SECTOR_CHUNKS * QUERY_CHUNK_SIZE * get_query_map_scale().x;
+
+    // Under the terrain, across the second resident sector and then past the last one.
+    for (int i = 0; i < 8; ++i) {
+        const real_t z = (i + 0.5) * sector_size / 8;
+        const Vector3 from = Vector3(sector_size + 10.0, 1.0, z);
+        const Vector3 to = Vector3(2.0 * sector_size - 10.0, 1.0, z);
+        CHECK_MESSAGE(!storage->is_visible(from, to), vformat("Resident sector, line at z %f isn't blocked.", z));
+        CHECK_MESSAGE(storage->is_visible(from + Vector3(sector_size, 0.0, 0.0), to + Vector3(sector_size, 0.0, 0.0)), vformat("Sector without data, line at z %f is blocked.", z));
+    }
+}
+
+TEST_CASE("[Terrainer][MapStorage] Leaves without heights only block below their minimum") {
+    Ref<MapStorage> storage;
+    storage.instantiate();
+    setup_query_storage(storage, false);
+    const Vector3 scale = get_query_map_scale();
+    const real_t chunk_size = QUERY_CHUNK_SIZE * scale.x;
+
+    // Lines along the middle of a chunk, far enough from its edges to cross only that leaf.
+    for (int cz = 0; cz < 4; ++cz) {
+        for (int cx = 0; cx < 4; ++cx) {
+            real_t min_y;
+            real_t max_y;
+            get_query_chunk_minmax(cx, cz, min_y, max_y);
+            const Vector3 from = Vector3((cx + 0.1) * chunk_size, 0.0, (cz + 0.5) * chunk_size);
+            const Vector3 to = Vector3((cx + 0.9) * chunk_size, 0.0, (cz + 0.5) * chunk_size);
+            const Vector3 below = Vector3(0.0, min_y - 0.1, 0.0);
+            const Vector3 above_min = Vector3(0.0, min_y + 0.1, 0.0);
+            const Vector3 middle = Vector3(0.0, 0.5 * (min_y + max_y), 0.0);
+
+            CHECK_MESSAGE(!storage->is_visible(from + below, to + below), vformat("Chunk %d, %d: line under its minimum isn't blocked.", cx, cz));
+            CHECK_MESSAGE(storage->is_visible(from + above_min, to + above_min), vformat("Chunk %d, %d: line over its minimum is blocked.", cx, cz));
+            CHECK_MESSAGE(storage->is_visible(from + middle, to + middle), vformat("Chunk %d, %d: line inside its bounds is blocked.", cx, cz));
+            // Sloped, from under the minimum to over the maximum.
+            CHECK_MESSAGE(!storage->is_visible(from + below, to + Vector3(0.0, max_y + 1.0, 0.0)), vformat("Chunk %d, %d: line starting under its minimum isn't blocked.", cx, cz));
+        }
+    }
+}
+
+TEST_CASE("[Terrainer][MapStorage][Benchmark] Visibility queries per second") {
+    // Per core, enough for the line of sight checks of a few thousand agents every frame.
+    const double target_per_core = 100000.0;
+    const int count = 1 << 16;
+    const real_t extent = QUERY_SECTORS * QUERY_SECTOR_CHUNKS * QUERY_CHUNK_SIZE * get_query_map_scale().x;
+    const int threads = WorkerThreadPool::get_singleton()->get_thread_count();
+    LocalVector<Vector3> from;
+    LocalVector<Vector3> to;
+    LocalVector<uint8_t> mask;
+    from.resize(count);
+    to.resize(count);
+    mask.resize((count + 7) / 8);
+    OS *os = OS::get_singleton();
+    String line = vformat("Visibility queries with %d pool threads, target %.2f M/s per core:", threads, target_per_core / 1e6);
+
+    for (int heights = 0; heights < 2; ++heights) {
+        Ref<MapStorage> storage;
+        storage.instantiate();
+        setup_query_storage(storage, heights == 1);
+        RandomPCG rng(13);
+
+        // Eye height over the ground, up to 200 units apart.
+        for (int i = 0; i < count; ++i) {
+            const Vector2 a = Vector2(rng.random(real_t(0.0), extent), rng.random(real_t(0.0), extent));
+            const real_t angle = rng.random(0.0, Math_TAU);
+            const real_t distance = rng.random(1.0, 200.0);
+            const Vector2 b = Vector2(CLAMP(a.x + distance * Math::cos(angle), real_t(0.0), extent), CLAMP(a.y + distance * Math::sin(angle), real_t(0.0), extent));
+            from[i] = Vector3(a.x, storage->get_height(a) + 1.8, a.y);
+            to[i] = Vector3(b.x, storage->get_height(b) + 1.8, b.y);
+        }
+
+        // Warm up, then the batch and the same queries one by one.
+        storage->get_visibility(from.ptr(), to.ptr(), count, mask.ptr());
+        uint64_t start = os->get_ticks_usec();
+        storage->get_visibility(from.ptr(), to.ptr(), count, mask.ptr());
+        const double batch_usec = MAX(double(os->get_ticks_usec() - start), 1.0);
+        int visible = 0;
+        start = os->get_ticks_usec();
+
+        for (int i = 0; i < count; ++i) {
+            visible += storage->is_visible(from[i], to[i]);
+        }
+
+        const double serial_usec = MAX(double(os->get_ticks_usec() - start), 1.0);
+        int masked = 0;
+
+        for (int i = 0; i < count; ++i) {
+            masked += (mask[i / 8] >> (i % 8)) & 1;
+        }
+
+        CHECK_MESSAGE(masked == visible, "The batch and the single queries must agree.");
+        const double serial_per_core = count / serial_usec * 1e6;
+        line += vformat("%s %s %.2f M/s batched, %.2f M/s per core (%s target, %d%% visible)", heights ? "," : "", heights ? "exact" : "bounds only",
+                count / batch_usec, serial_per_core / 1e6, serial_per_core >= target_per_core ? "over" : "under", 100 * visible / count);
+    }
+
+    MESSAGE(line);
+}
+
+} // namespace TestTerrainer
+
+#endif // TERRAINER_TEST_MAP_STORAGE_QUERY_H
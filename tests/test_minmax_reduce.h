@@ -0,0 +1,191 @@
+/**
+ * test_minmax_reduce.h
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#ifndef TERRAINER_TEST_MINMAX_REDUCE_H
+#define TERRAINER_TEST_MINMAX_REDUCE_H
+
+// Module defines, written by SCsub for the test build.
+#include "test_defines.gen.h"
+
+#include "../map_storage/minmax_reduce.h"
+
+#include "core/math/random_pcg.h"
+#include "core/os/os.h"
+#include "core/templates/local_vector.h"
+#include "tests/test_macros.h"
+
+#include <cstring>
+
+namespace TestTerrainer {
+
+// Random pairs, with the extremes of the range common enough to catch signed compares.
+static void fill_minmax_pairs(LocalVector<uint16_t> &r_pairs, uint32_t p_count, uint64_t p_seed) {
+    RandomPCG rng(p_seed);
+    r_pairs.resize(2 * p_count);
+
+    for (uint32_t i = 0; i < 2 * p_count; ++i) {
+        const uint32_t r = rng.rand();
+
+        switch (r & 7) {
+            case 0:
+                r_pairs[i] = 0;
+                break;
+            case 1:
+                r_pairs[i] = UINT16_MAX;
+                break;
+            case 2:
+                r_pairs[i] = 0x8000 + (r >> 16) % 2;
+                break;
+            default:
+                r_pairs[i] = uint16_t(r >> 16);
+        }
+    }
+}
+
+// Levels below a p_size square, all of them.
+static void allocate_minmax_levels(LocalVector<LocalVector<uint16_t>> &r_levels, LocalVector<uint16_t *> &r_pointers, int p_size) {
+    r_levels.clear();
+    r_pointers.clear();
+
+    for (int size = p_size >> 1; size > 0; size >>= 1) {
+        LocalVector<uint16_t> level;
+        level.resize(2 * size * size);
+        r_levels.push_back(level);
+    }
+
+    for (LocalVector<uint16_t> &level : r_levels) {
+        r_pointers.push_back(level.ptr());
+    }
+}
+
+TEST_CASE("[Terrainer][MinmaxReduce] Row kernels match the scalar one") {
+    const int counts[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 11, 15, 16, 17, 23, 31, 33, 63, 65, 127, 128, 129, 255, 1023, 2047, 2048 };
+    const int max_count = 2048;
+    // Canary after the last output pair, kernels must not write past it.
+    const uint16_t canary = 0xA5A5;
+    LocalVector<uint16_t> row0;
+    LocalVector<uint16_t> row1;
+    LocalVector<uint16_t> expected;
+    LocalVector<uint16_t> out;
+    fill_minmax_pairs(row0, 2 * max_count, 1);
+    fill_minmax_pairs(row1, 2 * max_count, 2);
+    expected.resize(2 * max_count + 2);
+    out.resize(2 * max_count + 2);
+
+    for (int kernel = 1; kernel < Terrainer::minmax_reduce_get_kernel_count(); ++kernel) {
+        const char *name = Terrainer::minmax_reduce_get_kernel_name(kernel);
+
+        for (int count : counts) {
+            // Unaligned rows too, every offset of a 32-byte vector.
+            for (int offset = 0; offset < 4; ++offset) {
+                const uint16_t *a = row0.ptr() + 4 * offset;
+                const uint16_t *b = row1.ptr() + 4 * offset + 2;
+                const int n = MIN(count, max_count - offset - 1);
+
+                for (uint32_t i = 0; i < out.size(); ++i) {
+                    expected[i] = canary;
+                    out[i] = canary;
+                }
+
+                Terrainer::minmax_reduce_row(0, a, b, expected.ptr(), n);
+                Terrainer::minmax_reduce_row(kernel, a, b, out.ptr(), n);
+                int mismatch = -1;
+
+                for (int i = 0; i < 2 * n + 2 && mismatch < 0; ++i) {
+                    if (out[i] != expected[i]) {
+                        mismatch = i;
+                    }
+                }
+
+                CHECK_MESSAGE(mismatch < 0, vformat("Kernel %s, %d pairs at offset %d: value %d differs from the scalar kernel.", name, n, offset, mismatch));
+            }
+        }
+    }
+}
+
+TEST_CASE("[Terrainer][MinmaxReduce] Pyramids match the scalar one") {
+    LocalVector<uint16_t> src;
+    LocalVector<LocalVector<uint16_t>> expected;
+    LocalVector<uint16_t *> expected_ptrs;
+    LocalVector<LocalVector<uint16_t>> levels;
+    LocalVector<uint16_t *> level_ptrs;
+
+    for (int size = 256; size <= 4096; size <<= 1) {
+        fill_minmax_pairs(src, size * size, size);
+        allocate_minmax_levels(expected, expected_ptrs, size);
+        allocate_minmax_levels(levels, level_ptrs, size);
+        Terrainer::minmax_reduce_with_kernel(0, src.ptr(), size, expected_ptrs.ptr(), expected_ptrs.size());
+
+        // The scalar kernel itself, on the first level.
+        const int half = size >> 1;
+        int wrong = -1;
+
+        for (int iz = 0; iz < half && wrong < 0; ++iz) {
+            for (int ix = 0; ix < half && wrong < 0; ++ix) {
+                const uint16_t *a = src.ptr() + 2 * (2 * iz * size + 2 * ix);
+                const uint16_t *b = a + 2 * size;
+                const uint16_t min_y = MIN(MIN(a[0], a[2]), MIN(b[0], b[2]));
+                const uint16_t max_y = MAX(MAX(a[1], a[3]), MAX(b[1], b[3]));
+                const uint32_t i = 2 * (iz * half + ix);
+
+                if (expected[0][i] != min_y || expected[0][i + 1] != max_y) {
+                    wrong = i;
+                }
+            }
+        }
+
+        CHECK_MESSAGE(wrong < 0, vformat("Scalar kernel, size %d: pair %d is wrong.", size, wrong / 2));
+
+        for (int kernel = 1; kernel < Terrainer::minmax_reduce_get_kernel_count(); ++kernel) {
+            Terrainer::minmax_reduce_with_kernel(kernel, src.ptr(), size, level_ptrs.ptr(), level_ptrs.size());
+
+            for (uint32_t ilevel = 0; ilevel < levels.size(); ++ilevel) {
+                const bool same = memcmp(levels[ilevel].ptr(), expected[ilevel].ptr(), expected[ilevel].size() * sizeof(uint16_t)) == 0;
+                CHECK_MESSAGE(same, vformat("Kernel %s, size %d: level %d differs from the scalar kernel.", Terrainer::minmax_reduce_get_kernel_name(kernel), size, ilevel + 1));
+            }
+        }
+    }
+}
+
+TEST_CASE("[Terrainer][MinmaxReduce][Benchmark] Pyramid throughput per kernel") {
+    LocalVector<uint16_t> src;
+    LocalVector<LocalVector<uint16_t>> levels;
+    LocalVector<uint16_t *> level_ptrs;
+    OS *os = OS::get_singleton();
+
+    for (int size = 256; size <= 4096; size <<= 1) {
+        fill_minmax_pairs(src, size * size, size);
+        allocate_minmax_levels(levels, level_ptrs, size);
+        // About the same number of source cells for every size.
+        const int runs = MAX(1, (4096 * 4096) / (size * size));
+        String line = vformat("Minmax pyramid of %d x %d:", size, size);
+
+        for (int kernel = 0; kernel < Terrainer::minmax_reduce_get_kernel_count(); ++kernel) {
+            // Warm up, so every level is in memory.
+            Terrainer::minmax_reduce_with_kernel(kernel, src.ptr(), size, level_ptrs.ptr(), level_ptrs.size());
+            const uint64_t start = os->get_ticks_usec();
+
+            for (int run = 0; run < runs; ++run) {
+                Terrainer::minmax_reduce_with_kernel(kernel, src.ptr(), size, level_ptrs.ptr(), level_ptrs.size());
+            }
+
+            const double usec = MAX(double(os->get_ticks_usec() - start), 1.0) / runs;
+            const double cells_per_sec = double(size) * size / usec * 1e6;
+            line += vformat(" %s %.3f ms (%.1f Mcells/s)", Terrainer::minmax_reduce_get_kernel_name(kernel), usec / 1000.0, cells_per_sec / 1e6);
+        }
+
+        MESSAGE(line.utf8().get_data());
+    }
+}
+
+} // namespace TestTerrainer
+
+#endif // TERRAINER_TEST_MINMAX_REDUCE_H
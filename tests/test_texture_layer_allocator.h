@@ -0,0 +1,200 @@
+/**
+ * test_texture_layer_allocator.h
+ * ==================================================================================
+ * Copyright (c) 2025-2026 Rafael Martínez Gordillo and the Terrainer contributors.
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ * ==================================================================================
+ */
+
+#ifndef TERRAINER_TEST_TEXTURE_LAYER_ALLOCATOR_H
+#define TERRAINER_TEST_TEXTURE_LAYER_ALLOCATOR_H
+
+// Module defines, written by SCsub for the test build.
+#include "test_defines.gen.h"
+
+#include "../map_storage/texture_layer_allocator.h"
+
+#include "core/templates/local_vector.h"
+#include "tests/test_macros.h"
+
+namespace TestTerrainer {
+
+typedef Terrainer::TextureLayerAllocator<int> LayerAllocator;
+
+// Keys of the evicted layers, refusing the ones below refuse_below.
+struct EvictionLog {
+    LocalVector<int> keys;
+    int refuse_below = -1;
+};
+
+static bool log_layer_eviction(void *p_owner, const int &p_key, uint8_t p_lod) {
+    EvictionLog *log = static_cast<EvictionLog *>(p_owner);
+
+    if (p_key < log->refuse_below) {
+        return false;
+    }
+
+    log->keys.push_back(p_key);
+    return true;
+}
+
+// Layer i for key i, with frames[i] as its last used frame.
+static void fill_layers(LayerAllocator &r_allocator, uint64_t *p_frames, int p_count) {
+    for (int i = 0; i < p_count; ++i) {
+        CHECK(r_allocator.allocate(i, &p_frames[i], Vector3(), 0) == i);
+    }
+}
+
+TEST_CASE("[Terrainer][TextureLayerAllocator] Growing keeps used layers in place") {
+    LayerAllocator allocator;
+    uint64_t frames[LayerAllocator::PAGE_LAYERS] = {};
+    CHECK(allocator.grow(10) == LayerAllocator::PAGE_LAYERS);
+
+    for (int i = 0; i < LayerAllocator::PAGE_LAYERS; ++i) {
+        CHECK(allocator.allocate(1000 + i, &frames[i], Vector3(), uint8_t(i % 4)) == i);
+    }
+
+    CHECK(allocator.allocate(0, &frames[0], Vector3(), 0) == LayerAllocator::INVALID_LAYER);
+    allocator.free(5);
+    allocator.free(40);
+
+    // At least double, in whole pages.
+    CHECK(allocator.grow(LayerAllocator::PAGE_LAYERS + 1) == 2 * LayerAllocator::PAGE_LAYERS);
+    CHECK(allocator.grow(10) == 2 * LayerAllocator::PAGE_LAYERS);
+    CHECK(allocator.get_used_count() == LayerAllocator::PAGE_LAYERS - 2);
+
+    for (int i = 0; i < 2 * LayerAllocator::PAGE_LAYERS; ++i) {
+        const bool used = i < LayerAllocator::PAGE_LAYERS && i != 5 && i != 40;
+        CHECK_MESSAGE(allocator.is_free(i) == !used, vformat("Layer %d changed its state when growing.", i));
+
+        if (used) {
+            CHECK_MESSAGE(allocator.get_key(i) == 1000 + i, vformat("Layer %d changed its key when growing.", i));
+            CHECK(allocator.get_lod(i) == i % 4);
+        }
+    }
+
+    // The maximum wins over pages and doubling.
+    allocator.set_max_capacity(3 * LayerAllocator::PAGE_LAYERS - 10);
+    CHECK(allocator.grow(1000) == 3 * LayerAllocator::PAGE_LAYERS - 10);
+    CHECK(allocator.grow(2000) == 3 * LayerAllocator::PAGE_LAYERS - 10);
+    CHECK(allocator.get_free_count() == allocator.get_capacity() - allocator.get_used_count());
+}
+
+TEST_CASE("[Terrainer][TextureLayerAllocator] Lowest free layer first") {
+    LayerAllocator allocator;
+    uint64_t frames[3 * LayerAllocator::PAGE_LAYERS] = {};
+    allocator.grow(3 * LayerAllocator::PAGE_LAYERS);
+    fill_layers(allocator, frames, 2 * LayerAllocator::PAGE_LAYERS + 3);
+
+    // Freed in any order, across pages, taken again from the lowest one.
+    const int freed[] = { 130, 70, 3, 64, 127 };
+    const int expected[] = { 3, 64, 70, 127, 130, 2 * LayerAllocator::PAGE_LAYERS + 3 };
+
+    for (int layer : freed) {
+        allocator.free(layer);
+    }
+
+    for (int layer : expected) {
+        CHECK_MESSAGE(allocator.allocate(layer, &frames[layer], Vector3(), 0) == layer, vformat("Layer %d wasn't the lowest free one.", layer));
+    }
+}
+
+TEST_CASE("[Terrainer][TextureLayerAllocator] Used layers get a second chance") {
+    LayerAllocator allocator;
+    EvictionLog log;
+    uint64_t frames[LayerAllocator::PAGE_LAYERS] = {};
+    allocator.set_owner(&log, log_layer_eviction);
+    allocator.grow(LayerAllocator::PAGE_LAYERS);
+    fill_layers(allocator, frames, LayerAllocator::PAGE_LAYERS);
+
+    // Even layers are used every frame, odd ones never again. No distance, one chance each.
+    for (uint64_t frame = 1; frame <= 4; ++frame) {
+        for (int i = 0; i < LayerAllocator::PAGE_LAYERS; i += 2) {
+            frames[i] = frame;
+        }
+
+        CHECK(allocator.evict(LayerAllocator::PAGE_LAYERS / 8, Vector3(), 0.0) == LayerAllocator::PAGE_LAYERS / 8);
+    }
+
+    CHECK(log.keys.size() == LayerAllocator::PAGE_LAYERS / 2);
+
+    for (int key : log.keys) {
+        CHECK_MESSAGE(key % 2 == 1, vformat("Layer %d was evicted while in use.", key));
+    }
+
+    // Without unused layers left, the used ones go after their chance.
+    CHECK(allocator.evict(1, Vector3(), 0.0) == 1);
+    CHECK(allocator.get_total_evictions() == LayerAllocator::PAGE_LAYERS / 2 + 1);
+}
+
+TEST_CASE("[Terrainer][TextureLayerAllocator] Nearer layers get more chances") {
+    LayerAllocator allocator;
+    EvictionLog log;
+    uint64_t frames[LayerAllocator::PAGE_LAYERS] = {};
+    const real_t far_distance = 10.0 * LayerAllocator::PAGE_LAYERS;
+    allocator.set_owner(&log, log_layer_eviction);
+    allocator.grow(LayerAllocator::PAGE_LAYERS);
+
+    // Further with the index, the last ones coarse enough to count as near.
+    for (int i = 0; i < LayerAllocator::PAGE_LAYERS; ++i) {
+        const uint8_t lod = i >= LayerAllocator::PAGE_LAYERS - 4 ? 2 : 0;
+        CHECK(allocator.allocate(i, &frames[i], Vector3(10.0 * i, 0.0, 0.0), lod) == i);
+    }
+
+    // All used once, then none again. The furthest third get a single chance.
+    for (int i = 0; i < LayerAllocator::PAGE_LAYERS; ++i) {
+        frames[i] = 1;
+    }
+
+    LocalVector<int> single_chance;
+
+    for (int i = 0; i < LayerAllocator::PAGE_LAYERS - 4; ++i) {
+        if (3.0 * (1.0 - 10.0 * i / far_distance) < 1.0) {
+            single_chance.push_back(i);
+        }
+    }
+
+    CHECK(allocator.evict(single_chance.size(), Vector3(), far_distance) == int(single_chance.size()));
+
+    for (int key : log.keys) {
+        CHECK_MESSAGE(single_chance.find(key) >= 0, vformat("Layer %d was evicted before the furthest ones.", key));
+    }
+
+    // Then the rest, from the furthest.
+    log.keys.clear();
+    CHECK(allocator.evict(LayerAllocator::PAGE_LAYERS, Vector3(), far_distance) == LayerAllocator::PAGE_LAYERS - int(single_chance.size()));
+    CHECK(allocator.get_used_count() == 0);
+    CHECK(log.keys[log.keys.size() - 1] < LayerAllocator::PAGE_LAYERS / 4);
+}
+
+TEST_CASE("[Terrainer][TextureLayerAllocator] Refused evictions keep their layers") {
+    LayerAllocator allocator;
+    EvictionLog log;
+    uint64_t frames[LayerAllocator::PAGE_LAYERS] = {};
+    log.refuse_below = 8;
+    allocator.set_owner(&log, log_layer_eviction);
+    allocator.grow(LayerAllocator::PAGE_LAYERS);
+    fill_layers(allocator, frames, LayerAllocator::PAGE_LAYERS);
+
+    // Asking for more than it can give ends after two turns of the hand.
+    CHECK(allocator.evict(LayerAllocator::PAGE_LAYERS, Vector3(), 0.0) == LayerAllocator::PAGE_LAYERS - 8);
+    CHECK(allocator.get_used_count() == 8);
+    CHECK(allocator.get_total_evictions() == LayerAllocator::PAGE_LAYERS - 8);
+
+    for (int i = 0; i < 8; ++i) {
+        CHECK(!allocator.is_free(i));
+        CHECK(allocator.get_key(i) == i);
+    }
+
+    // Accepted once the owner is done with them.
+    log.refuse_below = -1;
+    CHECK(allocator.evict(8, Vector3(), 0.0) == 8);
+    CHECK(allocator.get_used_count() == 0);
+}
+
+} // namespace TestTerrainer
+
+#endif // TERRAINER_TEST_TEXTURE_LAYER_ALLOCATOR_H
@@ -91,6 +91,21 @@ inline int lod_expand(int p_size, int p_lods) {
 	return int(4.0 * p_size * (1.0 - 1.0 / float(1 << (2 * p_lods))) / 3.0);
 }
 
+// Spread the lower 16 bits of p_x to the even bits of the result.
+_ALWAYS_INLINE_ uint32_t morton_part1by1(uint32_t p_x) {
+	p_x &= 0x0000FFFF;
+	p_x = (p_x | (p_x << 8)) & 0x00FF00FF;
+	p_x = (p_x | (p_x << 4)) & 0x0F0F0F0F;
+	p_x = (p_x | (p_x << 2)) & 0x33333333;
+	p_x = (p_x | (p_x << 1)) & 0x55555555;
+	return p_x;
+}
+
+// Z-order index of a cell, x in the even bits and z in the odd bits.
+_ALWAYS_INLINE_ uint32_t morton_encode(uint32_t p_x, uint32_t p_z) {
+	return morton_part1by1(p_x) | (morton_part1by1(p_z) << 1);
+}
+
 #ifdef TERRAINER_MODULE
 #define MAKE_HALF_FLOAT(v) Math::make_half_float(v)
 #elif TERRAINER_GDEXTENSION